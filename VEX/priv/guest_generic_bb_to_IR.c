@@ -1204,6 +1204,12 @@ static void add_extent ( /*MOD*/VexGuestExtents* vge, Addr base, UShort len )
    needs a check.  Since there can be at most 3 extents, the returned
    values must be between 0 and 7.
 
+   hot_successor, if non-NULL, is asked which way a conditional branch
+   usually goes when the branch can't be folded into an &&-idiom.  If
+   it knows, the trace continues into the hot successor and the other
+   one becomes a side exit.  This lets a hot path through several
+   blocks, such as a loop body, be optimised as one superblock.
+
    The number of extents which did get a self check (0 to 3) is put in
    n_sc_extents.  The caller already knows this because it told us
    which extents to add checks for, via the needs_self_check callback,
@@ -1268,12 +1274,14 @@ IRSB* bb_to_IR (
          /*OUT*/UInt*            n_guest_instrs, /* stats only */
          /*OUT*/UShort*          n_uncond_in_trace, /* stats only */
          /*OUT*/UShort*          n_cond_in_trace, /* stats only */
+         /*OUT*/UShort*          n_hot_in_trace, /* stats only */
          /*MOD*/VexRegisterUpdates* pxControl,
          /*IN*/ void*            callback_opaque,
          /*IN*/ DisOneInstrFn    dis_instr_fn,
          /*IN*/ const UChar*     guest_code,
          /*IN*/ Addr             guest_IP_sbstart,
          /*IN*/ Bool             (*chase_into_ok)(void*,Addr),
+         /*IN*/ Addr             (*hot_successor)(void*,Addr,Addr),
          /*IN*/ VexEndness       host_endness,
          /*IN*/ Bool             sigill_diag,
          /*IN*/ VexArch          arch_guest,
@@ -1313,6 +1321,7 @@ IRSB* bb_to_IR (
    *n_guest_instrs = 0;
    *n_uncond_in_trace = 0;
    *n_cond_in_trace   = 0;
+   *n_hot_in_trace    = 0;
 
    /* And a new IR superblock to dump the result into. */
    IRSB* irsb = emptyIRSB();
@@ -1661,8 +1670,60 @@ IRSB* bb_to_IR (
             update_instr_budget(&instrs_avail, &verbose_mode,
                                 sx_instrs_used, sx_verbose_seen);
             *n_cond_in_trace += 1;
+            break;
          }
-         break;
+
+         // Not an &&-idiom.  If the caller knows which way the branch
+         // usually goes, continue the trace on that side, and leave the
+         // other as a side exit.  The hot side is made the fall through
+         // first.
+         Addr hot = 0;
+         if (hot_successor) {
+            hot = hot_successor(
+                     callback_opaque,
+                     (Addr)((Long)guest_IP_sbstart + irsb_be.Be.Cond.deltaSX),
+                     (Addr)((Long)guest_IP_sbstart + irsb_be.Be.Cond.deltaFT));
+         }
+         if (hot == 0)
+            break;
+         if (hot == (Addr)((Long)guest_IP_sbstart + irsb_be.Be.Cond.deltaSX))
+            swap_sx_and_ft(irsb, &irsb_be);
+         vassert(hot
+                 == (Addr)((Long)guest_IP_sbstart + irsb_be.Be.Cond.deltaFT));
+
+         if (debug_print) {
+            vex_printf("\n-+-+ Hot follow (ext# %d) to 0x%llx -+-+\n\n",
+                       (Int)vge->n_used, (ULong)hot);
+         }
+         // The hot side has been run before, so any message about
+         // undecodable instructions in it has been printed already.
+         Int    hot_instrs_used  = 0;
+         Bool   hot_verbose_seen = False;
+         Addr   hot_base         = 0;
+         UShort hot_len          = 0;
+         IRSB*  hot_bb
+            = disassemble_basic_block_till_stop(
+                 /*OUT*/ &hot_instrs_used, &hot_verbose_seen,
+                         &hot_base, &hot_len,
+                 /*MOD*/ emptyIRSB(),
+                 /*IN*/  irsb_be.Be.Cond.deltaFT,
+                 instrs_avail, guest_IP_sbstart, host_endness,
+                 /*sigill_diag=*/False,
+                 arch_guest, archinfo_guest, abiinfo_both, guest_word_type,
+                 debug_print, dis_instr_fn, guest_code, offB_GUEST_IP
+              );
+         vassert(hot_instrs_used <= instrs_avail);
+
+         /* The side exit stays where it is; only the fall through
+            continuation is replaced by the hot block. */
+         concatenate_irsbs(irsb, hot_bb);
+
+         // Update instrs_used, extents, budget.
+         instrs_used += hot_instrs_used;
+         add_extent(vge, hot_base, hot_len);
+         update_instr_budget(&instrs_avail, &verbose_mode,
+                             hot_instrs_used, hot_verbose_seen);
+         *n_hot_in_trace += 1;
       } // if (be.tag == Be_Cond)
 
       // We don't know any other way to extend the block.  Give up.
@@ -145,12 +145,14 @@ IRSB* bb_to_IR (
          /*OUT*/UInt*            n_guest_instrs, /* stats only */
          /*OUT*/UShort*          n_uncond_in_trace, /* stats only */
          /*OUT*/UShort*          n_cond_in_trace, /* stats only */
+         /*OUT*/UShort*          n_hot_in_trace, /* stats only */
          /*MOD*/VexRegisterUpdates* pxControl,
          /*IN*/ void*            callback_opaque,
          /*IN*/ DisOneInstrFn    dis_instr_fn,
          /*IN*/ const UChar*     guest_code,
          /*IN*/ Addr             guest_IP_bbstart,
          /*IN*/ Bool             (*chase_into_ok)(void*,Addr),
+         /*IN*/ Addr             (*hot_successor)(void*,Addr,Addr),
          /*IN*/ VexEndness       host_endness,
          /*IN*/ Bool             sigill_diag,
          /*IN*/ VexArch          arch_guest,
@@ -299,6 +299,24 @@ void LibVEX_Init (
 }
 
 
+/* Exported to library client. */
+
+void LibVEX_Update_Control ( const VexControl* vcon )
+{
+   vassert(vex_initdone);
+   vassert(vcon->iropt_verbosity >= 0);
+   vassert(vcon->iropt_level >= 0);
+   vassert(vcon->iropt_level <= 2);
+   vassert(vcon->iropt_unroll_thresh >= 0);
+   vassert(vcon->iropt_unroll_thresh <= 400);
+   vassert(vcon->guest_max_insns >= 1);
+   vassert(vcon->guest_max_insns <= 100);
+   vassert(vcon->guest_chase == False || vcon->guest_chase == True);
+   vassert(vcon->regalloc_version == 2 || vcon->regalloc_version == 3);
+   vex_control = *vcon;
+}
+
+
 /* --------- Make a translation. --------- */
 
 /* KLUDGE: S390 need to know the hwcaps of the host when generating
@@ -556,6 +574,7 @@ IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
    res->n_guest_instrs = 0;
    res->n_uncond_in_trace = 0;
    res->n_cond_in_trace = 0;
+   res->n_hot_in_trace = 0;
 
 #ifndef VEXMULTIARCH
    /* yet more sanity checks ... */
@@ -585,12 +604,14 @@ IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
                      &res->n_guest_instrs,
                      &res->n_uncond_in_trace,
                      &res->n_cond_in_trace,
+                     &res->n_hot_in_trace,
                      pxControl,
                      vta->callback_opaque,
                      disInstrFn,
                      vta->guest_bytes, 
                      vta->guest_bytes_addr,
                      vta->chase_into_ok,
+                     vta->hot_successor,
                      vta->archinfo_host.endness,
                      vta->sigill_diag,
                      vta->arch_guest,
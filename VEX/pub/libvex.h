@@ -635,6 +635,10 @@ extern void LibVEX_Init (
    const VexControl* vcon
 );
 
+/* Change the settings given to LibVEX_Init.  They apply to the
+   translations made afterwards. */
+extern void LibVEX_Update_Control ( const VexControl* vcon );
+
 
 /*-------------------------------------------------------*/
 /*--- Make a translation                              ---*/
@@ -660,6 +664,9 @@ typedef
       /* Stats only: the number of conditional branches incorporated into the
          trace. */
       UShort n_cond_in_trace;
+      /* Stats only: the number of conditional branches across which
+         the trace was continued into the hot successor. */
+      UShort n_hot_in_trace;
    }
    VexTranslateResult;
 
@@ -712,6 +719,13 @@ typedef
 	 NULL. */
       Bool    (*chase_into_ok) ( /*callback_opaque*/void*, Addr );
 
+      /* IN: optionally, a callback which says which way a conditional
+         branch usually goes, so that the trace can be continued on
+         that side, with the other side as a side exit.  Given the
+         side-exit and fall-through destinations, it returns the hot
+         one, or 0 if it doesn't know.  May be NULL. */
+      Addr    (*hot_successor) ( /*callback_opaque*/void*, Addr, Addr );
+
       /* OUT: which bits of guest code actually got translated */
       VexGuestExtents* guest_extents;
 
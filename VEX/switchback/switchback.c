@@ -587,6 +587,7 @@ void make_translation ( Addr guest_addr, Bool verbose )
    vta.guest_bytes      = (UChar*)guest_addr;
    vta.guest_bytes_addr = guest_addr;
    vta.chase_into_ok    = chase_into_ok;
+   vta.hot_successor    = NULL;
 //   vta.guest_extents    = &vge;
    vta.guest_extents    = &trans_table[trans_table_used];
    vta.host_bytes       = transbuf;
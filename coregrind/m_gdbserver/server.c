@@ -24,6 +24,7 @@
 #include "server.h"
 #include "regdef.h"
 #include "pub_core_options.h"
+#include "pub_core_transcache.h"
 #include "pub_core_translate.h"
 #include "pub_core_mallocfree.h"
 #include "pub_core_initimg.h"
@@ -169,6 +170,7 @@ void VG_(print_all_stats) (Bool memory_stats, Bool tool_stats)
 
    VG_(print_translation_stats)();
    VG_(print_tt_tc_stats)();
+   VG_(print_transcache_stats)();
    VG_(print_scheduler_stats)();
    VG_(print_ExeContext_stats)( False /* with_stacktraces */ );
    VG_(print_errormgr_stats)();
@@ -60,6 +60,7 @@
 #include "pub_core_stacks.h"        // For VG_(register_stack)
 #include "pub_core_syswrap.h"
 #include "pub_core_tooliface.h"
+#include "pub_core_transcache.h"    // VG_(transcache_init)
 #include "pub_core_translate.h"     // For VG_(translate)
 #include "pub_core_trampoline.h"
 #include "pub_core_transtab.h"
@@ -209,6 +210,15 @@ static void usage_NORETURN ( int need_help )
 "           more sectors may increase performance, but use more memory.\n"
 "    --avg-transtab-entry-size=<number> avg size in bytes of a translated\n"
 "           basic block [0, meaning use tool provided default]\n"
+"    --translation-cache-dir=<dir> keep translations of code in ELF objects\n"
+"           in <dir> and reuse them in later runs [none]\n"
+"    --tiered-translation=no|yes translate blocks cheaply first, and fully\n"
+"           once they are hot [no]\n"
+"    --tier-up-threshold=<number> entries after which a block is hot [1000]\n"
+"    --trace-formation=no|yes  retranslate hot blocks together with their\n"
+"           hot successors [no]\n"
+"    --parallel-execution=no|yes  run client threads in parallel, for tools\n"
+"           that support it (amd64-linux only) [no]\n"
 "    --aspace-minaddr=0xPP     avoid mapping memory below 0xPP [guessed]\n"
 "    --valgrind-stacksize=<number> size of valgrind (host) thread's stack\n"
 "                               (in bytes) ["
@@ -399,6 +409,9 @@ struct process_option_state {
    Bool sigill_diag_set;
    Bool show_error_list_set;
 
+   /* Whether the user has explicitly provided --vgdb. */
+   Bool vgdb_set;
+
    /* Log to stderr by default, but usage message goes to stdout.  XML
       output is initially disabled. */
    VgLogTo log_to;  // Where is logging output to be sent?
@@ -537,9 +550,14 @@ static void process_option (Clo_Mode mode,
    else if VG_BOOL_CLO(arg, "--xml",            VG_(clo_xml))
       VG_(debugLog_setXml)(VG_(clo_xml));
 
-   else if VG_XACT_CLOM(cloPD, arg, "--vgdb=no",   VG_(clo_vgdb), Vg_VgdbNo) {}
-   else if VG_XACT_CLOM(cloPD, arg, "--vgdb=yes",  VG_(clo_vgdb), Vg_VgdbYes) {}
+   else if VG_XACT_CLOM(cloPD, arg, "--vgdb=no",   VG_(clo_vgdb), Vg_VgdbNo) {
+      if (pos) pos->vgdb_set = True;
+   }
+   else if VG_XACT_CLOM(cloPD, arg, "--vgdb=yes",  VG_(clo_vgdb), Vg_VgdbYes) {
+      if (pos) pos->vgdb_set = True;
+   }
    else if VG_XACT_CLOM(cloPD, arg, "--vgdb=full", VG_(clo_vgdb), Vg_VgdbFull) {
+      if (pos) pos->vgdb_set = True;
       /* automatically updates register values at each insn
          with --vgdb=full */
       VG_(clo_vex_control).iropt_register_updates_default
@@ -663,6 +681,16 @@ static void process_option (Clo_Mode mode,
    else if VG_BINT_CLO(arg, "--avg-transtab-entry-size",
                        VG_(clo_avg_transtab_entry_size),
                        50, 5000) {}
+   else if VG_STR_CLO(arg, "--translation-cache-dir",
+                      VG_(clo_translation_cache_dir)) {}
+   else if VG_BOOL_CLO(arg, "--tiered-translation",
+                       VG_(clo_tiered_translation)) {}
+   else if VG_BINT_CLO(arg, "--tier-up-threshold",
+                       VG_(clo_tier_up_threshold), 1, 1000000000) {}
+   else if VG_BOOL_CLO(arg, "--trace-formation",
+                       VG_(clo_trace_formation)) {}
+   else if VG_BOOL_CLO(arg, "--parallel-execution",
+                       VG_(clo_parallel_execution)) {}
    else if VG_BINT_CLOM(cloPD, arg, "--merge-recursive-frames",
                         VG_(clo_merge_recursive_frames), 0,
                         VG_DEEPEST_BACKTRACE) {}
@@ -897,7 +925,7 @@ static void early_process_cmd_line_options ( /*OUT*/Int* need_help )
    UInt   i;
    HChar* str;
    struct process_option_state pos
-      = {0, 0, False, False, VgLogTo_Fd, VgLogTo_Fd, 2, -1};
+      = {0, 0, False, False, False, VgLogTo_Fd, VgLogTo_Fd, 2, -1};
 
    vg_assert( VG_(args_for_valgrind) );
 
@@ -938,7 +966,7 @@ void main_process_cmd_line_options( void )
 {
    Int i;
    struct process_option_state pos
-      = {0, 0, False, False, VgLogTo_Fd, VgLogTo_Fd, 2, -1};
+      = {0, 0, False, False, False, VgLogTo_Fd, VgLogTo_Fd, 2, -1};
 
    /* Check for sane path in ./configure --prefix=... */
    if (VG_LIBDIR[0] != '/')
@@ -961,8 +989,30 @@ void main_process_cmd_line_options( void )
       process_option (cloP, arg, &pos);
    }
 
-   /* END command-line processing loop.  From now on, only dynamically
-      changeable options will have an effect. */
+   /* END command-line processing loop. */
+
+   /* Options that depend on each other.  These are checked before
+      switching to cloD, so that VG_(fmsg_bad_option) still exits. */
+   if (VG_(clo_trace_formation) && !VG_(clo_tiered_translation)) {
+      VG_(fmsg_bad_option)("--trace-formation=yes",
+         "--trace-formation=yes needs --tiered-translation=yes.\n");
+   }
+   if (VG_(clo_parallel_execution)) {
+#     if !defined(VGP_amd64_linux)
+      VG_(fmsg_bad_option)("--parallel-execution=yes",
+         "--parallel-execution=yes is only available on amd64-linux.\n");
+#     endif
+      /* The gdbserver expects to find all threads stopped whenever
+         it gets control, so it is off unless asked for, and can't be
+         asked for. */
+      if (pos.vgdb_set && VG_(clo_vgdb) != Vg_VgdbNo)
+         VG_(fmsg_bad_option)("--parallel-execution=yes",
+            "--parallel-execution=yes can't be used with --vgdb=yes or --vgdb=full.\n");
+      VG_(clo_vgdb) = Vg_VgdbNo;
+   }
+
+   /* From now on, only dynamically changeable options will have an
+      effect. */
    VG_(set_Clo_Mode)(cloD);
 
    /* Notify about deprecated features here. */
@@ -1737,6 +1787,15 @@ Int valgrind_main ( Int argc, HChar **argv, HChar **envp )
          VG_(core_panic)(s);
       }
    }
+   if (VG_(clo_parallel_execution) && !VG_(needs).parallel_execution) {
+      /* Option processing is over, so VG_(fmsg_bad_option) would only
+         warn. */
+      VG_(fmsg)("Bad option: --parallel-execution=yes\n");
+      VG_(fmsg)("%s can't run client threads in parallel.\n",
+                VG_(details).name);
+      VG_(fmsg)("Use --help for more information or consult the user manual.\n");
+      VG_(exit)(1);
+   }
 
    //--------------------------------------------------------------
    // Initialise translation table and translation cache
@@ -1746,6 +1805,14 @@ Int valgrind_main ( Int argc, HChar **argv, HChar **envp )
    VG_(debugLog)(1, "main", "Initialise TT/TC\n");
    VG_(init_tt_tc)();
 
+   //--------------------------------------------------------------
+   // Initialise the persistent translation cache
+   //   p: finish_needs_init [for VG_(needs).persistent_translations]
+   //   p: main_process_cmd_line_options [for the cache directory]
+   //--------------------------------------------------------------
+   VG_(debugLog)(1, "main", "Initialise the translation cache\n");
+   VG_(transcache_init)();
+
    //--------------------------------------------------------------
    // Initialise the redirect table.
    //   p: init_tt_tc [so it can call VG_(search_transtab) safely]
@@ -2204,6 +2271,9 @@ void shutdown_actions_NORETURN( ThreadId tid,
       the error management machinery. */
    VG_TDICT_CALL(tool_fini, 0/*exitcode*/);
 
+   /* Save the translations made in this run for the next one. */
+   VG_(transcache_fini)();
+
    if (VG_(needs).core_errors || VG_(needs).tool_errors) {
       if (VG_(clo_verbosity) == 1
           && !VG_(clo_xml)
@@ -45,6 +45,13 @@
    the_BigLock, and re-takes it when it becomes runnable again (either
    because the syscall finished, or we took a signal).
 
+   With --parallel-execution=yes, a thread also releases the_BigLock
+   while it runs generated code, so several client threads can run at
+   once.  It re-takes it as soon as it leaves generated code, for
+   anything from translation to signal delivery and syscalls.  See
+   VG_(stop_parallel_threads) below for how the holder of the_BigLock
+   keeps out of their way.
+
    VG_(scheduler) therefore runs in each thread.  It returns only when
    the thread is exiting, either because it exited itself, or it was
    told to exit by another thread.
@@ -109,6 +116,9 @@
 /* If False, a fault is Valgrind-internal (ie, a bug) */
 Bool VG_(in_generated_code) = False;
 
+/* --parallel-execution */
+Bool VG_(clo_parallel_execution) = False;
+
 /* 64-bit counter for the number of basic blocks done. */
 static ULong bbs_done = 0;
 
@@ -127,6 +137,7 @@ static void mostly_clear_thread_record ( ThreadId tid );
 /* Stats. */
 static ULong n_scheduling_events_MINOR = 0;
 static ULong n_scheduling_events_MAJOR = 0;
+static ULong n_parallel_stops = 0;
 
 /* Stats: number of XIndirs looked up in the fast cache, the number of hits in
    ways 1, 2 and 3, and the number of misses.  The number of hits in way 0 isn't
@@ -176,6 +187,10 @@ void VG_(print_scheduler_stats)(void)
    VG_(message)(Vg_DebugMsg,
       "scheduler: %'llu/%'llu major/minor sched events.\n",
       n_scheduling_events_MAJOR, n_scheduling_events_MINOR);
+   if (VG_(clo_parallel_execution))
+      VG_(message)(Vg_DebugMsg,
+                   "scheduler: %'llu stops of parallel threads\n",
+                   n_parallel_stops);
    VG_(message)(Vg_DebugMsg, 
                 "   sanity: %u cheap, %u expensive checks.\n",
                 sanity_fast_count, sanity_slow_count );
@@ -263,6 +278,25 @@ void maybe_show_sb_profile ( void )
    }
 }
 
+/* For --tiered-translation: look for hot first-tier translations every
+   so often.  Looking means scanning the whole translation table, hence
+   not after every timeslice. */
+#define TIER_UP_INTERVAL 1000000
+
+static
+void maybe_tier_up ( ThreadId tid )
+{
+   /* DO NOT MAKE NON-STATIC */
+   static ULong bbs_done_lastcheck = 0;
+   /* */
+   Long delta = (Long)(bbs_done - bbs_done_lastcheck);
+   vg_assert(delta >= 0);
+   if ((ULong)delta >= TIER_UP_INTERVAL) {
+      bbs_done_lastcheck = bbs_done;
+      VG_(tier_up_translations)(tid, bbs_done);
+   }
+}
+
 static
 const HChar* name_of_sched_event ( UInt event )
 {
@@ -438,6 +472,119 @@ Bool VG_(owns_BigLock_LL) ( ThreadId tid )
 }
 
 
+/* ---------------------------------------------------------------------
+   Parallel execution (--parallel-execution=yes).
+
+   Threads in generated code only read VG_(tt_fast) and the code in
+   the translation cache (and their own ThreadState), so the holder of
+   the_BigLock can do anything else while they run.  Before changing
+   either of those, m_transtab calls VG_(stop_parallel_threads), which
+   makes every such thread leave generated code at its next event
+   check.  They then wait for the_BigLock, so they cannot go back in
+   until the change is done.
+
+   Filling VG_(tt_fast) does not need that; see setFastCacheEntry.
+   ------------------------------------------------------------------ */
+
+/* Number of threads in generated code without the_BigLock. */
+static volatile Int n_running_unlocked = 0;
+
+static void release_BigLock_for_generated_code ( ThreadId tid )
+{
+   ThreadState* tst = VG_(get_ThreadState)(tid);
+
+   vg_assert(!tst->running_unlocked);
+   tst->running_unlocked = True;
+   tst->unlocked_count++;
+   __sync_fetch_and_add(&n_running_unlocked, 1);
+   VG_(in_generated_code) = False;
+   VG_(running_tid) = VG_INVALID_THREADID;
+   VG_(release_BigLock_LL)(NULL);
+}
+
+/* See pub_core_scheduler.h for description */
+void VG_(acquire_BigLock_after_generated_code) ( ThreadId tid )
+{
+   ThreadState* tst = VG_(get_ThreadState)(tid);
+
+   if (!tst->running_unlocked)
+      return;
+
+   /* Count ourselves out before waiting, since the holder of
+      the_BigLock may be waiting for that.  It may also zero our event
+      counter until we are out, so keep the value we left with. */
+   Int evc = (Int)tst->arch.vex.host_EvC_COUNTER;
+   tst->unlocked_count++;
+   __sync_fetch_and_sub(&n_running_unlocked, 1);
+   VG_(acquire_BigLock_LL)(NULL);
+
+   vg_assert(VG_(running_tid) == VG_INVALID_THREADID);
+   VG_(running_tid) = tid;
+   VG_(in_generated_code) = True;
+   tst->arch.vex.host_EvC_COUNTER = evc;
+   tst->running_unlocked = False;
+}
+
+/* See pub_core_scheduler.h for description */
+void VG_(stop_parallel_threads) ( void )
+{
+   ThreadId tid;
+
+   if (n_running_unlocked == 0)
+      return;
+
+   n_parallel_stops++;
+   while (True) {
+      /* Fail their next event check.  A thread on its way out may
+         still have running_unlocked set, which does no harm. */
+      for (tid = 1; tid < VG_N_THREADS; tid++)
+         if (VG_(threads)[tid].running_unlocked)
+            VG_(threads)[tid].arch.vex.host_EvC_COUNTER = 0;
+      __sync_synchronize();
+      if (n_running_unlocked == 0)
+         break;
+      VG_(do_syscall0)(__NR_sched_yield);
+   }
+}
+
+/* Threads below this one have left generated code since the current
+   grace period started; 0 once it is over. */
+static ThreadId grace_scan = 0;
+
+/* See pub_core_scheduler.h for description */
+void VG_(start_parallel_grace_period) ( void )
+{
+   ThreadId tid;
+
+   if (n_running_unlocked == 0) {
+      grace_scan = 0;
+      return;
+   }
+   for (tid = 1; tid < VG_N_THREADS; tid++) {
+      UInt count = VG_(threads)[tid].unlocked_count;
+      VG_(threads)[tid].grace_count = (count & 1) ? count : 0;
+   }
+   grace_scan = 1;
+}
+
+/* See pub_core_scheduler.h for description */
+Bool VG_(parallel_grace_period_over) ( void )
+{
+   /* A thread that has left stays done, so each call only needs to
+      look from where the previous one stopped. */
+   if (grace_scan == 0)
+      return True;
+   while (grace_scan < VG_N_THREADS) {
+      ThreadState* tst = &VG_(threads)[grace_scan];
+      if (tst->grace_count != 0 && tst->unlocked_count == tst->grace_count)
+         return False;
+      grace_scan++;
+   }
+   grace_scan = 0;
+   return True;
+}
+
+
 /* Clear out the ThreadState and release the semaphore. Leaves the
    ThreadState in VgTs_Zombie state, so that it doesn't get
    reallocated until the caller is really ready. */
@@ -618,6 +765,9 @@ void mostly_clear_thread_record ( ThreadId tid )
    VG_(clear_out_queued_signals)(tid, &savedmask);
 
    VG_(threads)[tid].sched_jmpbuf_valid = False;
+   VG_(threads)[tid].running_unlocked = False;
+   VG_(threads)[tid].unlocked_count = 0;
+   VG_(threads)[tid].grace_count = 0;
 }
 
 /*                                                                             
@@ -659,6 +809,9 @@ static void sched_fork_cleanup(ThreadId me)
       }
    }
 
+   /* Threads that were running unlocked are gone. */
+   n_running_unlocked = 0;
+
    /* re-init and take the sema */
    deinit_BigLock();
    init_BigLock();
@@ -963,9 +1116,13 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    } else {
       /* normal case -- redir translation */
       Addr host_from_fast_cache = 0;
+      /* Both the lookup, which reorders the set it hits, and updating
+         VG_(tt_fast) would have to stop threads running unlocked.
+         That isn't worth it just to start a timeslice. */
       Bool found_in_fast_cache
-         = VG_(lookupInFastCache)( &host_from_fast_cache,
-                                   (Addr)tst->arch.vex.VG_INSTR_PTR );
+         = !VG_(clo_parallel_execution)
+           && VG_(lookupInFastCache)( &host_from_fast_cache,
+                                      (Addr)tst->arch.vex.VG_INSTR_PTR );
       if (found_in_fast_cache) {
          host_code_addr = host_from_fast_cache;
       } else {
@@ -975,7 +1132,8 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
             to the scheduler. */
          Bool  found = VG_(search_transtab)(&res, NULL, NULL,
                                             (Addr)tst->arch.vex.VG_INSTR_PTR,
-                                            True/*upd cache*/
+                                            !VG_(clo_parallel_execution)
+                                            /*upd cache*/
                                             );
          if (LIKELY(found)) {
             host_code_addr = res;
@@ -1028,6 +1186,9 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    vg_assert(VG_(in_generated_code) == False);
    VG_(in_generated_code) = True;
 
+   if (VG_(clo_parallel_execution))
+      release_BigLock_for_generated_code(tid);
+
    SCHEDSETJMP(
       tid, 
       jumped, 
@@ -1038,6 +1199,10 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
       )
    );
 
+   /* If we faulted, the signal handler has done this already. */
+   if (VG_(clo_parallel_execution))
+      VG_(acquire_BigLock_after_generated_code)(tid);
+
    vg_assert(VG_(in_generated_code) == True);
    VG_(in_generated_code) = False;
 
@@ -1737,6 +1902,9 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 
       if (UNLIKELY(VG_(clo_profyle_sbs)) && VG_(clo_profyle_interval) > 0)
          maybe_show_sb_profile();
+
+      if (UNLIKELY(VG_(clo_tiered_translation)))
+         maybe_tier_up(tid);
    }
 
    if (VG_(clo_trace_sched))
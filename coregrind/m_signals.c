@@ -2845,6 +2845,12 @@ void sync_signalhandler ( Int sigNo,
    ThreadId tid = VG_(lwpid_to_vgtid)(VG_(gettid)());
    Bool from_user;
 
+   /* With --parallel-execution=yes the thread may be in generated code
+      without the_BigLock.  Take it before looking at anything shared;
+      if we end up returning to the code, it runs on with the lock. */
+   if (VG_(clo_parallel_execution) && tid != VG_INVALID_THREADID)
+      VG_(acquire_BigLock_after_generated_code)(tid);
+
    if (0) 
       VG_(printf)("sync_sighandler(%d, %p, %p)\n", sigNo, info, uc);
 
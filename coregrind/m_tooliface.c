@@ -97,7 +97,9 @@ VgNeeds VG_(needs) = {
    .var_info	         = False,
    .malloc_replacement   = False,
    .xml_output           = False,
-   .final_IR_tidy_pass   = False
+   .final_IR_tidy_pass   = False,
+   .persistent_translations = False,
+   .parallel_execution   = False
 };
 
 /* static */
@@ -223,6 +225,8 @@ NEEDS(libc_freeres)
 NEEDS(cxx_freeres)
 NEEDS(core_errors)
 NEEDS(var_info)
+NEEDS(persistent_translations)
+NEEDS(parallel_execution)
 
 void VG_(needs_superblock_discards)(
    void (*discard)(Addr, VexGuestExtents)
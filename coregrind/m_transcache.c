@@ -0,0 +1,649 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Persistent on-disk cache of translations.                    ---*/
+/*---                                                m_transcache.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_core_basics.h"
+#include "pub_core_vki.h"
+#include "pub_core_aspacemgr.h"
+#include "pub_core_clientstate.h"  // VG_(args_for_valgrind)
+#include "pub_core_hashtable.h"
+#include "pub_core_libcbase.h"
+#include "pub_core_libcassert.h"
+#include "pub_core_libcfile.h"
+#include "pub_core_libcprint.h"
+#include "pub_core_libcproc.h"     // VG_(getpid)
+#include "pub_core_machine.h"      // VG_(machine_get_VexArchInfo), VG_ELF_CLASS
+#include "pub_core_mallocfree.h"
+#include "pub_core_options.h"
+#include "pub_core_tooliface.h"    // VG_(needs)
+#include "pub_core_xarray.h"
+#include "pub_core_transcache.h"   // self
+#include "config.h"                // VERSION
+
+#if defined(VGO_linux) || defined(VGO_solaris)
+/* --- !!! --- EXTERNAL HEADERS start --- !!! --- */
+#include <elf.h>
+/* --- !!! --- EXTERNAL HEADERS end --- !!! --- */
+#endif
+
+
+/*------------------------------------------------------------*/
+/*--- File format                                          ---*/
+/*------------------------------------------------------------*/
+
+/* A cache file is a TCFileHdr followed by n_entries entries.  Each
+   entry is a TCDiskEntry followed by code_len bytes of host code,
+   padded to a multiple of 8 bytes.  Files are only ever replaced as a
+   whole (write to a temporary file, then rename), so concurrent runs
+   see either the old or the new contents. */
+
+#define TC_MAGIC "VGTC0001"
+
+typedef
+   struct {
+      HChar magic[8];
+      ULong key;         // configuration hash, see compute_key
+      ULong n_entries;
+   }
+   TCFileHdr;
+
+typedef
+   struct {
+      ULong  nraddr;
+      ULong  abi_hash;
+      ULong  guest_hash; // of the guest bytes of all extents
+      ULong  base[3];
+      ULong  bias[3];    // start - file offset of each extent's segment
+      ULong  chased[VG_TRANSCACHE_MAX_CHASED];
+      UShort len[3];
+      UShort n_used;
+      UInt   n_chased;
+      UInt   code_len;
+      Int    offs_profInc;
+      UInt   n_guest_instrs;
+   }
+   TCDiskEntry;
+
+STATIC_ASSERT(sizeof(TCFileHdr) == 24);
+STATIC_ASSERT(sizeof(TCDiskEntry) == 128);
+
+#define TC_ENTRY_SIZE(code_len) \
+   (sizeof(TCDiskEntry) + VG_ROUNDUP((code_len), 8))
+
+
+/*------------------------------------------------------------*/
+/*--- State                                                ---*/
+/*------------------------------------------------------------*/
+
+const HChar* VG_(clo_translation_cache_dir) = NULL;
+
+/* Translations of one object, keyed by nraddr.  ent points either
+   into the mapped cache file or, if fresh, to a block of our own. */
+typedef
+   struct _TCNode {
+      struct _TCNode* next;
+      UWord key;
+      TCDiskEntry* ent;
+      Bool fresh;
+   }
+   TCNode;
+
+/* A file-backed object, keyed by inode.  path is NULL if the object
+   has no build-id, in which case its code is never cached. */
+typedef
+   struct _TCObject {
+      struct _TCObject* next;
+      UWord key;
+      ULong dev;
+      ULong ino;
+      HChar* path;
+      VgHashTable* entries;
+      Bool dirty;
+   }
+   TCObject;
+
+static Bool enabled = False;
+static ULong config_key;
+static VgHashTable* objects = NULL;
+
+/* Stats */
+static ULong n_lookups = 0;
+static ULong n_found   = 0;
+static ULong n_stale   = 0;
+static ULong n_loaded  = 0;
+static ULong n_added   = 0;
+static ULong n_written = 0;
+
+
+/*------------------------------------------------------------*/
+/*--- Helpers                                              ---*/
+/*------------------------------------------------------------*/
+
+#define FNV_INIT 0xcbf29ce484222325ULL
+
+static ULong fnv_hash ( ULong h, const void* p, SizeT n )
+{
+   const UChar* b = p;
+   SizeT i;
+   for (i = 0; i < n; i++) {
+      h ^= b[i];
+      h *= 0x100000001b3ULL;
+   }
+   return h;
+}
+
+static ULong fnv_hash_str ( ULong h, const HChar* s )
+{
+   return fnv_hash(h, s, VG_(strlen)(s) + 1);
+}
+
+/* Hash the ABI settings a translation was made with.  Field by
+   field, as the struct has padding bytes in it. */
+static ULong abi_hash ( const VexAbiInfo* abi )
+{
+   ULong h = FNV_INIT;
+   h = fnv_hash(h, &abi->guest_stack_redzone_size,
+                sizeof(abi->guest_stack_redzone_size));
+   h = fnv_hash(h, &abi->guest_amd64_assume_fs_is_const,
+                sizeof(abi->guest_amd64_assume_fs_is_const));
+   h = fnv_hash(h, &abi->guest_amd64_assume_gs_is_const,
+                sizeof(abi->guest_amd64_assume_gs_is_const));
+   h = fnv_hash(h, &abi->guest_ppc_zap_RZ_at_blr,
+                sizeof(abi->guest_ppc_zap_RZ_at_blr));
+   h = fnv_hash(h, &abi->guest_ppc_zap_RZ_at_bl,
+                sizeof(abi->guest_ppc_zap_RZ_at_bl));
+   h = fnv_hash(h, &abi->guest__use_fallback_LLSC,
+                sizeof(abi->guest__use_fallback_LLSC));
+   h = fnv_hash(h, &abi->host_ppc_calls_use_fndescrs,
+                sizeof(abi->host_ppc_calls_use_fndescrs));
+   h = fnv_hash(h, &abi->guest_mips_fp_mode,
+                sizeof(abi->guest_mips_fp_mode));
+   return h;
+}
+
+/* Options that have no effect on translations, so that, say, a
+   --log-file=%p does not make each run use its own cache. */
+static Bool arg_affects_translations ( const HChar* arg )
+{
+   static const HChar* const exact[]
+      = { "-v", "--verbose", "-q", "--quiet" };
+   static const HChar* const prefix[]
+      = { "--log-fd=", "--log-file=", "--log-socket=",
+          "--xml-fd=", "--xml-file=", "--xml-socket=",
+          "--stats=", "--translation-cache-dir=" };
+   UInt i;
+
+   for (i = 0; i < sizeof(exact)/sizeof(exact[0]); i++)
+      if (VG_(strcmp)(arg, exact[i]) == 0)
+         return False;
+   for (i = 0; i < sizeof(prefix)/sizeof(prefix[0]); i++)
+      if (VG_(strncmp)(arg, prefix[i], VG_(strlen)(prefix[i])) == 0)
+         return False;
+   return True;
+}
+
+/* Hash everything the host code may depend on, other than the guest
+   code itself: the Valgrind version, the tool binary (helper
+   addresses are baked into the code), the host CPU and the options. */
+static Bool compute_key ( /*OUT*/ULong* key )
+{
+   VexArch     arch;
+   VexArchInfo archinfo;
+   struct vg_stat st;
+   ULong h = FNV_INIT;
+   Word i;
+
+   NSegment const* seg = VG_(am_find_nsegment)((Addr)&VG_(transcache_init));
+   const HChar* tool = seg ? VG_(am_get_filename)(seg) : NULL;
+   if (!tool || sr_isError(VG_(stat)(tool, &st)))
+      return False;
+
+   h = fnv_hash_str(h, VERSION);
+   h = fnv_hash_str(h, VG_(clo_toolname));
+   h = fnv_hash(h, &st.dev, sizeof(st.dev));
+   h = fnv_hash(h, &st.ino, sizeof(st.ino));
+   h = fnv_hash(h, &st.size, sizeof(st.size));
+   h = fnv_hash(h, &st.mtime, sizeof(st.mtime));
+
+   VG_(machine_get_VexArchInfo)(&arch, &archinfo);
+   h = fnv_hash(h, &arch, sizeof(arch));
+   h = fnv_hash(h, &archinfo.hwcaps, sizeof(archinfo.hwcaps));
+   h = fnv_hash(h, &archinfo.endness, sizeof(archinfo.endness));
+
+   for (i = 0; i < VG_(sizeXA)(VG_(args_for_valgrind)); i++) {
+      const HChar* arg = *(HChar**)VG_(indexXA)(VG_(args_for_valgrind), i);
+      if (arg_affects_translations(arg))
+         h = fnv_hash_str(h, arg);
+   }
+
+   *key = h;
+   return True;
+}
+
+/* Returns the GNU build-id of FILENAME as a hex string, or NULL. */
+static HChar* read_build_id ( const HChar* filename )
+{
+#  if defined(VGO_linux) || defined(VGO_solaris)
+#  if VG_WORDSIZE == 4
+   Elf32_Ehdr ehdr;
+   Elf32_Phdr phdr;
+#  else
+   Elf64_Ehdr ehdr;
+   Elf64_Phdr phdr;
+#  endif
+   UChar notes[4096];
+   HChar* res = NULL;
+   UInt i;
+
+   SysRes sr = VG_(open)(filename, VKI_O_RDONLY, 0);
+   if (sr_isError(sr))
+      return NULL;
+   Int fd = sr_Res(sr);
+
+   sr = VG_(pread)(fd, &ehdr, sizeof(ehdr), 0);
+   if (sr_isError(sr) || sr_Res(sr) != sizeof(ehdr)
+       || VG_(memcmp)(ehdr.e_ident, ELFMAG, SELFMAG) != 0
+       || ehdr.e_ident[EI_CLASS] != VG_ELF_CLASS
+       || ehdr.e_phentsize != sizeof(phdr))
+      goto out;
+
+   for (i = 0; i < ehdr.e_phnum && !res; i++) {
+      sr = VG_(pread)(fd, &phdr, sizeof(phdr),
+                      ehdr.e_phoff + i * sizeof(phdr));
+      if (sr_isError(sr) || sr_Res(sr) != sizeof(phdr))
+         break;
+      if (phdr.p_type != PT_NOTE || phdr.p_filesz > sizeof(notes))
+         continue;
+      sr = VG_(pread)(fd, notes, phdr.p_filesz, phdr.p_offset);
+      if (sr_isError(sr) || sr_Res(sr) != phdr.p_filesz)
+         continue;
+
+      SizeT off = 0;
+      while (off + 12 <= phdr.p_filesz) {
+         UInt namesz = *(UInt*)(notes + off);
+         UInt descsz = *(UInt*)(notes + off + 4);
+         UInt type   = *(UInt*)(notes + off + 8);
+         SizeT name  = off + 12;
+         SizeT desc  = name + VG_ROUNDUP(namesz, 4);
+         if (desc + descsz > phdr.p_filesz)
+            break;
+         if (type == NT_GNU_BUILD_ID && namesz == 4 && descsz > 0
+             && VG_(memcmp)(notes + name, "GNU", 4) == 0) {
+            UInt j;
+            res = VG_(malloc)("transcache.rbi.1", 2 * descsz + 1);
+            for (j = 0; j < descsz; j++)
+               VG_(sprintf)(res + 2 * j, "%02x", notes[desc + j]);
+            break;
+         }
+         off = desc + VG_ROUNDUP(descsz, 4);
+      }
+   }
+
+  out:
+   VG_(close)(fd);
+   return res;
+#  else
+   return NULL;
+#  endif
+}
+
+static ULong guest_hash ( const VexGuestExtents* vge )
+{
+   ULong h = FNV_INIT;
+   UInt i;
+   for (i = 0; i < vge->n_used; i++)
+      h = fnv_hash(h, (const void*)vge->base[i], vge->len[i]);
+   return h;
+}
+
+/* Checks that each extent lies in a segment of the object that SEG0
+   belongs to, and computes its bias.  Code is only cached or reused
+   when all of it comes from one object mapped the same way. */
+static Bool extents_in_object ( NSegment const* seg0,
+                                const VexGuestExtents* vge,
+                                /*OUT*/ULong* bias )
+{
+   UInt i;
+   for (i = 0; i < vge->n_used; i++) {
+      NSegment const* seg = VG_(am_find_nsegment)(vge->base[i]);
+      if (!seg || seg->kind != SkFileC || !seg->hasR || !seg->hasX
+          || seg->dev != seg0->dev || seg->ino != seg0->ino
+          || vge->base[i] + vge->len[i] > seg->end + 1)
+         return False;
+      bias[i] = seg->start - seg->offset;
+   }
+   return True;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Objects and cache files                              ---*/
+/*------------------------------------------------------------*/
+
+static void load_file ( TCObject* obj )
+{
+   struct vg_stat st;
+   const TCFileHdr* hdr;
+   ULong i, off;
+   UInt n = 0;
+
+   SysRes sr = VG_(open)(obj->path, VKI_O_RDONLY, 0);
+   if (sr_isError(sr))
+      return;
+   Int fd = sr_Res(sr);
+   if (VG_(fstat)(fd, &st) != 0 || st.size < (Long)sizeof(TCFileHdr)) {
+      VG_(close)(fd);
+      return;
+   }
+   sr = VG_(am_mmap_file_float_valgrind)(st.size, VKI_PROT_READ, fd, 0);
+   VG_(close)(fd);
+   if (sr_isError(sr))
+      return;
+
+   UChar* base = (UChar*)sr_Res(sr);
+   hdr = (const TCFileHdr*)base;
+   if (VG_(memcmp)(hdr->magic, TC_MAGIC, sizeof(hdr->magic)) != 0
+       || hdr->key != config_key) {
+      VG_(am_munmap_valgrind)((Addr)base, st.size);
+      return;
+   }
+
+   off = sizeof(TCFileHdr);
+   for (i = 0; i < hdr->n_entries; i++) {
+      TCDiskEntry* e = (TCDiskEntry*)(base + off);
+      if (off + sizeof(TCDiskEntry) > st.size
+          || e->n_used < 1 || e->n_used > 3
+          || e->n_chased > VG_TRANSCACHE_MAX_CHASED
+          || e->code_len == 0 || e->code_len >= 65536
+          || off + TC_ENTRY_SIZE(e->code_len) > st.size)
+         break;
+      if (!VG_(HT_lookup)(obj->entries, e->nraddr)) {
+         TCNode* node = VG_(malloc)("transcache.lf.1", sizeof(TCNode));
+         node->key   = e->nraddr;
+         node->ent   = e;
+         node->fresh = False;
+         VG_(HT_add_node)(obj->entries, node);
+         n++;
+      }
+      off += TC_ENTRY_SIZE(e->code_len);
+   }
+   n_loaded += n;
+
+   /* Loaded entries point into the mapping, so it stays as long as
+      they do, that is, until the end of the run. */
+   if (n == 0) {
+      VG_(am_munmap_valgrind)((Addr)base, st.size);
+      return;
+   }
+
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg, "transcache: %u translations from %s\n",
+                   VG_(HT_count_nodes)(obj->entries), obj->path);
+}
+
+/* Finds the object ADDR belongs to, reading its cache file the first
+   time round.  Returns NULL if ADDR is not in a file mapping. */
+static TCObject* find_object ( Addr addr, /*OUT*/NSegment const** seg0 )
+{
+   NSegment const* seg = VG_(am_find_nsegment)(addr);
+   TCObject* obj;
+
+   if (!seg || seg->kind != SkFileC)
+      return NULL;
+   *seg0 = seg;
+
+   obj = VG_(HT_lookup)(objects, (UWord)seg->ino);
+   if (obj)
+      return obj->dev == seg->dev ? obj : NULL;
+
+   obj = VG_(calloc)("transcache.fo.1", 1, sizeof(TCObject));
+   obj->key = (UWord)seg->ino;
+   obj->dev = seg->dev;
+   obj->ino = seg->ino;
+   VG_(HT_add_node)(objects, obj);
+
+   const HChar* filename = VG_(am_get_filename)(seg);
+   HChar* build_id = filename ? read_build_id(filename) : NULL;
+   if (build_id) {
+      obj->path = VG_(malloc)("transcache.fo.2",
+                              VG_(strlen)(VG_(clo_translation_cache_dir))
+                              + VG_(strlen)(build_id) + 19);
+      VG_(sprintf)(obj->path, "%s/%s-%016llx",
+                   VG_(clo_translation_cache_dir), build_id, config_key);
+      VG_(free)(build_id);
+      obj->entries = VG_(HT_construct)("transcache.entries");
+      load_file(obj);
+   }
+   return obj;
+}
+
+static Bool write_all ( Int fd, const void* buf, SizeT len )
+{
+   return VG_(write)(fd, buf, len) == (Int)len;
+}
+
+static void write_file ( TCObject* obj )
+{
+   static const UChar zeroes[8] = { 0 };
+   TCFileHdr hdr;
+   TCNode* node;
+   Bool ok;
+
+   HChar tmp[VG_(strlen)(obj->path) + 16];
+   VG_(sprintf)(tmp, "%s.%d", obj->path, VG_(getpid)());
+   SysRes sr = VG_(open)(tmp, VKI_O_CREAT|VKI_O_WRONLY|VKI_O_TRUNC, 0644);
+   if (sr_isError(sr)) {
+      VG_(umsg)("Warning: cannot create translation cache file %s\n", tmp);
+      return;
+   }
+   Int fd = sr_Res(sr);
+
+   VG_(memcpy)(hdr.magic, TC_MAGIC, sizeof(hdr.magic));
+   hdr.key = config_key;
+   hdr.n_entries = VG_(HT_count_nodes)(obj->entries);
+   ok = write_all(fd, &hdr, sizeof(hdr));
+
+   VG_(HT_ResetIter)(obj->entries);
+   while (ok && (node = VG_(HT_Next)(obj->entries))) {
+      const TCDiskEntry* e = node->ent;
+      ok = write_all(fd, e, sizeof(*e) + e->code_len)
+           && write_all(fd, zeroes,
+                        VG_ROUNDUP(e->code_len, 8) - e->code_len);
+   }
+   VG_(close)(fd);
+
+   if (ok && VG_(rename)(tmp, obj->path) == 0) {
+      n_written += hdr.n_entries;
+   } else {
+      VG_(umsg)("Warning: cannot write translation cache file %s\n",
+                obj->path);
+      VG_(unlink)(tmp);
+   }
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Exported functions                                   ---*/
+/*------------------------------------------------------------*/
+
+void VG_(transcache_init) ( void )
+{
+   struct vg_stat st;
+   const HChar* dir = VG_(clo_translation_cache_dir);
+
+   if (!dir)
+      return;
+   if (!VG_(needs).persistent_translations) {
+      VG_(umsg)("Warning: tool %s does not support --translation-cache-dir;"
+                " ignored\n", VG_(clo_toolname));
+      return;
+   }
+   if (sr_isError(VG_(stat)(dir, &st)) || !VKI_S_ISDIR(st.mode)) {
+      VG_(umsg)("Warning: --translation-cache-dir=%s is not a directory;"
+                " ignored\n", dir);
+      return;
+   }
+   if (!compute_key(&config_key)) {
+      VG_(umsg)("Warning: cannot identify the tool executable;"
+                " --translation-cache-dir ignored\n");
+      return;
+   }
+
+   objects = VG_(HT_construct)("transcache.objects");
+   enabled = True;
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg, "transcache: using %s, key %016llx\n",
+                   dir, config_key);
+}
+
+Bool VG_(transcache_enabled) ( void )
+{
+   return enabled;
+}
+
+Bool VG_(transcache_lookup) ( Addr nraddr, const VexAbiInfo* abi,
+                              /*OUT*/TranscacheEntry* te )
+{
+   NSegment const* seg0;
+   ULong bias[3];
+   TCObject* obj;
+   TCNode* node;
+   UInt i;
+
+   vg_assert(enabled);
+   n_lookups++;
+
+   obj = find_object(nraddr, &seg0);
+   if (!obj || !obj->entries)
+      return False;
+   node = VG_(HT_lookup)(obj->entries, nraddr);
+   if (!node)
+      return False;
+
+   const TCDiskEntry* e = node->ent;
+   te->vge.n_used = e->n_used;
+   for (i = 0; i < e->n_used; i++) {
+      te->vge.base[i] = e->base[i];
+      te->vge.len[i]  = e->len[i];
+   }
+   /* Same ABI settings, same object mapping, same guest code. */
+   if (e->abi_hash != abi_hash(abi)
+       || !extents_in_object(seg0, &te->vge, bias)
+       || VG_(memcmp)(bias, e->bias, e->n_used * sizeof(ULong)) != 0
+       || guest_hash(&te->vge) != e->guest_hash) {
+      n_stale++;
+      return False;
+   }
+
+   te->n_chased = e->n_chased;
+   for (i = 0; i < e->n_chased; i++)
+      te->chased[i] = e->chased[i];
+   te->code           = (const UChar*)(e + 1);
+   te->code_len       = e->code_len;
+   te->offs_profInc   = e->offs_profInc;
+   te->n_guest_instrs = e->n_guest_instrs;
+   n_found++;
+   return True;
+}
+
+void VG_(transcache_add) ( Addr nraddr, const VexAbiInfo* abi,
+                           const TranscacheEntry* te )
+{
+   NSegment const* seg0;
+   ULong bias[3];
+   TCObject* obj;
+   TCNode* node;
+   UInt i;
+
+   vg_assert(enabled);
+   vg_assert(te->n_chased <= VG_TRANSCACHE_MAX_CHASED);
+
+   obj = find_object(nraddr, &seg0);
+   if (!obj || !obj->entries
+       || !extents_in_object(seg0, &te->vge, bias))
+      return;
+
+   TCDiskEntry* e = VG_(malloc)("transcache.add.1",
+                                sizeof(TCDiskEntry) + te->code_len);
+   VG_(memset)(e, 0, sizeof(*e));
+   e->nraddr     = nraddr;
+   e->abi_hash   = abi_hash(abi);
+   e->guest_hash = guest_hash(&te->vge);
+   e->n_used     = te->vge.n_used;
+   for (i = 0; i < te->vge.n_used; i++) {
+      e->base[i] = te->vge.base[i];
+      e->len[i]  = te->vge.len[i];
+      e->bias[i] = bias[i];
+   }
+   e->n_chased = te->n_chased;
+   for (i = 0; i < te->n_chased; i++)
+      e->chased[i] = te->chased[i];
+   e->code_len       = te->code_len;
+   e->offs_profInc   = te->offs_profInc;
+   e->n_guest_instrs = te->n_guest_instrs;
+   VG_(memcpy)(e + 1, te->code, te->code_len);
+
+   node = VG_(HT_remove)(obj->entries, nraddr);
+   if (node) {
+      if (node->fresh)
+         VG_(free)(node->ent);
+   } else {
+      node = VG_(malloc)("transcache.add.2", sizeof(TCNode));
+      node->key = nraddr;
+   }
+   node->ent   = e;
+   node->fresh = True;
+   VG_(HT_add_node)(obj->entries, node);
+   obj->dirty = True;
+   n_added++;
+}
+
+void VG_(transcache_fini) ( void )
+{
+   TCObject* obj;
+
+   if (!enabled)
+      return;
+   VG_(HT_ResetIter)(objects);
+   while ((obj = VG_(HT_Next)(objects)))
+      if (obj->dirty)
+         write_file(obj);
+}
+
+void VG_(print_transcache_stats) ( void )
+{
+   if (!enabled)
+      return;
+   VG_(message)(Vg_DebugMsg,
+                "transcache: %'llu lookups, %'llu found, %'llu stale\n",
+                n_lookups, n_found, n_stale);
+   VG_(message)(Vg_DebugMsg,
+                "transcache: %'llu loaded, %'llu added, %'llu written\n",
+                n_loaded, n_added, n_written);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
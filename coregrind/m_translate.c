@@ -46,6 +46,7 @@
 #include "pub_core_stacks.h"     // VG_(unknown_SP_update*)()
 #include "pub_core_tooliface.h"  // VG_(tdict)
 
+#include "pub_core_transcache.h"
 #include "pub_core_translate.h"
 #include "pub_core_transtab.h"
 #include "pub_core_dispatch.h" // VG_(run_innerloop__dispatch_{un}profiled)
@@ -80,6 +81,10 @@ static ULong n_PX_VexRegUpdUnwindregsAtMemAccess = 0;
 static ULong n_PX_VexRegUpdAllregsAtMemAccess    = 0;
 static ULong n_PX_VexRegUpdAllregsAtEachInsn     = 0;
 
+static ULong n_tier_first = 0;
+static ULong n_tier_up    = 0;
+static ULong n_tier_hot_followed = 0;
+
 void VG_(print_translation_stats) ( void )
 {
    VG_(message)
@@ -121,6 +126,12 @@ void VG_(print_translation_stats) ( void )
        "  AllRegs %'llu,  AllRegsAllInsns %'llu\n",
        n_PX_VexRegUpdSpAtMemAccess, n_PX_VexRegUpdUnwindregsAtMemAccess,
        n_PX_VexRegUpdAllregsAtMemAccess, n_PX_VexRegUpdAllregsAtEachInsn);
+
+   if (VG_(clo_tiered_translation))
+      VG_(message)(Vg_DebugMsg,
+                   "translate: tiers: %'llu first-tier, %'llu retranslated,"
+                   " %'llu hot branches followed\n",
+                   n_tier_first, n_tier_up, n_tier_hot_followed);
 }
 
 /*------------------------------------------------------------*/
@@ -949,6 +960,14 @@ static UInt needs_self_check ( void* closureV,
 }
 
 
+/* Addresses chase_into_ok allowed chasing into during the current
+   translation.  A translation from the persistent cache is only reused
+   if chasing into all of them is still allowed.  n_chased may exceed
+   VG_TRANSCACHE_MAX_CHASED, in which case the translation is not
+   cached. */
+static Addr chased[VG_TRANSCACHE_MAX_CHASED];
+static UInt n_chased = 0;
+
 /* This is a callback passed to LibVEX_Translate.  It stops Vex from
    chasing into function entry points that we wish to redirect.
    Chasing across them obviously defeats the redirect mechanism, with
@@ -994,6 +1013,9 @@ static Bool chase_into_ok ( void* closureV, Addr addr )
 #  endif
 
    /* well, ok then.  go on and chase. */
+   if (n_chased < VG_TRANSCACHE_MAX_CHASED)
+      chased[n_chased] = addr;
+   n_chased++;
    return True;
 
    vg_assert(0);
@@ -1005,6 +1027,72 @@ static Bool chase_into_ok ( void* closureV, Addr addr )
 }
 
 
+/* --------------- the persistent translation cache --------------- */
+
+/* The cache takes care of the guest code and of the object mapping
+   being the same as when the translation was made.  What remains to
+   check is what depends on run-time state: redirections of chased-into
+   addresses, self-checks (--smc-check=stack) and gdbserver. */
+static Bool gdbserver_needs_block ( const VexGuestExtents* vge )
+{
+   return VG_(clo_vgdb) != Vg_VgdbNo
+          && VG_(gdbserver_instrumentation_needed)(vge) != Vg_VgdbNo;
+}
+
+static Bool reuse_cached_translation ( VgCallbackClosure* closure,
+                                       const VexAbiInfo* abi )
+{
+   TranscacheEntry te;
+   VexRegisterUpdates px
+      = VG_(clo_vex_control).iropt_register_updates_default;
+   UInt i;
+
+   if (!VG_(transcache_lookup)(closure->nraddr, abi, &te))
+      return False;
+   for (i = 0; i < te.n_chased; i++)
+      if (!chase_into_ok(closure, te.chased[i]))
+         return False;
+   if (needs_self_check(closure, &px, &te.vge) != 0
+       || gdbserver_needs_block(&te.vge))
+      return False;
+
+   for (i = 0; i < te.vge.n_used; i++)
+      VG_(am_set_segment_hasT)( te.vge.base[i] );
+   VG_(add_to_transtab)( &te.vge,
+                         closure->nraddr,
+                         (Addr)te.code,
+                         te.code_len,
+                         False,
+                         te.offs_profInc,
+                         te.n_guest_instrs,
+                         False );
+   return True;
+}
+
+static void cache_translation ( Addr nraddr, const VexAbiInfo* abi,
+                                const VexGuestExtents* vge,
+                                const VexTranslateResult* tres,
+                                const UChar* code, Int code_len )
+{
+   TranscacheEntry te;
+   UInt i;
+
+   if (tres->n_sc_extents > 0 || n_chased > VG_TRANSCACHE_MAX_CHASED
+       || gdbserver_needs_block(vge))
+      return;
+
+   te.vge = *vge;
+   te.n_chased = n_chased;
+   for (i = 0; i < n_chased; i++)
+      te.chased[i] = chased[i];
+   te.code           = code;
+   te.code_len       = code_len;
+   te.offs_profInc   = tres->offs_profInc;
+   te.n_guest_instrs = tres->n_guest_instrs;
+   VG_(transcache_add)(nraddr, abi, &te);
+}
+
+
 /* --------------- helpers for with-TOC platforms --------------- */
 
 /* NOTE: with-TOC platforms are: ppc64-linux. */
@@ -1480,6 +1568,56 @@ typedef
    }
    T_Kind;
 
+/* Tiered translation.  With --tiered-translation=yes, blocks are first
+   translated cheaply: at most iropt level 1 and without chasing, with
+   a profile counter increment as for --profile-flags.  Blocks whose
+   counter reaches --tier-up-threshold are retranslated with the
+   configured settings, and the new translation replaces the first-tier
+   one in the translation table. */
+Bool VG_(clo_tiered_translation) = False;
+UInt VG_(clo_tier_up_threshold)  = 1000;
+Bool VG_(clo_trace_formation)    = False;
+
+/* For --trace-formation: a callback passed to LibVEX_Translate when
+   retranslating a hot block.  Says which of the destinations of a
+   conditional branch is hot, going by how often their translations
+   have been entered.  These are block counts rather than edge counts,
+   so a successor which is hot because of other predecessors may be
+   picked; that costs a side exit taken more often, but is still
+   correct.  A successor without a translation was never run (or was
+   discarded), and counts as cold. */
+static Addr hot_successor ( void* closureV, Addr sx, Addr ft )
+{
+   ULong n_sx = 0, n_ft = 0;
+
+   (void)VG_(transtab_entry_count)( sx, &n_sx );
+   (void)VG_(transtab_entry_count)( ft, &n_ft );
+   /* Ask for a clear bias: at least 4 out of 5 entries. */
+   if (n_sx > 0 && n_sx / 4 >= n_ft)
+      return sx;
+   if (n_ft > 0 && n_ft / 4 >= n_sx)
+      return ft;
+   return 0;
+}
+
+/* Switch VEX between the first-tier and the configured settings. */
+static void set_vex_control_for_tier ( Bool first_tier )
+{
+   static Bool first_tier_now = False;
+   VexControl vcon;
+
+   if (first_tier == first_tier_now)
+      return;
+   vcon = VG_(clo_vex_control);
+   if (first_tier) {
+      if (vcon.iropt_level > 1)
+         vcon.iropt_level = 1;
+      vcon.guest_chase = False;
+   }
+   LibVEX_Update_Control( &vcon );
+   first_tier_now = first_tier;
+}
+
 /* Translate the basic block beginning at NRADDR, and add it to the
    translation cache & translation table.  Unless
    DEBUGGING_TRANSLATION is true, in which case the call is being done
@@ -1487,21 +1625,24 @@ typedef
    is made, and (b) produce a load of debugging output.  If
    ALLOW_REDIRECTION is False, do not attempt redirection of NRADDR,
    and also, put the resulting translation into the no-redirect tt/tc
-   instead of the normal one.
+   instead of the normal one.  If TIER_UP is True, NRADDR has a hot
+   first-tier translation, which the new one replaces.
 
    TID is the identity of the thread requesting this translation.
 */
 
-Bool VG_(translate) ( ThreadId tid, 
-                      Addr     nraddr,
-                      Bool     debugging_translation,
-                      Int      debugging_verbosity,
-                      ULong    bbs_done,
-                      Bool     allow_redirection )
+static Bool translate_block ( ThreadId tid, 
+                              Addr     nraddr,
+                              Bool     debugging_translation,
+                              Int      debugging_verbosity,
+                              ULong    bbs_done,
+                              Bool     allow_redirection,
+                              Bool     tier_up )
 {
    Addr               addr;
    T_Kind             kind;
    Int                tmpbuf_used, verbosity, i;
+   Bool               use_transcache, first_tier;
    Bool (*preamble_fn)(void*,IRSB*);
    VexArch            vex_arch;
    VexArchInfo        vex_archinfo;
@@ -1577,7 +1718,9 @@ Bool VG_(translate) ( ThreadId tid,
                    addr, name2 );
    }
 
-   if (!debugging_translation)
+   /* Only the thread's own jumps to ADDR are reported: a tier-up
+      retranslates code which was checked when it was first translated. */
+   if (!debugging_translation && !tier_up)
       VG_TRACK( pre_mem_read, Vg_CoreTranslate, 
                               tid, "(translator)", addr, 1 );
 
@@ -1611,6 +1754,9 @@ Bool VG_(translate) ( ThreadId tid,
 
    if ( (!translations_allowable_from_seg(seg, addr))
         || addr == TRANSTAB_BOGUS_GUEST_ADDR ) {
+      /* Not the thread's fault: just keep the first-tier translation. */
+      if (tier_up)
+         return False;
       if (VG_(clo_trace_signals))
          VG_(message)(Vg_DebugMsg, "translations not allowed here (0x%lx)"
                                    " - throwing SEGV\n", addr);
@@ -1752,6 +1898,23 @@ Bool VG_(translate) ( ThreadId tid,
    closure.nraddr = nraddr;
    closure.readdr = addr;
 
+   /* Plain translations of code in ELF objects may come from, and go
+      to, the persistent translation cache. */
+   use_transcache = VG_(transcache_enabled)()
+                    && kind == T_Normal && preamble_fn == NULL
+                    && !debugging_translation && verbosity == 0;
+   if (use_transcache && !tier_up
+       && reuse_cached_translation(&closure, &vex_abiinfo))
+      return True;
+   n_chased = 0;
+
+   /* No-redir translations cannot have a profile counter, so they are
+      always made with the configured settings. */
+   first_tier = VG_(clo_tiered_translation) && !tier_up
+                && kind != T_NoRedir && !debugging_translation;
+   if (VG_(clo_tiered_translation))
+      set_vex_control_for_tier( first_tier );
+
    /* Set up args for LibVEX_Translate. */
    vta.arch_guest       = vex_arch;
    vta.archinfo_guest   = vex_archinfo;
@@ -1762,6 +1925,8 @@ Bool VG_(translate) ( ThreadId tid,
    vta.guest_bytes      = (UChar*)addr;
    vta.guest_bytes_addr = addr;
    vta.chase_into_ok    = chase_into_ok;
+   vta.hot_successor    = tier_up && VG_(clo_trace_formation)
+                             ? hot_successor : NULL;
    vta.guest_extents    = &vge;
    vta.host_bytes       = tmpbuf;
    vta.host_bytes_size  = N_TMPBUF;
@@ -1794,7 +1959,8 @@ Bool VG_(translate) ( ThreadId tid,
    vta.preamble_function = preamble_fn;
    vta.traceflags        = verbosity;
    vta.sigill_diag       = VG_(clo_sigill_diag);
-   vta.addProfInc        = VG_(clo_profyle_sbs) && kind != T_NoRedir;
+   vta.addProfInc        = (VG_(clo_profyle_sbs) || first_tier)
+                           && kind != T_NoRedir;
 
    /* Set up the dispatch continuation-point info.  If this is a
       no-redir translation then it cannot be chained, and the chain-me
@@ -1815,6 +1981,11 @@ Bool VG_(translate) ( ThreadId tid,
          = VG_(fnptr_to_fnentry)( &VG_(disp_cp_chain_me_to_fastEP) );
       vta.disp_cp_xindir
          = VG_(fnptr_to_fnentry)( &VG_(disp_cp_xindir) );
+#     if defined(VGP_amd64_linux)
+      if (VG_(clo_parallel_execution))
+         vta.disp_cp_xindir
+            = VG_(fnptr_to_fnentry)( &VG_(disp_cp_xindir_parallel) );
+#     endif
    } else {
       vta.disp_cp_chain_me_to_slowEP = NULL;
       vta.disp_cp_chain_me_to_fastEP = NULL;
@@ -1836,6 +2007,7 @@ Bool VG_(translate) ( ThreadId tid,
    n_TRACE_total_guest_insns += tres.n_guest_instrs;
    n_TRACE_total_uncond_branches_followed += tres.n_uncond_in_trace;
    n_TRACE_total_cond_branches_followed   += tres.n_cond_in_trace;
+   n_tier_hot_followed                    += tres.n_hot_in_trace;
    } /* END new scope specially for 'seg' */
 
    /* Tell aspacem of all segments that have had translations taken
@@ -1855,15 +2027,34 @@ Bool VG_(translate) ( ThreadId tid,
           // Put it into the normal TT/TC structures.  This is the
           // normal case.
 
+          // Only final translations go into the persistent cache.
+          if (use_transcache && !first_tier)
+             cache_translation( nraddr, &vex_abiinfo, &vge, &tres,
+                                tmpbuf, tmpbuf_used );
+
           // Note that we use nraddr (the non-redirected address), not
           // addr, which might have been changed by the redirection
-          VG_(add_to_transtab)( &vge,
-                                nraddr,
-                                (Addr)(&tmpbuf[0]), 
-                                tmpbuf_used,
-                                tres.n_sc_extents > 0,
-                                tres.offs_profInc,
-                                tres.n_guest_instrs );
+          if (tier_up) {
+             n_tier_up++;
+             VG_(replace_in_transtab)( &vge,
+                                       nraddr,
+                                       (Addr)(&tmpbuf[0]),
+                                       tmpbuf_used,
+                                       tres.n_sc_extents > 0,
+                                       tres.offs_profInc,
+                                       tres.n_guest_instrs );
+          } else {
+             if (first_tier)
+                n_tier_first++;
+             VG_(add_to_transtab)( &vge,
+                                   nraddr,
+                                   (Addr)(&tmpbuf[0]), 
+                                   tmpbuf_used,
+                                   tres.n_sc_extents > 0,
+                                   tres.offs_profInc,
+                                   tres.n_guest_instrs,
+                                   first_tier );
+          }
       } else {
           vg_assert(tres.offs_profInc == -1); /* -1 == unset */
           VG_(add_to_unredir_transtab)( &vge,
@@ -1876,6 +2067,30 @@ Bool VG_(translate) ( ThreadId tid,
    return True;
 }
 
+Bool VG_(translate) ( ThreadId tid, 
+                      Addr     nraddr,
+                      Bool     debugging_translation,
+                      Int      debugging_verbosity,
+                      ULong    bbs_done,
+                      Bool     allow_redirection )
+{
+   return translate_block( tid, nraddr, debugging_translation,
+                           debugging_verbosity, bbs_done,
+                           allow_redirection, False );
+}
+
+/* Retranslate the first-tier translations which got hot. */
+void VG_(tier_up_translations) ( ThreadId tid, ULong bbs_done )
+{
+   Addr hot[256];
+   UInt i, n;
+
+   n = VG_(find_hot_first_tier)( hot, sizeof(hot)/sizeof(hot[0]),
+                                 VG_(clo_tier_up_threshold) );
+   for (i = 0; i < n; i++)
+      translate_block( tid, hot[i], False, 0, bbs_done, True, True );
+}
+
 /*--------------------------------------------------------------------*/
 /*--- end                                                          ---*/
 /*--------------------------------------------------------------------*/
@@ -42,6 +42,7 @@
 #include "pub_core_mallocfree.h" // VG_(out_of_memory_NORETURN)
 #include "pub_core_xarray.h"
 #include "pub_core_dispatch.h"   // For VG_(disp_cp*) addresses
+#include "pub_core_scheduler.h"  // VG_(stop_parallel_threads)
 
 
 #define DEBUG_TRANSTAB 0
@@ -174,6 +175,10 @@ typedef
                are profiling. */
             ULong    count;
             UShort   weight;
+            /* True for a first-tier translation (--tiered-translation)
+               which has not been picked for retranslation yet.  Count
+               is then maintained even if we are not profiling. */
+            Bool     first_tier;
          } prof; // if status == InUse
          TTEno next_empty_tte; // if status != InUse
       } usage;
@@ -496,6 +501,7 @@ static Bool init_done = False;
 /* Number of fast-cache updates and flushes done. */
 static ULong n_fast_flushes = 0;
 static ULong n_fast_updates = 0;
+static ULong n_fast_retired = 0;
 
 /* Number of full lookups done. */
 static ULong n_full_lookups = 0;
@@ -911,6 +917,24 @@ void VG_(tt_tc_do_chaining) ( void* from__patch_addr,
    }
 
    TTEntryC* from_tteC = index_tteC(from_sNo, from_tteNo);
+   HWord from_offs = (HWord)( (UChar*)from__patch_addr
+                              - (UChar*)from_tteC->tcptr );
+   vg_assert(from_offs < 100000/* let's say */);
+
+   if (VG_(clo_parallel_execution)) {
+      /* Several threads running in parallel may have left through
+         the same unchained jump.  The first one to get here chains
+         it, and the others must not patch it again. */
+      UWord i, n = OutEdgeArr__size(&from_tteC->out_edges);
+      for (i = 0; i < n; i++) {
+         if (OutEdgeArr__index(&from_tteC->out_edges, i)->from_offs
+             == from_offs)
+            return;
+      }
+   }
+
+   /* Nobody may be running the code we patch. */
+   VG_(stop_parallel_threads)();
 
    /* Get VEX to do the patching itself.  We have to hand it off
       since it is host-dependent. */
@@ -936,9 +960,6 @@ void VG_(tt_tc_do_chaining) ( void* from__patch_addr,
    ie.from_sNo   = from_sNo;
    ie.from_tteNo = from_tteNo;
    ie.to_fastEP  = to_fastEP;
-   HWord from_offs = (HWord)( (UChar*)from__patch_addr
-                              - (UChar*)from_tteC->tcptr );
-   vg_assert(from_offs < 100000/* let's say */);
    ie.from_offs  = (UInt)from_offs;
 
    /* This is the new to_ -> from_ backlink to add. */
@@ -965,6 +986,7 @@ static void unchain_one ( VexArch arch_host, VexEndness endness_host,
                           void* to_fastEPaddr, void* to_slowEPaddr )
 {
    vg_assert(ie);
+   VG_(stop_parallel_threads)();
    TTEntryC* tteC
       = index_tteC(ie->from_sNo, ie->from_tteNo);
    UChar* place_to_patch
@@ -1460,9 +1482,95 @@ static inline HTTno HASH_TT ( Addr key )
    return (HTTno)(k32 % N_HTTES_PER_SECTOR);
 }
 
+/* With --parallel-execution=yes, threads running unlocked look up
+   VG_(tt_fast) while we fill it.  VG_(disp_cp_xindir_parallel)
+   compares the guest address of a way, then jumps to its host address,
+   so a way may only get a new entry while nobody can be between those
+   two loads on it.  Stopping those threads for every fill would cost
+   far too much, so instead sets are never shifted, and:
+
+   - A free way (guest TRANSTAB_BOGUS_GUEST_ADDR) gets the host address
+     first and the guest address last.  amd64 keeps both the stores and
+     the loads in order, so whoever sees the new guest sees its host.
+   - When the set is full, one way is retired: its guest is set to
+     TRANSTAB_BOGUS_GUEST_ADDR, but the way isn't filled again until a
+     grace period (see VG_(start_parallel_grace_period)) has passed.
+     Its old host stays valid until then, and the new entry just isn't
+     cached this time.
+
+   Removing entries whose code goes away still stops those threads. */
+
+#define N_FAST_RETIRED 1024
+
+/* Bit n is set when way n of the set is retired. */
+static UChar fast_retired[VG_TT_FAST_SETS];
+
+/* Retired ways, as (setNo << 2) | way, waiting for the current grace
+   period, and retired since it started. */
+static UInt fast_retired_old[N_FAST_RETIRED];
+static UInt n_fast_retired_old = 0;
+static UInt fast_retired_new[N_FAST_RETIRED];
+static UInt n_fast_retired_new = 0;
+
+/* Way to retire next; rotates so that no way stays forever. */
+static UInt fast_victim = 0;
+
+/* Forget all retired ways, once nobody can be reading them. */
+static void clearFastCacheRetired ( void )
+{
+   VG_(memset)(fast_retired, 0, sizeof(fast_retired));
+   n_fast_retired_old = 0;
+   n_fast_retired_new = 0;
+}
+
+static void setFastCacheEntryParallel ( Addr guest, ULong* tcptr )
+{
+   UInt i, way;
+
+   if (n_fast_retired_old > 0 && VG_(parallel_grace_period_over)()) {
+      for (i = 0; i < n_fast_retired_old; i++)
+         fast_retired[fast_retired_old[i] >> 2]
+            &= ~(1 << (fast_retired_old[i] & 3));
+      n_fast_retired_old = 0;
+   }
+   if (n_fast_retired_old == 0 && n_fast_retired_new > 0) {
+      VG_(memcpy)(fast_retired_old, fast_retired_new,
+                  n_fast_retired_new * sizeof(UInt));
+      n_fast_retired_old = n_fast_retired_new;
+      n_fast_retired_new = 0;
+      VG_(start_parallel_grace_period)();
+   }
+
+   UWord setNo = (UInt)VG_TT_FAST_HASH(guest);
+   /* The ways are guest/host pairs of words, checked at startup. */
+   volatile Addr* ways = (volatile Addr*)&VG_(tt_fast)[setNo];
+
+   for (way = 0; way < 4; way++) {
+      if (ways[2*way] == TRANSTAB_BOGUS_GUEST_ADDR
+          && !(fast_retired[setNo] & (1 << way))) {
+         ways[2*way+1] = (Addr)tcptr;
+         ways[2*way]   = guest;
+         n_fast_updates++;
+         return;
+      }
+   }
+
+   /* Full.  Retire one way, unless the set already waits for one. */
+   if (fast_retired[setNo] != 0 || n_fast_retired_new == N_FAST_RETIRED)
+      return;
+   way = fast_victim++ & 3;
+   ways[2*way] = TRANSTAB_BOGUS_GUEST_ADDR;
+   fast_retired[setNo] |= 1 << way;
+   fast_retired_new[n_fast_retired_new++] = (setNo << 2) | way;
+   n_fast_retired++;
+}
+
 /* Invalidate the fast cache VG_(tt_fast). */
 static void invalidateFastCache ( void )
 {
+   VG_(stop_parallel_threads)();
+   if (VG_(clo_parallel_execution))
+      clearFastCacheRetired();
    for (UWord j = 0; j < VG_TT_FAST_SETS; j++) {
       FastCacheSet* set = &VG_(tt_fast)[j];
       set->guest0 = TRANSTAB_BOGUS_GUEST_ADDR;
@@ -1480,6 +1588,7 @@ static void invalidateFastCacheEntry ( Addr guest )
       which should reject any attempt to make translation of code
       starting at TRANSTAB_BOGUS_GUEST_ADDR. */
    vg_assert(guest != TRANSTAB_BOGUS_GUEST_ADDR);
+   VG_(stop_parallel_threads)();
    /* If any entry in the line is the right one, just set it to
       TRANSTAB_BOGUS_GUEST_ADDR.  Doing so ensure that the entry will never
       be used in future, so will eventually fall off the end of the line,
@@ -1507,6 +1616,10 @@ static void setFastCacheEntry ( Addr guest, ULong* tcptr )
       which should reject any attempt to make translation of code
       starting at TRANSTAB_BOGUS_GUEST_ADDR. */
    vg_assert(guest != TRANSTAB_BOGUS_GUEST_ADDR);
+   if (VG_(clo_parallel_execution)) {
+      setFastCacheEntryParallel(guest, tcptr);
+      return;
+   }
    /* Shift all entries along one, so that the LRU one disappears, and put the
       new entry at the MRU position. */
    UWord setNo = (UInt)VG_TT_FAST_HASH(guest);
@@ -1634,7 +1747,9 @@ static void initialiseSector ( SECno sno )
 
    } else {
 
-      /* Sector has been used before.  Dump the old contents. */
+      /* Sector has been used before.  Dump the old contents.  Its code
+         is about to be overwritten, so nobody may be running it. */
+      VG_(stop_parallel_threads)();
       if (VG_(clo_stats) || VG_(debugLog_getLevel)() >= 1)
          VG_(dmsg)("transtab: " "recycle  sector %d\n", sno);
       n_sectors_recycled++;
@@ -1735,7 +1850,8 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
                            UInt             code_len,
                            Bool             is_self_checking,
                            Int              offs_profInc,
-                           UInt             n_guest_instrs )
+                           UInt             n_guest_instrs,
+                           Bool             is_first_tier )
 {
    Int    tcAvailQ, reqdQ, y;
    ULong  *tcptr, *tcptr2;
@@ -1833,6 +1949,8 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
    TTEntryH__init(&sectors[y].ttH[tteix]);
    sectors[y].ttC[tteix].tcptr  = tcptr;
    sectors[y].ttC[tteix].usage.prof.count  = 0;
+   sectors[y].ttC[tteix].usage.prof.first_tier = is_first_tier;
+   vg_assert(!is_first_tier || offs_profInc != -1);
 
    sectors[y].ttC[tteix].usage.prof.weight
       = False
@@ -2311,6 +2429,87 @@ void VG_(discard_translations) ( Addr guest_start, ULong range,
    }
 }
 
+/*-------------------------------------------------------------*/
+/*--- Tiered translation.                                   ---*/
+/*-------------------------------------------------------------*/
+
+/* Find first-tier translations entered at least threshold times since
+   they were made, and put (at most n_max of) their entry points in
+   entries[].  The ones returned are no longer first-tier candidates,
+   so that a block which cannot be retranslated is not tried again. */
+UInt VG_(find_hot_first_tier) ( /*OUT*/Addr* entries, UInt n_max,
+                                ULong threshold )
+{
+   SECno sno;
+   TTEno i;
+   UInt  n = 0;
+
+   vg_assert(init_done);
+   for (sno = 0; sno < n_sectors && n < n_max; sno++) {
+      if (sectors[sno].tc == NULL)
+         continue;
+      for (i = 0; i < N_TTES_PER_SECTOR && n < n_max; i++) {
+         TTEntryC* tteC = &sectors[sno].ttC[i];
+         if (sectors[sno].ttH[i].status != InUse
+             || !tteC->usage.prof.first_tier
+             || tteC->usage.prof.count < threshold)
+            continue;
+         tteC->usage.prof.first_tier = False;
+         entries[n++] = tteC->entry;
+      }
+   }
+   return n;
+}
+
+/* Like VG_(add_to_transtab), but first deletes the translation of
+   entry, if there is one.  Jumps chained to the old translation are
+   unchained, so they go through the dispatcher again and get chained
+   to the new one.  The new translation inherits the old one's count,
+   which --trace-formation uses as the block's profile. */
+void VG_(replace_in_transtab)( const VexGuestExtents* vge,
+                               Addr             entry,
+                               Addr             code,
+                               UInt             code_len,
+                               Bool             is_self_checking,
+                               Int              offs_profInc,
+                               UInt             n_guest_instrs )
+{
+   SECno sno;
+   TTEno tteno;
+   Addr  ga_deleted;
+   ULong count = 0;
+
+   if (VG_(search_transtab)( NULL, &sno, &tteno, entry, False )) {
+      count = sectors[sno].ttC[tteno].usage.prof.count;
+      VexArch     arch_host = VexArch_INVALID;
+      VexArchInfo archinfo_host;
+      VG_(bzero_inline)(&archinfo_host, sizeof(archinfo_host));
+      VG_(machine_get_VexArchInfo)( &arch_host, &archinfo_host );
+      delete_tte( &ga_deleted, &sectors[sno], sno, tteno,
+                  arch_host, archinfo_host.endness );
+      invalidateFastCacheEntry( entry );
+   }
+   VG_(add_to_transtab)( vge, entry, code, code_len, is_self_checking,
+                         offs_profInc, n_guest_instrs, False );
+   if (VG_(search_transtab)( NULL, &sno, &tteno, entry, False ))
+      sectors[sno].ttC[tteno].usage.prof.count = count;
+}
+
+/* How many times has the translation of guest_addr been entered?
+   Only known for first-tier translations, and ones that replaced them
+   (which keep the count the first-tier one had), or when profiling.
+   Returns False if there is no translation of guest_addr. */
+Bool VG_(transtab_entry_count) ( Addr guest_addr, /*OUT*/ULong* count )
+{
+   SECno sno;
+   TTEno tteno;
+
+   if (!VG_(search_transtab)( NULL, &sno, &tteno, guest_addr, False ))
+      return False;
+   *count = sectors[sno].ttC[tteno].usage.prof.count;
+   return True;
+}
+
 /* Whether or not tools may discard translations. */
 Bool  VG_(ok_to_discard_translations) = False;
 
@@ -2682,6 +2881,10 @@ void VG_(print_tt_tc_stats) ( void )
    VG_(message)(Vg_DebugMsg,
       "    tt/tc: %'llu fast-cache updates, %'llu flushes\n",
       n_fast_updates, n_fast_flushes );
+   if (VG_(clo_parallel_execution))
+      VG_(message)(Vg_DebugMsg,
+         "    tt/tc: %'llu fast-cache ways retired\n",
+         n_fast_retired );
 
    VG_(message)(Vg_DebugMsg,
                 " transtab: new        %'llu "
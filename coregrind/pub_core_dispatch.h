@@ -70,6 +70,9 @@ void VG_(disp_run_translations)( HWord* two_words,
 void VG_(disp_cp_chain_me_to_slowEP)(void);
 void VG_(disp_cp_chain_me_to_fastEP)(void);
 void VG_(disp_cp_xindir)(void);
+#if defined(VGP_amd64_linux)
+void VG_(disp_cp_xindir_parallel)(void);
+#endif
 void VG_(disp_cp_xassisted)(void);
 void VG_(disp_cp_evcheck_fail)(void);
 
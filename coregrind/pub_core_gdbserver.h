@@ -164,6 +164,11 @@ extern IRSB* VG_(instrument_for_gdbserver_if_needed)
       const VexGuestExtents* vge,
       IRType gWordTy, IRType hWordTy);
 
+/* Returns the reason for which the block made of vge needs gdbserver
+   instrumentation, or Vg_VgdbNo if it does not need any. */
+extern VgVgdb VG_(gdbserver_instrumentation_needed)
+     (const VexGuestExtents* vge);
+
 /* reason for which gdbserver connection must be finished */
 typedef
    enum {
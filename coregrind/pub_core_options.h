@@ -330,6 +330,21 @@ extern UInt VG_(clo_num_transtab_sectors);
    provided default. */
 extern UInt VG_(clo_avg_transtab_entry_size);
 
+/* Translate blocks cheaply first, and again with the configured VEX
+   settings once they have been entered VG_(clo_tier_up_threshold)
+   times.  See m_translate.c. */
+extern Bool VG_(clo_tiered_translation);
+extern UInt VG_(clo_tier_up_threshold);
+
+/* When retranslating a hot block, continue the superblock across
+   conditional branches into the successor which was entered more
+   often.  Needs VG_(clo_tiered_translation). */
+extern Bool VG_(clo_trace_formation);
+
+/* Directory of the persistent translation cache, or NULL if there is
+   none.  See m_transcache.c. */
+extern const HChar* VG_(clo_translation_cache_dir);
+
 /* Only client requested fixed mapping can be done below 
    VG_(clo_aspacem_minAddr). */
 extern Addr VG_(clo_aspacem_minAddr);
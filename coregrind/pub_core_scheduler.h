@@ -84,6 +84,27 @@ extern void VG_(release_BigLock_LL) ( const HChar* who );
 /* Whether the specified thread owns the big lock. */
 extern Bool VG_(owns_BigLock_LL) ( ThreadId tid );
 
+/* With --parallel-execution=yes, tid runs generated code without the
+   big lock.  Take it again once out of generated code: after
+   returning from the dispatcher, or on entry to a synchronous signal
+   handler.  Does nothing if tid already has it. */
+extern void VG_(acquire_BigLock_after_generated_code) ( ThreadId tid );
+
+/* Wait until no thread runs generated code without the big lock.
+   The caller must hold it, so they stay out until it releases it.
+   Needed before changing VG_(tt_fast) or code in the translation
+   cache. */
+extern void VG_(stop_parallel_threads) ( void );
+
+/* A cheaper alternative to VG_(stop_parallel_threads) for removing
+   something that threads without the big lock may still be reading:
+   start a grace period, and once VG_(parallel_grace_period_over)
+   returns True, every thread that was in generated code when it
+   started has left it since.  There is one grace period at a time;
+   starting another abandons the previous one. */
+extern void VG_(start_parallel_grace_period) ( void );
+extern Bool VG_(parallel_grace_period_over) ( void );
+
 /* Yield the CPU for a while.  Drops/acquires the lock using the
    normal (non _LL) functions. */
 extern void VG_(vg_yield)(void);
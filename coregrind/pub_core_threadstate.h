@@ -403,6 +403,19 @@ typedef struct {
    Bool               sched_jmpbuf_valid;
    VG_MINIMAL_JMP_BUF(sched_jmpbuf);
 
+   /* True while the thread runs generated code without holding
+      the_BigLock (--parallel-execution=yes). */
+   Bool running_unlocked;
+
+   /* Incremented by the thread each time it starts or stops running
+      generated code without the_BigLock, so odd while it does.  See
+      VG_(start_parallel_grace_period). */
+   volatile UInt unlocked_count;
+
+   /* unlocked_count when the current grace period started, or 0 if
+      the thread wasn't in generated code then. */
+   UInt grace_count;
+
    /* This thread's name. NULL, if no name. */
    HChar *thread_name;
    UInt ptrace;
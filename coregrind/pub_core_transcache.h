@@ -0,0 +1,90 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Persistent on-disk cache of translations.                    ---*/
+/*---                                        pub_core_transcache.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __PUB_CORE_TRANSCACHE_H
+#define __PUB_CORE_TRANSCACHE_H
+
+//--------------------------------------------------------------------
+// PURPOSE: This module keeps translations of code from file-backed
+// ELF objects on disk (--translation-cache-dir), so that a later run
+// of the same tool with the same options on the same objects can put
+// them straight into the translation table instead of calling
+// LibVEX_Translate again.  There is one cache file per object and
+// configuration, named after the object's build-id and a hash of the
+// configuration.
+//--------------------------------------------------------------------
+
+#include "pub_core_basics.h"   // VG_ macro
+#include "libvex.h"            // VexGuestExtents, VexAbiInfo
+
+/* Max number of chased-into addresses a cacheable translation may
+   have.  Each of them is checked with chase_into_ok again before a
+   cached translation is reused. */
+#define VG_TRANSCACHE_MAX_CHASED 4
+
+/* A translation, as stored in and returned by the cache.  The host
+   code is the unchained code made by LibVEX_Translate, which is
+   position independent: VG_(add_to_transtab) copies it the same way. */
+typedef
+   struct {
+      VexGuestExtents vge;
+      Addr         chased[VG_TRANSCACHE_MAX_CHASED];
+      UInt         n_chased;
+      const UChar* code;
+      UInt         code_len;
+      Int          offs_profInc;
+      UInt         n_guest_instrs;
+   }
+   TranscacheEntry;
+
+/* Check the option and the tool's needs, and compute the
+   configuration hash.  Called once the tool's needs are final. */
+extern void VG_(transcache_init) ( void );
+
+/* Write the new translations of each object to its cache file. */
+extern void VG_(transcache_fini) ( void );
+
+/* Is the cache in use in this run? */
+extern Bool VG_(transcache_enabled) ( void );
+
+/* Look up a cached translation of NRADDR made with ABI.  Returns True
+   if there is one whose guest code and object mapping are the same as
+   now; the caller still has to check chase targets and self-checks. */
+extern Bool VG_(transcache_lookup) ( Addr nraddr, const VexAbiInfo* abi,
+                                     /*OUT*/TranscacheEntry* te );
+
+/* Record a fresh translation of NRADDR, if all its extents are in one
+   file-backed object that has a build-id. */
+extern void VG_(transcache_add) ( Addr nraddr, const VexAbiInfo* abi,
+                                  const TranscacheEntry* te );
+
+extern void VG_(print_transcache_stats) ( void );
+
+#endif   // __PUB_CORE_TRANSCACHE_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
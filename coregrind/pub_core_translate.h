@@ -44,6 +44,9 @@ Bool VG_(translate) ( ThreadId tid,
                       ULong    bbs_done,
                       Bool     allow_redirection );
 
+/* Retranslate hot first-tier translations (--tiered-translation). */
+extern void VG_(tier_up_translations) ( ThreadId tid, ULong bbs_done );
+
 extern void VG_(print_translation_stats) ( void );
 
 #endif   // __PUB_CORE_TRANSLATE_H
@@ -174,7 +174,25 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
                            UInt             code_len,
                            Bool             is_self_checking,
                            Int              offs_profInc,
-                           UInt             n_guest_instrs );
+                           UInt             n_guest_instrs,
+                           Bool             is_first_tier );
+
+/* Tiered translation: see VG_(clo_tiered_translation). */
+extern
+UInt VG_(find_hot_first_tier) ( /*OUT*/Addr* entries, UInt n_max,
+                                ULong threshold );
+
+extern
+void VG_(replace_in_transtab)( const VexGuestExtents* vge,
+                               Addr             entry,
+                               Addr             code,
+                               UInt             code_len,
+                               Bool             is_self_checking,
+                               Int              offs_profInc,
+                               UInt             n_guest_instrs );
+
+extern
+Bool VG_(transtab_entry_count) ( Addr guest_addr, /*OUT*/ULong* count );
 
 typedef UShort SECno; // SECno type identifies a sector
 typedef UShort TTEno; // TTEno type identifies a TT entry in a sector.
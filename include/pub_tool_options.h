@@ -329,6 +329,12 @@ extern VexRegisterUpdates VG_(clo_px_file_backed);
 
 extern Int VG_(clo_redzone_size);
 
+/* Client threads run generated code at the same time
+   (--parallel-execution).  Tool-visible so that tools with
+   VG_(needs_parallel_execution) can pick thread-safe helpers only when
+   they are needed. */
+extern Bool VG_(clo_parallel_execution);
+
 typedef
    enum {
       Vg_XTMemory_None,   // Do not do any xtree memory profiling.
@@ -495,6 +495,19 @@ extern void VG_(needs_xml_output) ( void );
    function here. */
 extern void VG_(needs_final_IR_tidy_pass) ( IRSB*(*final_tidy)(IRSB*) );
 
+/* Can translations be kept across runs (--translation-cache-dir)?  Only
+   if the instrumented code depends on nothing but the guest code and
+   the command line options: in particular it must not embed addresses
+   of memory allocated at run time, or values such as ExeContext
+   uniques. */
+extern void VG_(needs_persistent_translations) ( void );
+
+/* Can guest threads run generated code at the same time
+   (--parallel-execution)?  Only if the instrumented code and the
+   helpers it calls are safe to run concurrently, and do not rely on
+   the core's lock: for example, counters must be updated atomically. */
+extern void VG_(needs_parallel_execution) ( void );
+
 
 /* ------------------------------------------------------------------ */
 /* Core events to track */
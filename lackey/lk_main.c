@@ -286,6 +286,39 @@ static void add_one_inverted_Jcc_untaken(void)
    n_IJccs_untaken++;
 }
 
+/* With --parallel-execution=yes, threads can run the counting helpers
+   at the same time, so the instrumentation calls these atomic variants
+   instead (see COUNT_HELPER).  That mode is only available on amd64,
+   where they are cheap. */
+#if defined(VGA_amd64)
+#  define ATOMIC_INC(x) __sync_fetch_and_add(&(x), 1)
+#else
+#  define ATOMIC_INC(x) (x)++
+#endif
+
+#define ATOMIC_HELPER(fn, counter) \
+   static void fn##_atomic(void) \
+   { \
+      ATOMIC_INC(counter); \
+   }
+
+ATOMIC_HELPER(add_one_func_call,            n_func_calls)
+ATOMIC_HELPER(add_one_SB_entered,           n_SBs_entered)
+ATOMIC_HELPER(add_one_SB_completed,         n_SBs_completed)
+ATOMIC_HELPER(add_one_IRStmt,               n_IRStmts)
+ATOMIC_HELPER(add_one_guest_instr,          n_guest_instrs)
+ATOMIC_HELPER(add_one_Jcc,                  n_Jccs)
+ATOMIC_HELPER(add_one_Jcc_untaken,          n_Jccs_untaken)
+ATOMIC_HELPER(add_one_inverted_Jcc,         n_IJccs)
+ATOMIC_HELPER(add_one_inverted_Jcc_untaken, n_IJccs_untaken)
+
+/* Name and address of the plain or atomic variant of a helper, as the
+   second and third arguments of unsafeIRDirty_0_N. */
+#define COUNT_HELPER(fn) \
+   (VG_(clo_parallel_execution) ? #fn "_atomic" : #fn), \
+   VG_(fnptr_to_fnentry)( VG_(clo_parallel_execution) \
+                          ? (void*)&fn##_atomic : (void*)&fn )
+
 /*------------------------------------------------------------*/
 /*--- Stuff for --detailed-counts                          ---*/
 /*------------------------------------------------------------*/
@@ -359,6 +392,12 @@ void increment_detail(ULong* detail)
    (*detail)++;
 }
 
+static VG_REGPARM(1)
+void increment_detail_atomic(ULong* detail)
+{
+   ATOMIC_INC(*detail);
+}
+
 /* A helper that adds the instrumentation for a detail.  guard ::
    Ity_I1 is the guarding condition for the event.  If NULL it is
    assumed to mean "always True". */
@@ -372,9 +411,7 @@ static void instrument_detail(IRSB* sb, Op op, IRType type, IRAtom* guard)
    tl_assert(typeIx < N_TYPES);
 
    argv = mkIRExprVec_1( mkIRExpr_HWord( (HWord)&detailCounts[op][typeIx] ) );
-   di = unsafeIRDirty_0_N( 1, "increment_detail",
-                              VG_(fnptr_to_fnentry)( &increment_detail ), 
-                              argv);
+   di = unsafeIRDirty_0_N( 1, COUNT_HELPER(increment_detail), argv);
    if (guard) di->guard = guard;
    addStmtToIRSB( sb, IRStmt_Dirty(di) );
 }
@@ -645,6 +682,12 @@ static void lk_post_clo_init(void)
          for (tyIx = 0; tyIx < N_TYPES; tyIx++)
             detailCounts[op][tyIx] = 0;
    }
+
+   /* The counters are safe to update from several threads at once,
+      but the memory trace buffer and the superblock trace output
+      aren't. */
+   if (!clo_trace_mem && !clo_trace_sbs)
+      VG_(needs_parallel_execution) ();
 }
 
 static
@@ -681,8 +724,7 @@ IRSB* lk_instrument ( VgCallbackClosure* closure,
 
    if (clo_basic_counts) {
       /* Count this superblock. */
-      di = unsafeIRDirty_0_N( 0, "add_one_SB_entered", 
-                                 VG_(fnptr_to_fnentry)( &add_one_SB_entered ),
+      di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_SB_entered),
                                  mkIRExprVec_0() );
       addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
    }
@@ -707,8 +749,7 @@ IRSB* lk_instrument ( VgCallbackClosure* closure,
 
       if (clo_basic_counts) {
          /* Count one VEX statement. */
-         di = unsafeIRDirty_0_N( 0, "add_one_IRStmt", 
-                                    VG_(fnptr_to_fnentry)( &add_one_IRStmt ), 
+         di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_IRStmt), 
                                     mkIRExprVec_0() );
          addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
       }
@@ -729,8 +770,7 @@ IRSB* lk_instrument ( VgCallbackClosure* closure,
                ilen  = st->Ist.IMark.len;
 
                /* Count guest instruction. */
-               di = unsafeIRDirty_0_N( 0, "add_one_guest_instr",
-                                          VG_(fnptr_to_fnentry)( &add_one_guest_instr ), 
+               di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_guest_instr), 
                                           mkIRExprVec_0() );
                addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
 
@@ -752,9 +792,7 @@ IRSB* lk_instrument ( VgCallbackClosure* closure,
                if (VG_(get_fnname_if_entry)(ep, st->Ist.IMark.addr,
                                             &fnname)
                    && 0 == VG_(strcmp)(fnname, clo_fnname)) {
-                  di = unsafeIRDirty_0_N( 
-                          0, "add_one_func_call", 
-                             VG_(fnptr_to_fnentry)( &add_one_func_call ), 
+                  di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_func_call), 
                              mkIRExprVec_0() );
                   addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
                }
@@ -938,13 +976,10 @@ IRSB* lk_instrument ( VgCallbackClosure* closure,
 
                /* Count Jcc */
                if (!condition_inverted)
-                  di = unsafeIRDirty_0_N( 0, "add_one_Jcc", 
-                                          VG_(fnptr_to_fnentry)( &add_one_Jcc ), 
+                  di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_Jcc), 
                                           mkIRExprVec_0() );
                else
-                  di = unsafeIRDirty_0_N( 0, "add_one_inverted_Jcc",
-                                          VG_(fnptr_to_fnentry)(
-                                             &add_one_inverted_Jcc ),
+                  di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_inverted_Jcc),
                                           mkIRExprVec_0() );
 
                addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
@@ -958,14 +993,10 @@ IRSB* lk_instrument ( VgCallbackClosure* closure,
             if (clo_basic_counts) {
                /* Count non-taken Jcc */
                if (!condition_inverted)
-                  di = unsafeIRDirty_0_N( 0, "add_one_Jcc_untaken", 
-                                          VG_(fnptr_to_fnentry)(
-                                             &add_one_Jcc_untaken ),
+                  di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_Jcc_untaken),
                                           mkIRExprVec_0() );
                else
-                  di = unsafeIRDirty_0_N( 0, "add_one_inverted_Jcc_untaken",
-                                          VG_(fnptr_to_fnentry)(
-                                             &add_one_inverted_Jcc_untaken ),
+                  di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_inverted_Jcc_untaken),
                                           mkIRExprVec_0() );
 
                addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
@@ -980,8 +1011,7 @@ IRSB* lk_instrument ( VgCallbackClosure* closure,
 
    if (clo_basic_counts) {
       /* Count this basic block. */
-      di = unsafeIRDirty_0_N( 0, "add_one_SB_completed", 
-                                 VG_(fnptr_to_fnentry)( &add_one_SB_completed ),
+      di = unsafeIRDirty_0_N( 0, COUNT_HELPER(add_one_SB_completed),
                                  mkIRExprVec_0() );
       addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
    }
@@ -1059,6 +1089,7 @@ static void lk_pre_clo_init(void)
    VG_(needs_command_line_options)(lk_process_cmd_line_option,
                                    lk_print_usage,
                                    lk_print_debug_usage);
+   VG_(needs_persistent_translations)();
 }
 
 VG_DETERMINE_INTERFACE_VERSION(lk_pre_clo_init)
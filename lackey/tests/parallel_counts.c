@@ -0,0 +1,39 @@
+/* Several threads call count_me() a known number of times, so lackey's
+   --fnname count is exact, whether or not the threads run in parallel. */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define N_THREADS 4
+#define N_CALLS   10000
+
+static volatile int sink;
+
+__attribute__((noinline))
+void count_me(int i)
+{
+   sink += i;
+}
+
+static void* worker(void* arg)
+{
+   int i;
+
+   for (i = 0; i < N_CALLS; i++)
+      count_me(i);
+   return NULL;
+}
+
+int main(void)
+{
+   pthread_t t[N_THREADS];
+   int i;
+
+   for (i = 0; i < N_THREADS; i++)
+      pthread_create(&t[i], NULL, worker, NULL);
+   for (i = 0; i < N_THREADS; i++)
+      pthread_join(t[i], NULL);
+
+   printf("done\n");
+   return 0;
+}
@@ -7778,6 +7778,10 @@ static void mc_post_clo_init ( void )
 #     endif
       VG_(track_new_mem_stack)     ( mc_new_mem_stack     );
       VG_(track_new_mem_stack_signal) ( mc_new_mem_w_tid_no_ECU );
+
+      /* Without origin tracking, no ExeContext uniques end up in the
+         instrumented code, so translations can be kept across runs. */
+      VG_(needs_persistent_translations) ();
    }
 
    // We assume that brk()/sbrk() does not initialise new memory.  Is this
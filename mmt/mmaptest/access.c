@@ -0,0 +1,98 @@
+/*
+ * Accesses a shared mapping of every given file in the same way: single
+ * stores and loads, a polling loop which reads one value many times and
+ * yields the CPU, runs of strided stores and a pair of stores too short to
+ * be a run. Prints what it read back.
+ *
+ * Usage: access file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define LEN 0x1000
+
+static void run(const char *path)
+{
+	volatile uint32_t *p;
+	volatile uint64_t *q;
+	volatile uint8_t *b;
+	const char *name;
+	uint32_t poll = 0, sum = 0;
+	uint64_t sum64 = 0;
+	int fd, i;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror("open");
+		exit(1);
+	}
+	if (ftruncate(fd, LEN) < 0)
+	{
+		perror("ftruncate");
+		exit(1);
+	}
+
+	p = mmap(NULL, LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	q = (volatile uint64_t *)p;
+	b = (volatile uint8_t *)p;
+
+	/* single accesses */
+	p[0] = 0x12345678;
+	b[0x10] = 0xab;
+
+	/* polling loop, with a syscall which must not split it */
+	for (i = 0; i < 100; ++i)
+	{
+		poll += p[0];
+		sched_yield();
+	}
+
+	/* runs of strided stores */
+	for (i = 0; i < 16; ++i)
+		p[0x40 + i] = 0x01010101 * i;
+	for (i = 0; i < 4; ++i)
+		q[0x40 + 2 * i] = 0x1000000000ULL + i;
+
+	/* too short for a run */
+	p[0x200] = 1;
+	p[0x202] = 2;
+
+	for (i = 0; i < 16; ++i)
+		sum += p[0x40 + i];
+	for (i = 0; i < 4; ++i)
+		sum64 += q[0x40 + 2 * i];
+
+	name = strrchr(path, '/');
+	printf("%s: %x %x %x %llx %x\n", name ? name + 1 : path, poll, b[0x10],
+			sum, (unsigned long long)sum64, p[0x200] + p[0x202]);
+
+	munmap((void *)p, LEN);
+	close(fd);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s file...\n", argv[0]);
+		exit(1);
+	}
+
+	for (i = 1; i < argc; ++i)
+		run(argv[i]);
+	return 0;
+}
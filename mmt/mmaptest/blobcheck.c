@@ -0,0 +1,89 @@
+/*
+ * Checks that every deduplicated dump ('Y' record) in a binary trace
+ * refers to a blob ('b' record) written earlier in the same trace, and
+ * prints the number of blobs and references.
+ *
+ * Usage: blobcheck trace
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mmt_reader.h"
+
+#define MAX_BLOBS 4096
+
+static unsigned char defined[MAX_BLOBS];
+
+static unsigned int get4(const unsigned char *p)
+{
+	unsigned int v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[1 << 24];
+	unsigned int blobs = 0, refs = 0, id;
+	size_t size, pos = 0;
+	long len;
+	FILE *f;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s trace\n", argv[0]);
+		return 2;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f)
+	{
+		perror(argv[1]);
+		return 2;
+	}
+	size = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	while (pos < size)
+	{
+		const unsigned char *p = buf + pos;
+
+		len = mmt_record_len(p, size - pos);
+		if (len < 0)
+		{
+			fprintf(stderr, "%s: %s at %zu\n", argv[1], mmt_reader_error(len),
+					pos);
+			return 2;
+		}
+
+		if (p[0] == 'b' || p[0] == 'Y')
+		{
+			id = get4(p + (p[0] == 'b' ? 1 : 9));
+			if (id >= MAX_BLOBS)
+			{
+				fprintf(stderr, "%s: blob id %u too big\n", argv[1], id);
+				return 2;
+			}
+
+			if (p[0] == 'b')
+			{
+				defined[id] = 1;
+				blobs++;
+			}
+			else if (!defined[id])
+			{
+				printf("%zu: dump refers to unknown blob %u\n", pos, id);
+				return 1;
+			}
+			else
+				refs++;
+		}
+
+		pos += len;
+	}
+
+	printf("%u blobs, %u references\n", blobs, refs);
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Device model for mmt-replay which prints every record it is given, one
+ * per line, so decoded traces can be compared with expected output.
+ * Reads return the traced value and ioctls are not modelled. Only the last
+ * component of opened paths is printed, so output does not depend on the
+ * directory tests run in.
+ *
+ * Usage: mmt-replay -q -d ./dump_model.so trace
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "../mmt_replay.h"
+
+static void print_data(const void *data, unsigned int len)
+{
+	const unsigned char *d = data;
+	unsigned int i;
+
+	/* values of single accesses as numbers, longer runs as bytes */
+	if (len <= 8)
+	{
+		printf("0x");
+		for (i = len; i > 0; --i)
+			printf("%02x", d[i - 1]);
+		return;
+	}
+
+	for (i = 0; i < len; ++i)
+		printf("%s%02x", i ? " " : "", d[i]);
+}
+
+static void dump_open(void *priv, int fd, const char *path)
+{
+	const char *name = strrchr(path, '/');
+
+	printf("open fd %d %s\n", fd, name ? name + 1 : path);
+}
+
+static void dump_dup(void *priv, int oldfd, int newfd)
+{
+	printf("dup fd %d to %d\n", oldfd, newfd);
+}
+
+static void dump_mmap(void *priv, unsigned int region, int fd,
+		unsigned long long offset, unsigned long long len)
+{
+	printf("mmap region %u fd %d offset 0x%llx len 0x%llx\n", region, fd,
+			offset, len);
+}
+
+static void dump_munmap(void *priv, unsigned int region)
+{
+	printf("munmap region %u\n", region);
+}
+
+static void dump_write(void *priv, unsigned int region,
+		unsigned long long offset, const void *data, unsigned int len)
+{
+	printf("w %u:0x%04llx, ", region, offset);
+	print_data(data, len);
+	printf("\n");
+}
+
+static void dump_read(void *priv, unsigned int region,
+		unsigned long long offset, void *data, unsigned int len)
+{
+	printf("r %u:0x%04llx, ", region, offset);
+	print_data(data, len);
+	printf("\n");
+}
+
+static void dump_sync(void *priv, unsigned int id)
+{
+	printf("sync %u\n", id);
+}
+
+static const struct mmt_replay_model dump_model =
+{
+	.version = MMT_REPLAY_MODEL_VERSION,
+	.name = "dump",
+	.open = dump_open,
+	.dup = dump_dup,
+	.mmap = dump_mmap,
+	.munmap = dump_munmap,
+	.write = dump_write,
+	.read = dump_read,
+	.sync = dump_sync,
+};
+
+const struct mmt_replay_model *mmt_replay_model_get(void)
+{
+	return &dump_model;
+}
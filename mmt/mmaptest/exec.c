@@ -0,0 +1,102 @@
+/*
+ * Writes to a shared mapping of a file from a process which tries to
+ * execve missing programs, then execs itself, and from a forked child which
+ * execs /bin/true. Under --trace-children=yes --mmt-timestamps with
+ * --log-file=name.%p, the trace written before the successful execve is
+ * kept in name.<pid>.1, and mmt-merge puts all traces back together.
+ *
+ * Usage: exec file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define LEN 0x1000
+
+static volatile uint32_t *map(const char *path, int flags)
+{
+	volatile uint32_t *p;
+	int fd;
+
+	fd = open(path, O_RDWR | flags, 0644);
+	if (fd < 0)
+	{
+		perror("open");
+		exit(1);
+	}
+	if (ftruncate(fd, LEN) < 0)
+	{
+		perror("ftruncate");
+		exit(1);
+	}
+
+	p = mmap(NULL, LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
+	return p;
+}
+
+int main(int argc, char **argv)
+{
+	char *missing[] = { "/nonexistent/exec", NULL };
+	volatile uint32_t *p;
+	int status;
+	pid_t pid;
+
+	if (argc == 2)
+	{
+		p = map(argv[1], O_CREAT | O_TRUNC);
+		p[0] = 0x10;
+
+		/* as in a PATH search */
+		execv("/nonexistent/1/exec", missing);
+		execv("/nonexistent/2/exec", missing);
+		p[1] = 0x11;
+
+		execl(argv[0], argv[0], argv[1], "again", NULL);
+		perror("execl");
+		exit(1);
+	}
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s file\n", argv[0]);
+		exit(1);
+	}
+
+	p = map(argv[1], 0);
+	p[2] = 0x12;
+
+	pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0)
+	{
+		p[3] = 0x13;
+		execl("/bin/true", "true", NULL);
+		perror("execl");
+		exit(1);
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "child failed\n");
+		exit(1);
+	}
+	p[4] = 0x14;
+	printf("done\n");
+
+	munmap((void *)p, LEN);
+	return 0;
+}
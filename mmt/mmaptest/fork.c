@@ -0,0 +1,105 @@
+/*
+ * Submits the same nouveau pushbuf from a process and its forked child.
+ * The file is not a DRM device, so the ioctl fails, but with
+ * --mmt-trace-nouveau-ioctls its buffers are still dumped, and with
+ * --mmt-dedup-dumps they become blobs, which the child's trace must define
+ * on its own.
+ *
+ * Usage: fork file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+struct pushbuf_push
+{
+	uint32_t bo_index;
+	uint32_t pad;
+	uint64_t offset;
+	uint64_t length;
+};
+
+struct pushbuf
+{
+	uint32_t channel;
+	uint32_t nr_buffers;
+	uint64_t buffers;
+	uint32_t nr_relocs;
+	uint32_t nr_push;
+	uint64_t relocs;
+	uint64_t push;
+	uint32_t suffix0;
+	uint32_t suffix1;
+	uint64_t vram_available;
+	uint64_t gart_available;
+};
+
+/* DRM_IOCTL_NOUVEAU_GEM_PUSHBUF */
+#define PUSHBUF_IOCTL _IOWR('d', 0x40 + 0x41, struct pushbuf)
+
+static void submit(int fd)
+{
+	struct pushbuf_push push[2];
+	struct pushbuf pb;
+
+	memset(push, 0, sizeof(push));
+	push[0].length = 0x100;
+	push[1].offset = 0x100;
+	push[1].length = 0x40;
+
+	memset(&pb, 0, sizeof(pb));
+	pb.nr_push = 2;
+	pb.push = (uintptr_t)push;
+
+	if (ioctl(fd, PUSHBUF_IOCTL, &pb) == 0)
+		fprintf(stderr, "pushbuf ioctl did not fail\n");
+}
+
+int main(int argc, char **argv)
+{
+	int fd, status;
+	pid_t pid;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s file\n", argv[0]);
+		exit(1);
+	}
+
+	fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror("open");
+		exit(1);
+	}
+
+	submit(fd);
+
+	pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0)
+	{
+		submit(fd);
+		exit(0);
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "child failed\n");
+		exit(1);
+	}
+	printf("done\n");
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Writes to a shared mapping of a file, which sync_consumer -c checks
+ * against the trace: with --mmt-sync-file every write must be traced
+ * before it reaches the file.
+ *
+ * Usage: order file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define LEN 0x1000
+
+int main(int argc, char **argv)
+{
+	volatile unsigned int *p;
+	volatile unsigned char *b;
+	int fd, i;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s file\n", argv[0]);
+		exit(1);
+	}
+
+	fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror("open");
+		exit(1);
+	}
+	if (ftruncate(fd, LEN) < 0)
+	{
+		perror("ftruncate");
+		exit(1);
+	}
+
+	p = mmap(NULL, LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	b = (volatile unsigned char *)p;
+
+	/* a run of consecutive stores, coalesced with --mmt-coalesce-stores */
+	p[0x10] = 0x11111111;
+	p[0x11] = 0x22222222;
+	p[0x12] = 0x33333333;
+	p[0x13] = 0x44444444;
+	p[0x14] = 0x55555555;
+	p[0x15] = 0x66666666;
+	p[0x16] = 0x77777777;
+	p[0x17] = 0x88888888;
+
+	/* single stores */
+	b[0x200] = 0x99;
+	p[0x100] = 0xaaaaaaaa;
+
+	for (i = 0x10; i < 0x18; ++i)
+		printf("%x\n", p[i]);
+	printf("%x\n", b[0x200]);
+	printf("%x\n", p[0x100]);
+
+	munmap((void *)p, LEN);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Prints opens, mmaps, mremaps, memory accesses and access counters of a
+ * binary trace, one line per record. Unlike mmt-replay it does not expand
+ * records standing for many accesses, so it shows how a trace was encoded:
+ * repeated reads are printed as "repeated N times" and ranges of writes
+ * with their count, stride and first and last value. Only the last
+ * component of opened paths is printed.
+ *
+ * Usage: records trace
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mmt_reader.h"
+
+static unsigned int get4(const unsigned char *p)
+{
+	unsigned int v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned long long get8(const unsigned char *p)
+{
+	unsigned long long v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void print_value(const unsigned char *data, unsigned int len)
+{
+	unsigned int i;
+
+	printf("0x");
+	for (i = len; i > 0; --i)
+		printf("%02x", data[i - 1]);
+}
+
+static void print_access(const unsigned char *p, const struct mmt_access *a,
+		unsigned long long cnt)
+{
+	if ((p[0] & MMT_V2_ACCESS) && (p[0] & MMT_V2_REPEAT))
+	{
+		printf("repeated %llu times\n", cnt);
+		return;
+	}
+
+	printf("%c %u:0x%04llx", a->write ? 'w' : 'r', a->region, a->offset);
+	if (a->range)
+	{
+		printf(" x%llu stride %lld, ", cnt, a->stride);
+		print_value(a->data, a->len);
+		printf(" ... ");
+		print_value(a->data + (cnt - 1) * a->len, a->len);
+	}
+	else
+	{
+		printf(", ");
+		print_value(a->data, a->len);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[1 << 24];
+	struct mmt_reader_state st;
+	struct mmt_access a;
+	unsigned long long cnt;
+	size_t size, pos = 0;
+	const char *name;
+	long len;
+	FILE *f;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s trace\n", argv[0]);
+		return 2;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f)
+	{
+		perror(argv[1]);
+		return 2;
+	}
+	size = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	mmt_reader_reset(&st);
+	while (pos < size)
+	{
+		const unsigned char *p = buf + pos;
+
+		len = mmt_record_len(p, size - pos);
+		if (len < 0)
+		{
+			fprintf(stderr, "%s: %s at %zu\n", argv[1], mmt_reader_error(len),
+					pos);
+			return 2;
+		}
+
+		cnt = mmt_decode_access(&st, p, len, &a);
+		if (cnt)
+			print_access(p, &a, cnt);
+		else if (p[0] == 'v' || p[0] == 'T')
+			mmt_reader_reset(&st);
+		else if (p[0] == 'o')
+		{
+			name = strrchr((const char *)p + 17, '/');
+			printf("open fd %u %s\n", get4(p + 9),
+					name ? name + 1 : (const char *)p + 17);
+		}
+		else if (p[0] == 'M')
+			printf("mmap region %u fd %d\n", get4(p + 21), (int)get4(p + 17));
+		else if (p[0] == 'e')
+			printf("mremap region %u\n", get4(p + 9));
+		else if (p[0] == 'c')
+			printf("count %u:0x%04x, %llu reads, %llu writes\n", get4(p + 1),
+					get4(p + 5), get8(p + 9), get8(p + 17));
+
+		pos += len;
+	}
+
+	return 0;
+}
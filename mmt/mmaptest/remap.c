@@ -0,0 +1,70 @@
+/*
+ * Accesses a shared mapping of a file, moves it with mremap to twice its
+ * size and accesses it again. Under the count policy the counts taken
+ * before and after the move add up into one set. Prints what it read back.
+ *
+ * Usage: remap file
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define LEN 0x1000
+
+int main(int argc, char **argv)
+{
+	volatile uint32_t *p;
+	uint32_t sum = 0;
+	void *q;
+	int fd, i;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s file\n", argv[0]);
+		exit(1);
+	}
+
+	fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror("open");
+		exit(1);
+	}
+	if (ftruncate(fd, 2 * LEN) < 0)
+	{
+		perror("ftruncate");
+		exit(1);
+	}
+
+	p = mmap(NULL, LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+
+	p[0] = 1;
+	for (i = 0; i < 3; ++i)
+		sum += p[0];
+
+	q = mremap((void *)p, LEN, 2 * LEN, MREMAP_MAYMOVE);
+	if (q == MAP_FAILED)
+	{
+		perror("mremap");
+		exit(1);
+	}
+	p = q;
+
+	p[0] = 2;
+	p[0x400] = 3;
+	sum += p[0] + p[0x400];
+	printf("%x\n", sum);
+
+	munmap((void *)p, 2 * LEN);
+	close(fd);
+	return 0;
+}
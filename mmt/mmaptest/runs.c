@@ -0,0 +1,94 @@
+/*
+ * Stores to a shared mapping of a file in runs of the kinds folded into
+ * range records with --mmt-trace-format=2: a run longer than a range can
+ * hold, a descending run, runs broken by a change of stride, of size and
+ * by a load, and runs too short to be folded. Loads back the ends of the
+ * runs and prints their sum.
+ *
+ * Usage: runs file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define LEN 0x4000
+
+int main(int argc, char **argv)
+{
+	volatile uint32_t *p;
+	volatile uint8_t *b;
+	uint32_t sum = 0;
+	int fd, i;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s file\n", argv[0]);
+		exit(1);
+	}
+
+	fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror("open");
+		exit(1);
+	}
+	if (ftruncate(fd, LEN) < 0)
+	{
+		perror("ftruncate");
+		exit(1);
+	}
+
+	p = mmap(NULL, LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	b = (volatile uint8_t *)p;
+
+	/* 5 KB, split into two ranges */
+	for (i = 0; i < 0x500; ++i)
+		p[i] = i;
+
+	/* descending */
+	for (i = 7; i >= 0; --i)
+		p[0x600 + i] = 0x600 + i;
+
+	/* stride changes: one range and two single stores */
+	p[0x700] = 1;
+	p[0x701] = 2;
+	p[0x702] = 3;
+	p[0x710] = 4;
+	p[0x720] = 5;
+
+	/* size changes */
+	b[0x2000] = 6;
+	b[0x2001] = 7;
+	b[0x2002] = 8;
+	p[0x801] = 9;
+	p[0x802] = 10;
+	p[0x803] = 11;
+
+	/* broken by a load */
+	p[0x900] = 12;
+	p[0x901] = 13;
+	p[0x902] = 14;
+	sum += p[0x900];
+	p[0x903] = 15;
+	p[0x904] = 16;
+	p[0x905] = 17;
+
+	sum += p[0] + p[0x3ff] + p[0x400] + p[0x4ff];
+	sum += p[0x600] + p[0x607];
+	sum += p[0x702] + p[0x720];
+	sum += b[0x2002] + p[0x803];
+	sum += p[0x905];
+	printf("%x\n", sum);
+
+	munmap((void *)p, LEN);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Reference consumer for --mmt-sync-file.
+ *
+ * Reads binary trace from stdin, acknowledges every sync marker by writing
+ * its id to the file given as argument and copies everything except sync
+ * markers to stdout.
+ *
+ * With -c, the traced region with id 1 is a shared mapping of the given
+ * file from offset 0, which is zero-filled before the traced program
+ * writes to it. Every traced write must be seen before it reaches the
+ * file, so the written bytes must still be zero when its record arrives.
+ * The number of checked records and bytes is printed to stderr.
+ *
+ * Usage: sync_consumer [-c file] reply-file < trace > trace-without-markers
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static unsigned char rec[1 << 24];
+static size_t len;
+
+static void get(size_t n)
+{
+	if (len + n > sizeof(rec))
+	{
+		fprintf(stderr, "record too long\n");
+		exit(2);
+	}
+	if (fread(rec + len, 1, n, stdin) != n)
+	{
+		fprintf(stderr, "truncated trace\n");
+		exit(2);
+	}
+	len += n;
+}
+
+static uint32_t get4(void)
+{
+	uint32_t v;
+	get(4);
+	memcpy(&v, rec + len - 4, 4);
+	return v;
+}
+
+static void get_buffer(void)
+{
+	get(get4());
+}
+
+static uint64_t get_varint(void)
+{
+	uint64_t v = 0;
+	int shift = 0;
+
+	do
+	{
+		get(1);
+		v |= (uint64_t)(rec[len - 1] & 0x7f) << shift;
+		shift += 7;
+	}
+	while (rec[len - 1] & 0x80);
+
+	return v;
+}
+
+static const char *check_path;
+static const unsigned char *check_map;
+static size_t check_len;
+static unsigned long checked_writes, checked_bytes;
+
+/* region 1 write of len bytes at offset must not have reached the file */
+static int check_write(uint32_t region, uint32_t offset, uint32_t len)
+{
+	uint32_t i;
+
+	if (!check_path || region != 1)
+		return 0;
+
+	if (!check_map)
+	{
+		struct stat st;
+		int fd = open(check_path, O_RDONLY);
+
+		if (fd < 0 || fstat(fd, &st) < 0)
+		{
+			perror(check_path);
+			return 1;
+		}
+		check_len = st.st_size;
+		check_map = mmap(NULL, check_len, PROT_READ, MAP_SHARED, fd, 0);
+		if (check_map == MAP_FAILED)
+		{
+			perror("mmap");
+			return 1;
+		}
+		close(fd);
+	}
+
+	if ((size_t)offset + len > check_len)
+	{
+		fprintf(stderr, "write at 0x%x outside of %s\n", offset, check_path);
+		return 1;
+	}
+	for (i = 0; i < len; ++i)
+		if (check_map[offset + i])
+		{
+			fprintf(stderr, "write at 0x%x reached %s before it was traced\n",
+					offset, check_path);
+			return 1;
+		}
+
+	checked_writes++;
+	checked_bytes += len;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c, reply_fd;
+
+	if (argc == 4 && strcmp(argv[1], "-c") == 0)
+	{
+		check_path = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s [-c file] reply-file\n", argv[0]);
+		return 1;
+	}
+
+	/* tracer opens its end after the log file (our stdin) */
+	reply_fd = open(argv[1], O_WRONLY);
+	if (reply_fd < 0)
+	{
+		perror("open");
+		return 1;
+	}
+
+	while ((c = getchar()) != EOF)
+	{
+		len = 0;
+		rec[len++] = c;
+
+		/* compact access record (--mmt-trace-format=2) */
+		if (c & 0x80)
+		{
+			if (c & 0x02)
+				get_varint();
+			else
+			{
+				size_t size = 1 << ((c >> 3) & 7);
+				if (((c >> 3) & 7) == 7)
+					size = get_varint();
+				if (c & 0x04)
+					get_varint();
+				get_varint();
+				get(size);
+			}
+			fwrite(rec, 1, len, stdout);
+			continue;
+		}
+
+		switch (c)
+		{
+			case '=':
+			case '-':
+				do
+					get(1);
+				while (rec[len - 1] != 10);
+				fwrite(rec, 1, len, stdout);
+				continue;
+			case 'r': case 'w':
+				get(8);
+				get(1);
+				get(rec[len - 1]);
+				if (c == 'w')
+				{
+					uint32_t region, offset;
+
+					memcpy(&region, rec + 1, 4);
+					memcpy(&offset, rec + 5, 4);
+					if (check_write(region, offset, rec[9]))
+						return 2;
+				}
+				break;
+			case 'R': case 'W':
+				get(8);
+				get(1);
+				get(rec[len - 1]);
+				break;
+			case 'M': get(8 + 4 + 4 + 4 + 4 + 8 + 8); break;
+			case 'u': get(8 + 4 + 8 + 8 + 8 + 8); break;
+			case 'e': get(8 + 4 + 8 * 6); break;
+			case 'd': get(4 + 4); break;
+			case 'o': get(4 + 4 + 4); get_buffer(); break;
+			case 'i': get(4 + 4); get_buffer(); break;
+			case 'j': get(4 + 4 + 8 + 8); get_buffer(); break;
+			case 'y': get(8); get_buffer(); break;
+			case 't': get(4); get_buffer(); break;
+			case 's': case 'x': get_buffer(); break;
+			case 'n': get(1); get_buffer(); break;
+			case 'S': get(4); break;
+			case 'c': get(4 + 4 + 8 + 8); break;
+			case 'v': get(4); break;
+			default:
+				fprintf(stderr, "unknown record type 0x%x\n", c);
+				return 2;
+		}
+
+		get(1);
+		if (rec[len - 1] != 10)
+		{
+			fprintf(stderr, "corrupted record of type '%c'\n", rec[0]);
+			return 2;
+		}
+
+		if (rec[0] != 'S')
+		{
+			fwrite(rec, 1, len, stdout);
+			continue;
+		}
+
+		fflush(stdout);
+		if (write(reply_fd, rec + 1, 4) != 4)
+		{
+			perror("write");
+			return 1;
+		}
+	}
+
+	if (check_path)
+		fprintf(stderr, "checked %lu writes, %lu bytes\n", checked_writes,
+				checked_bytes);
+	return 0;
+}
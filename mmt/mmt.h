@@ -0,0 +1,108 @@
+/*
+   ----------------------------------------------------------------
+
+   Notice that the following BSD-style license applies to this one
+   file (mmt.h) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+
+   ----------------------------------------------------------------
+
+   This file is part of mmt, a valgrind tool for tracing accesses to
+   memory mapped from devices.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+   2. The origin of this software must not be misrepresented; you must
+      not claim that you wrote the original software.  If you use this
+      software in a product, an acknowledgment in the product
+      documentation would be appreciated but is not required.
+
+   3. Altered source versions must be plainly marked as such, and must
+      not be misrepresented as being the original software.
+
+   4. The name of the author may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+   OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+   ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   ----------------------------------------------------------------
+
+   Notice that the above BSD-style license applies to this one file
+   (mmt.h) only.  The entire rest of Valgrind is licensed under
+   the terms of the GNU General Public License, version 2.  See the
+   COPYING file in the source distribution for details.
+
+   ----------------------------------------------------------------
+*/
+
+#ifndef __MMT_H
+#define __MMT_H
+
+#include "valgrind.h"
+
+/* !! ABIWARNING !! ABIWARNING !! ABIWARNING !! ABIWARNING !!
+   This enum comprises an ABI exported by Valgrind to programs
+   which use client requests.  DO NOT CHANGE THE ORDER OF THESE
+   ENTRIES, NOR DELETE ANY -- add new ones at the end.
+ */
+
+typedef
+   enum {
+      VG_USERREQ__MMT_SET_POLICY = VG_USERREQ_TOOL_BASE('M','T'),
+      VG_USERREQ__MMT_SET_FD_POLICY,
+      VG_USERREQ__MMT_TRACE_RANGE
+   } Vg_MmtClientRequest;
+
+/* What is recorded for accesses to a traced region. */
+typedef
+   enum {
+      MMT_POLICY_TRACE,   /* every access, with its value (default) */
+      MMT_POLICY_COUNT,   /* only number of accesses to each offset,
+                             written out when region is unmapped */
+      MMT_POLICY_IGNORE   /* nothing */
+   } Vg_MmtPolicy;
+
+/* Sets policy of the traced region containing addr.
+   Returns 0 on success, -1 if addr is not in a traced region or the
+   program does not run under mmt. */
+#define MMT_SET_POLICY(addr, policy)                                 \
+   (int)VALGRIND_DO_CLIENT_REQUEST_EXPR(-1,                          \
+                                        VG_USERREQ__MMT_SET_POLICY,  \
+                                        (addr), (policy), 0, 0, 0)
+
+/* Sets policy of all traced regions mapped from fd, including the ones
+   mapped later.  Returns 0 on success, -1 if the program does not run
+   under mmt. */
+#define MMT_SET_FD_POLICY(fd, policy)                                   \
+   (int)VALGRIND_DO_CLIENT_REQUEST_EXPR(-1,                             \
+                                        VG_USERREQ__MMT_SET_FD_POLICY,  \
+                                        (fd), (policy), 0, 0, 0)
+
+/* Limits tracing of the traced region containing addr to accesses
+   touching [addr, addr + len) and other ranges added this way or with
+   --mmt-trace-range.  Returns 0 on success, -1 if addr is not in a traced
+   region or the program does not run under mmt. */
+#define MMT_TRACE_RANGE(addr, len)                                   \
+   (int)VALGRIND_DO_CLIENT_REQUEST_EXPR(-1,                          \
+                                        VG_USERREQ__MMT_TRACE_RANGE, \
+                                        (addr), (len), 0, 0, 0)
+
+#endif /* __MMT_H */
@@ -0,0 +1,140 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Deduplication of memory dumps (--mmt-dedup-dumps).
+ *
+ * Drivers pass the same blocks of state to ioctls over and over. With this
+ * option contents of dumps are interned in a dedup pool and every distinct
+ * content is written only once, as a blob:
+ *
+ *   'b' id(4) len(4) data '\n'
+ *
+ * and dumps refer to it instead of carrying the data:
+ *
+ *   'Y' addr(8) id(4) '\n'
+ *
+ * Blob ids start at 1 and only grow. When the pool reaches its size limit
+ * it is thrown away and known contents get new ids (and are written again)
+ * when they show up next time. Short dumps, for which a reference would not
+ * save much, are written as usual 'y' records.
+ */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_deduppoolalloc.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+
+#include "mmt_blob.h"
+#include "mmt_trace_bin.h"
+
+#define MIN_BLOB_SIZE 32
+#define MAX_POOL_SIZE (64 << 20)
+
+struct blob
+{
+	/* VgHashNode, keyed by address of the interned copy */
+	struct blob *next;
+	UWord elt;
+
+	UInt id;
+};
+
+int mmt_dedup_dumps = False;
+
+static DedupPoolAlloc *pool;
+static VgHashTable *blobs;
+static SizeT pool_size;
+static UInt next_id = 1;
+
+static void free_pool(void)
+{
+	if (!pool)
+		return;
+
+	VG_(HT_destruct)(blobs, VG_(free));
+	VG_(deleteDedupPA)(pool);
+	pool = NULL;
+	blobs = NULL;
+}
+
+static void reset_pool(void)
+{
+	free_pool();
+
+	pool = VG_(newDedupPA)(1 << 20, 8, VG_(malloc), "mmt.blob.pool", VG_(free));
+	blobs = VG_(HT_construct)("mmt.blob.ids");
+	pool_size = 0;
+}
+
+/* returns id of blob with given contents, writing it out if it is new */
+static UInt intern(const UChar *data, UInt len)
+{
+	const void *elt;
+	struct blob *b;
+
+	if (!pool || pool_size + len > MAX_POOL_SIZE)
+		reset_pool();
+
+	elt = VG_(allocEltDedupPA)(pool, len, data);
+	b = VG_(HT_lookup)(blobs, (UWord)elt);
+	if (b)
+		return b->id;
+
+	b = VG_(malloc)("mmt.blob", sizeof(*b));
+	b->elt = (UWord)elt;
+	b->id = next_id++;
+	VG_(HT_add_node)(blobs, b);
+	pool_size += len;
+
+	mmt_bin_write_1('b');
+	mmt_bin_write_4(b->id);
+	mmt_bin_write_buffer(data, len);
+	mmt_bin_end();
+
+	return b->id;
+}
+
+/* blobs written by the parent are not in the child's trace, so the child
+ * starts with an empty pool and ids from 1 */
+void mmt_blob_atfork_child(void)
+{
+	free_pool();
+	pool_size = 0;
+	next_id = 1;
+}
+
+void mmt_dump_memory(Addr addr, const UChar *data, UInt len)
+{
+	if (mmt_dedup_dumps && len >= MIN_BLOB_SIZE)
+	{
+		UInt id = intern(data, len);
+
+		mmt_bin_write_1('Y');
+		mmt_bin_write_8(addr);
+		mmt_bin_write_4(id);
+		mmt_bin_end();
+		return;
+	}
+
+	mmt_bin_write_1('y');
+	mmt_bin_write_8(addr);
+	mmt_bin_write_buffer(data, len);
+	mmt_bin_end();
+}
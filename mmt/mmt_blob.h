@@ -0,0 +1,13 @@
+#ifndef MMT_BLOB_H_
+#define MMT_BLOB_H_
+
+#include "pub_tool_basics.h"
+
+extern int mmt_dedup_dumps;
+
+/* dumps of memory pointed to by ioctl arguments ('y' records) */
+void mmt_dump_memory(Addr addr, const UChar *data, UInt len);
+
+void mmt_blob_atfork_child(void);
+
+#endif /* MMT_BLOB_H_ */
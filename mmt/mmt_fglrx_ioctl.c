@@ -24,15 +24,18 @@
 #include <inttypes.h>
 
 #include "pub_tool_libcassert.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_oset.h"
+#include "pub_tool_vki.h"
 #include "pub_tool_vkiscnums.h"
 #include "coregrind/pub_core_syscall.h"
 #include "coregrind/pub_core_aspacemgr.h"
 
 #include "fglrx_ioctl.h"
+#include "mmt_blob.h"
 #include "mmt_fglrx_ioctl.h"
 #include "mmt_trace_bin.h"
 
-static const int dump_maps = 0;
 static const int fuzzer_enabled = 0;
 
 int mmt_trace_fglrx_ioctls;
@@ -44,10 +47,7 @@ static noinline void dumpmem(Addr addr, UInt size)
 	if (!addr)
 		return;
 
-	mmt_bin_write_1('y');
-	mmt_bin_write_8(addr);
-	mmt_bin_write_buffer((const UChar *)addr, size);
-	mmt_bin_end();
+	mmt_dump_memory(addr, (const UChar *)addr, size);
 }
 
 static void *test_page = NULL;
@@ -189,156 +189,197 @@ static void dump_ioctl_data(UInt id, void *data)
 	}
 }
 
-static void *read_process_maps(int *len)
+/*
+ * fglrx maps memory of /dev/ati/card0 from within ioctls, without any mmap
+ * syscall, so neither mmt nor Valgrind's address space manager sees it.
+ * After every fglrx ioctl /proc/self/maps is scanned once, line by line,
+ * and compared with the set of card0 mappings found so far. Only the
+ * differences are traced (as mmap and munmap) and reported to the address
+ * space manager, so Valgrind does not put anything on top of them.
+ */
+
+struct ati_card0_map
 {
-#define MAX_MAPS_LEN (1<<16)
-	static char data[MAX_MAPS_LEN];
-	int fd = VG_(fd_open)("/proc/self/maps", VKI_O_RDONLY, 0);
-	if (fd == -1)
-	{
-		*len = 0;
-		return NULL;
-	}
+	Addr start; /* OSet key */
+	Addr end;
+	Off64T offset;
+	int prot;
+	int flags;
+	struct mmt_mmap_data *region;
 
-	int curlen = 0;
-	int r;
-	do
-	{
-		r = VG_(read)(fd, data + curlen, MAX_MAPS_LEN - 1 - curlen);
-		if (r > 0)
-			curlen += r;
-	}
-	while (r != 0);
+	/* scan which found it last time */
+	UInt scan;
+};
 
-	VG_(close)(fd);
+static OSet *ati_card0_maps;
+static UInt maps_scan;
 
-	data[curlen] = 0;
+static Bool parse_maps_line(HChar *line, struct ati_card0_map *m)
+{
+	HChar *end;
 
-	*len = curlen;
-	return data;
+	if (!VG_(strstr)(line, "/dev/ati/card0"))
+		return False;
+
+	m->start = VG_(strtoull16)(line, &end);
+	line = end + 1; // "-"
+	m->end = VG_(strtoull16)(line, &end);
+	line = end + 1; // " "
+
+	m->prot = PROT_NONE;
+	if (*line++ == 'r')
+		m->prot |= PROT_READ;
+	if (*line++ == 'w')
+		m->prot |= PROT_WRITE;
+	if (*line++ == 'x')
+		m->prot |= PROT_EXEC;
+
+	m->flags = 0;
+	if (*line == 's')
+		m->flags |= MAP_SHARED;
+	else if (*line == 'p')
+		m->flags |= MAP_PRIVATE;
+	line++;
+
+	line++; // " "
+	m->offset = VG_(strtoull16)(line, &end);
+
+	return True;
 }
 
-static void dump_process_maps(void)
+static void unmap_card0(struct ati_card0_map *m)
 {
-	int len;
-	const char *data = read_process_maps(&len);
-	if (len == 0)
+	NSegment const *seg;
+
+	/* the client may have unmapped it by itself, and mapped something
+	 * else there since, which aspacemgr must keep track of */
+	if (find_mmap(m->start) != m->region)
 		return;
 
-	mmt_bin_write_1('y');
-	mmt_bin_write_8(1);
-	mmt_bin_write_buffer((const UChar *)data, len);
-	mmt_bin_end();
+	mmt_unmap_region(m->region);
+
+	seg = VG_(am_find_nsegment)(m->start);
+	if (seg && seg->kind == SkFileC && seg->offset == m->offset)
+		VG_(am_notify_munmap)(m->start, m->end - m->start);
 }
 
-struct ati_card0_map
+static void map_card0(int fd, struct ati_card0_map *m)
 {
-	Addr start;
-	Addr end;
-	Off64T offset;
-	int prot;
-	int flags;
-	struct mmt_mmap_data *region;
-};
+	/* nobody executes device memory, there are no translations to discard */
+	VG_(am_notify_client_mmap)(m->start, m->end - m->start, m->prot,
+			m->flags | MAP_FIXED, fd, m->offset);
 
-#define MAX_MAPS 1000
-static int ati_card0_map_len;
-static struct ati_card0_map ati_card0_maps[MAX_MAPS];
+	m->region = mmt_map_region(fd, m->start, m->end, m->offset, m->prot,
+			m->flags);
+}
 
-static void update_maps(int fd)
+static void found_card0(int fd, const struct ati_card0_map *cur)
 {
-	int i, j, len;
-	char *data = read_process_maps(&len);
-	if (len == 0)
-		return;
-
-	int num = 0;
-	static struct ati_card0_map maps[MAX_MAPS];
+	struct ati_card0_map *m = VG_(OSetGen_Lookup)(ati_card0_maps, &cur->start);
 
-	HChar *line = VG_(strtok)(data, "\n");
-	HChar *end;
+	if (m && m->end == cur->end && m->offset == cur->offset &&
+			m->prot == cur->prot && m->flags == cur->flags)
+	{
+		m->scan = maps_scan;
+		return;
+	}
 
-	while (line && num < MAX_MAPS)
+	if (m)
+		unmap_card0(m);
+	else
 	{
-		if (VG_(strstr)(line, "/dev/ati/card0"))
-		{
-			maps[num].start = VG_(strtoull16)(line, &end);
-			line = end + 1; // "-"
-			maps[num].end = VG_(strtoull16)(line, &end);
-			line = end + 1; // " "
-			int prot = PROT_NONE;
-			int flags = 0;
-			if (*line++ == 'r')
-				prot |= PROT_READ;
-			if (*line++ == 'w')
-				prot |= PROT_WRITE;
-			if (*line++ == 'x')
-				prot |= PROT_EXEC;
-			maps[num].prot = prot;
-
-			if (*line == 's')
-				flags |= MAP_SHARED;
-			else if (*line == 'p')
-				flags |= MAP_PRIVATE;
-			line++;
-			maps[num].flags = flags;
-
-			line++; // " "
-			maps[num].offset = VG_(strtoull16)(line, &end);
-
-			num++;
-		}
-		tl_assert(num <= MAX_MAPS);
+		/* mapped by mmap syscall, already traced */
+		if (find_mmap(cur->start))
+			return;
 
-		line = VG_(strtok)(NULL, "\n");
+		m = VG_(OSetGen_AllocNode)(ati_card0_maps, sizeof(*m));
+		m->start = cur->start;
+		VG_(OSetGen_Insert)(ati_card0_maps, m);
 	}
 
-	for (i = 0; i < ati_card0_map_len; ++i)
-	{
-		int found = 0;
-		for (j = 0; j < num && !found; ++j)
-			found = ati_card0_maps[i].start == maps[j].start &&
-					ati_card0_maps[i].end == maps[j].end &&
-					ati_card0_maps[i].offset == maps[j].offset &&
-					ati_card0_maps[i].prot == maps[j].prot &&
-					ati_card0_maps[i].flags == maps[j].flags;
-
-		if (!found)
-		{
-			mmt_bin_flush();
-			VG_(message)(Vg_UserMsg, "ioctl munmap\n");
+	m->end = cur->end;
+	m->offset = cur->offset;
+	m->prot = cur->prot;
+	m->flags = cur->flags;
+	m->scan = maps_scan;
+	map_card0(fd, m);
+}
 
-			mmt_unmap_region(ati_card0_maps[i].region);
+static void remove_stale_maps(void)
+{
+	struct ati_card0_map *m;
+	Addr *stale;
+	UWord n = 0, i;
 
-			VG_(memmove)(&ati_card0_maps[i], &ati_card0_maps[i + 1],
-					sizeof(ati_card0_maps[i]) * (ati_card0_map_len - i - 1));
-			ati_card0_map_len--;
-			i--;
-		}
+	stale = VG_(malloc)("mmt.fglrx.stale",
+			(VG_(OSetGen_Size)(ati_card0_maps) + 1) * sizeof(stale[0]));
+
+	VG_(OSetGen_ResetIter)(ati_card0_maps);
+	while ((m = VG_(OSetGen_Next)(ati_card0_maps)) != NULL)
+		if (m->scan != maps_scan)
+			stale[n++] = m->start;
+
+	for (i = 0; i < n; ++i)
+	{
+		m = VG_(OSetGen_Remove)(ati_card0_maps, &stale[i]);
+		unmap_card0(m);
+		VG_(OSetGen_FreeNode)(ati_card0_maps, m);
 	}
 
-	for (j = 0; j < num; ++j)
+	VG_(free)(stale);
+}
+
+static void update_maps(int fd)
+{
+	static HChar buf[2 * VKI_PATH_MAX];
+	struct ati_card0_map cur;
+	HChar *line, *nl;
+	Int len = 0, r;
+	Bool skip = False;
+
+	if (!ati_card0_maps)
+		ati_card0_maps = VG_(OSetGen_Create)(offsetof(struct ati_card0_map, start),
+				NULL, VG_(malloc), "mmt.fglrx.maps", VG_(free));
+
+	int mfd = VG_(fd_open)("/proc/self/maps", VKI_O_RDONLY, 0);
+	if (mfd == -1)
+		return;
+
+	maps_scan++;
+
+	do
 	{
-		int found = find_mmap(maps[j].start) != NULL;
-		for (i = 0; i < ati_card0_map_len && !found; ++i)
-			found = ati_card0_maps[i].start == maps[j].start &&
-					ati_card0_maps[i].end == maps[j].end &&
-					ati_card0_maps[i].offset == maps[j].offset &&
-					ati_card0_maps[i].prot == maps[j].prot &&
-					ati_card0_maps[i].flags == maps[j].flags;
-
-		if (!found)
-		{
-			mmt_bin_flush();
-			VG_(message)(Vg_UserMsg, "ioctl mmap\n");
+		r = VG_(read)(mfd, buf + len, sizeof(buf) - 1 - len);
+		if (r > 0)
+			len += r;
+		buf[len] = 0;
 
-			ati_card0_maps[ati_card0_map_len] = maps[j];
-			ati_card0_maps[ati_card0_map_len].region = mmt_map_region(fd,
-					maps[j].start, maps[j].end, maps[j].offset, maps[j].prot,
-					maps[j].flags);
-			ati_card0_map_len++;
+		line = buf;
+		while (line < buf + len)
+		{
+			nl = VG_(strchr)(line, '\n');
+			/* wait for the rest of the line, unless it does not fit */
+			if (!nl && r > 0 && (line > buf || len < (Int)sizeof(buf) - 1))
+				break;
+
+			if (nl)
+				*nl = 0;
+			if (!skip && parse_maps_line(line, &cur))
+				found_card0(fd, &cur);
+			/* continuation of a line longer than the buffer */
+			skip = !nl && r > 0;
+
+			line = nl ? nl + 1 : buf + len;
 		}
+
+		len -= line - buf;
+		VG_(memmove)(buf, line, len);
 	}
+	while (r > 0);
+
+	VG_(close)(mfd);
+
+	remove_stale_maps();
 }
 
 int mmt_fglrx_ioctl_pre(UWord *args)
@@ -362,9 +403,6 @@ int mmt_fglrx_ioctl_pre(UWord *args)
 	mmt_bin_write_buffer((const UChar *)data, size);
 	mmt_bin_end();
 
-	if (dump_maps)
-		dump_process_maps();
-
 #define FFIELD ptr1
 #define FIOCTL FGLRX_IOCTL_4F
 #define FSTRUCT struct fglrx_ioctl_4f
@@ -454,9 +492,6 @@ int mmt_fglrx_ioctl_post(UWord *args, SysRes res)
 	mmt_bin_write_buffer((const UChar *)data, size);
 	mmt_bin_end();
 
-	if (dump_maps)
-		dump_process_maps();
-
 	dump_ioctl_data(id, data);
 
 	mmt_bin_sync();
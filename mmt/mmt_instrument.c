@@ -22,22 +22,83 @@
 */
 
 #include "mmt_instrument.h"
+#include "mmt_profile.h"
 #include "mmt_trace.h"
 #include "mmt_trace_bin.h"
 
 #include "pub_tool_machine.h"
 #include "pub_tool_libcprint.h"
 #include "pub_tool_libcassert.h"
+#include "pub_tool_mallocfree.h"
 
 int dump_load = True, dump_store = True;
+int mmt_coalesce_stores = False;
+
+#ifdef MMT_PRINT_FILENAMES
+#define want_inst_addr() True
+#else
+/* profile attributes accesses to instructions */
+#define want_inst_addr() mmt_profile
+#endif
+
+/* condition for helper calls of currently instrumented access (or NULL) */
+static IRExpr *call_guard;
 
 static void addCall(IRSB *bb, const char *name, void *fun, IRExpr **argv)
 {
 	IRDirty *di = unsafeIRDirty_0_N(2, name, VG_(fnptr_to_fnentry)(fun), argv);
 
+	if (call_guard)
+		di->guard = call_guard;
+
 	addStmtToIRSB(bb, IRStmt_Dirty(di));
 }
 
+/*
+ * Emits inline check whether addr may belong to a traced region,
+ * i.e. mmt_granule_map[(addr >> MMT_GRANULE_SHIFT) % MMT_GRANULE_MAP_SIZE] != 0.
+ */
+static IRExpr *add_region_filter(IRSB *bb, IRExpr *addr, IRType ty)
+{
+	IRTemp sh = newIRTemp(bb->tyenv, ty);
+	IRTemp idx = newIRTemp(bb->tyenv, ty);
+	IRTemp ptr = newIRTemp(bb->tyenv, ty);
+	IRTemp cnt = newIRTemp(bb->tyenv, Ity_I32);
+	IRTemp guard = newIRTemp(bb->tyenv, Ity_I1);
+	HWord mask = (MMT_GRANULE_MAP_SIZE - 1) * sizeof(mmt_granule_map[0]);
+	Int shift = MMT_GRANULE_SHIFT - 2;
+
+	tl_assert(sizeof(mmt_granule_map[0]) == 4);
+
+	if (ty == Ity_I64)
+	{
+		addStmtToIRSB(bb, IRStmt_WrTmp(sh, IRExpr_Binop(Iop_Shr64,
+				addr, IRExpr_Const(IRConst_U8(shift)))));
+		addStmtToIRSB(bb, IRStmt_WrTmp(idx, IRExpr_Binop(Iop_And64,
+				IRExpr_RdTmp(sh), IRExpr_Const(IRConst_U64(mask)))));
+		addStmtToIRSB(bb, IRStmt_WrTmp(ptr, IRExpr_Binop(Iop_Add64,
+				IRExpr_RdTmp(idx),
+				IRExpr_Const(IRConst_U64((HWord)mmt_granule_map)))));
+	}
+	else
+	{
+		addStmtToIRSB(bb, IRStmt_WrTmp(sh, IRExpr_Binop(Iop_Shr32,
+				addr, IRExpr_Const(IRConst_U8(shift)))));
+		addStmtToIRSB(bb, IRStmt_WrTmp(idx, IRExpr_Binop(Iop_And32,
+				IRExpr_RdTmp(sh), IRExpr_Const(IRConst_U32(mask)))));
+		addStmtToIRSB(bb, IRStmt_WrTmp(ptr, IRExpr_Binop(Iop_Add32,
+				IRExpr_RdTmp(idx),
+				IRExpr_Const(IRConst_U32((HWord)mmt_granule_map)))));
+	}
+
+	addStmtToIRSB(bb, IRStmt_WrTmp(cnt,
+			IRExpr_Load(Iend_LE, Ity_I32, IRExpr_RdTmp(ptr))));
+	addStmtToIRSB(bb, IRStmt_WrTmp(guard, IRExpr_Binop(Iop_CmpNE32,
+			IRExpr_RdTmp(cnt), IRExpr_Const(IRConst_U32(0)))));
+
+	return IRExpr_RdTmp(guard);
+}
+
 static maybe_unused void
 __add_trace_load1_ia(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRExpr *val1)
 {
@@ -83,10 +144,6 @@ __add_trace_load2_ia(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRExpr *v
 
 	if (size == 4)
 		addCall(bb, "trace_load_4_4", mmt_trace_load_bin_4_4_ia, argv);
-#ifdef MMT_64BIT
-	else if (size == 8)
-		addCall(bb, "trace_load_8_8", mmt_trace_load_bin_8_8_ia, argv);
-#endif
 	else
 		tl_assert(0);
 }
@@ -98,62 +155,64 @@ __add_trace_load2(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRExpr *val1
 
 	if (size == 4)
 		addCall(bb, "trace_load_4_4", mmt_trace_load_bin_4_4, argv);
-#ifdef MMT_64BIT
-	else if (size == 8)
-		addCall(bb, "trace_load_8_8", mmt_trace_load_bin_8_8, argv);
-#endif
 	else
 		tl_assert(0);
 }
 
-static maybe_unused void
-__add_trace_load4_ia(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRExpr *val1, IRExpr *val2, IRExpr *val3, IRExpr *val4)
+/*
+ * Values wider than a machine word (vectors) are stored to mmt_bulk_data,
+ * the helper gets the whole value from there, with one call.
+ */
+static void add_trace_spilled(IRSB *bb, UChar type, IRExpr *addr, Addr inst_addr,
+		IREndness end, IRExpr *data, IRType ty)
 {
-	IRExpr **argv = mkIRExprVec_6(addr, val1, val2, val3, val4, mkIRExpr_HWord(inst_addr));
+	Int len = sizeofIRType(ty);
+	IRExpr **argv;
+	IRDirty *di;
 
-#ifndef MMT_64BIT
-	if (size == 4)
-		addCall(bb, "trace_load_4_4_4_4", mmt_trace_load_bin_4_4_4_4_ia, argv);
-#else
-	if (size == 8)
-		addCall(bb, "trace_load_8_8_8_8", mmt_trace_load_bin_8_8_8_8_ia, argv);
-#endif
-	else
-		tl_assert(0);
-}
+	tl_assert(len <= MMT_BULK_MAX);
 
-static maybe_unused void
-__add_trace_load4(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRExpr *val1, IRExpr *val2, IRExpr *val3, IRExpr *val4)
-{
-	IRExpr **argv = mkIRExprVec_5(addr, val1, val2, val3, val4);
+	addStmtToIRSB(bb, IRStmt_Store(end, mkIRExpr_HWord((HWord)mmt_bulk_data), data));
 
-#ifndef MMT_64BIT
-	if (size == 4)
-		addCall(bb, "trace_load_4_4_4_4", mmt_trace_load_bin_4_4_4_4, argv);
-#else
-	if (size == 8)
-		addCall(bb, "trace_load_8_8_8_8", mmt_trace_load_bin_8_8_8_8, argv);
-#endif
+	if (want_inst_addr())
+	{
+		argv = mkIRExprVec_3(addr, mkIRExpr_HWord(len), mkIRExpr_HWord(inst_addr));
+		if (type == 'w')
+			di = unsafeIRDirty_0_N(2, "trace_store_bulk",
+					VG_(fnptr_to_fnentry)(mmt_trace_store_bin_bulk_ia), argv);
+		else
+			di = unsafeIRDirty_0_N(2, "trace_load_bulk",
+					VG_(fnptr_to_fnentry)(mmt_trace_load_bin_bulk_ia), argv);
+	}
 	else
-		tl_assert(0);
+	{
+		argv = mkIRExprVec_2(addr, mkIRExpr_HWord(len));
+		if (type == 'w')
+			di = unsafeIRDirty_0_N(2, "trace_store_bulk",
+					VG_(fnptr_to_fnentry)(mmt_trace_store_bin_bulk), argv);
+		else
+			di = unsafeIRDirty_0_N(2, "trace_load_bulk",
+					VG_(fnptr_to_fnentry)(mmt_trace_load_bin_bulk), argv);
+	}
+
+	di->mFx = Ifx_Read;
+	di->mAddr = mkIRExpr_HWord((HWord)mmt_bulk_data);
+	di->mSize = len;
+	if (call_guard)
+		di->guard = call_guard;
+
+	addStmtToIRSB(bb, IRStmt_Dirty(di));
 }
 
-#ifdef MMT_PRINT_FILENAMES
-#define add_trace_load1 __add_trace_load1_ia
-#define add_trace_load2 __add_trace_load2_ia
-#define add_trace_load4 __add_trace_load4_ia
-#else
-#define add_trace_load1 __add_trace_load1
-#define add_trace_load2 __add_trace_load2
-#define add_trace_load4 __add_trace_load4
-#endif
+#define add_trace_load1 (want_inst_addr() ? __add_trace_load1_ia : __add_trace_load1)
+#define add_trace_load2 (want_inst_addr() ? __add_trace_load2_ia : __add_trace_load2)
 
 #ifdef MMT_64BIT
-static void add_trace_load(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRExpr *data, IRType arg_ty)
+static void add_trace_load(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr,
+		IREndness end, IRExpr *data, IRType arg_ty)
 {
 	IRTemp t;
 	IRStmt *cast;
-	IRExpr *data1, *data2, *data3, *data4;
 
 	switch (arg_ty)
 	{
@@ -208,62 +267,19 @@ static void add_trace_load(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRE
 			add_trace_load1(bb, addr, size, inst_addr, data);
 			break;
 
-		case Ity_V128:
-			// upper 64
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128HIto64, data));
-			addStmtToIRSB(bb, cast);
-			data1 = IRExpr_RdTmp(t);
-
-			// lower 64
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128to64, data));
-			addStmtToIRSB(bb, cast);
-			data2 = IRExpr_RdTmp(t);
-
-			add_trace_load2(bb, addr, sizeofIRType(Ity_I64), inst_addr, data1, data2);
-			break;
-
-		case Ity_V256:
-			// 192
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_3, data));
-			addStmtToIRSB(bb, cast);
-			data1 = IRExpr_RdTmp(t);
-
-			// 128
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_2, data));
-			addStmtToIRSB(bb, cast);
-			data2 = IRExpr_RdTmp(t);
-
-			// 64
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_1, data));
-			addStmtToIRSB(bb, cast);
-			data3 = IRExpr_RdTmp(t);
-
-			// 0
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_0, data));
-			addStmtToIRSB(bb, cast);
-			data4 = IRExpr_RdTmp(t);
-
-			add_trace_load4(bb, addr, sizeofIRType(Ity_I64), inst_addr, data1, data2, data3, data4);
-			break;
 		default:
-			VG_(message) (Vg_UserMsg, "Warning! we missed a read of 0x%08x\n", (UInt) arg_ty);
+			/* V128, V256 and other types wider than a machine word */
+			add_trace_spilled(bb, 'r', addr, inst_addr, end, data, arg_ty);
 			break;
 	}
 }
 #else
-static void add_trace_load(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRExpr *data, IRType arg_ty)
+static void add_trace_load(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr,
+		IREndness end, IRExpr *data, IRType arg_ty)
 {
 	IRTemp t;
 	IRStmt *cast;
-	IRExpr *data0;
 	IRExpr *data1, *data2;
-	IRExpr *data3, *data4;
 
 	switch (arg_ty)
 	{
@@ -325,47 +341,9 @@ static void add_trace_load(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr, IRE
 
 			add_trace_load2(bb, addr, sizeofIRType(Ity_I32), inst_addr, data1, data2);
 			break;
-		case Ity_V128:
-			// upper 64
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128HIto64, data));
-			addStmtToIRSB(bb, cast);
-			data0 = IRExpr_RdTmp(t);
-
-			// upper 32 of upper 64
-			t = newIRTemp(bb->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64HIto32, data0));
-			addStmtToIRSB(bb, cast);
-			data1 = IRExpr_RdTmp(t);
-
-			// lower 32 of upper 64
-			t = newIRTemp(bb->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64to32, data0));
-			addStmtToIRSB(bb, cast);
-			data2 = IRExpr_RdTmp(t);
-
-			// lower 64
-			t = newIRTemp(bb->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128to64, data));
-			addStmtToIRSB(bb, cast);
-			data0 = IRExpr_RdTmp(t);
-
-			// upper 32 of lower 64
-			t = newIRTemp(bb->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64HIto32, data0));
-			addStmtToIRSB(bb, cast);
-			data3 = IRExpr_RdTmp(t);
-
-			// lower 32 of lower 64
-			t = newIRTemp(bb->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64to32, data0));
-			addStmtToIRSB(bb, cast);
-			data4 = IRExpr_RdTmp(t);
-
-			add_trace_load4(bb, addr, sizeofIRType(Ity_I32), inst_addr, data1, data2, data3, data4);
-			break;
 		default:
-			VG_(message) (Vg_UserMsg, "Warning! we missed a read of 0x%08x\n", (UInt) arg_ty);
+			/* V128, V256 and other types wider than a machine word */
+			add_trace_spilled(bb, 'r', addr, inst_addr, end, data, arg_ty);
 			break;
 	}
 }
@@ -417,10 +395,6 @@ __add_trace_store2_ia(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr,
 
 	if (size == 4)
 		addCall(bb, "trace_store_4_4", mmt_trace_store_bin_4_4_ia, argv);
-#ifdef MMT_64BIT
-	else if (size == 8)
-		addCall(bb, "trace_store_8_8", mmt_trace_store_bin_8_8_ia, argv);
-#endif
 	else
 		tl_assert(0);
 }
@@ -433,64 +407,19 @@ __add_trace_store2(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr,
 
 	if (size == 4)
 		addCall(bb, "trace_store_4_4", mmt_trace_store_bin_4_4, argv);
-#ifdef MMT_64BIT
-	else if (size == 8)
-		addCall(bb, "trace_store_8_8", mmt_trace_store_bin_8_8, argv);
-#endif
 	else
 		tl_assert(0);
 }
 
-static maybe_unused void
-__add_trace_store4_ia(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr,
-		IRExpr *data1, IRExpr *data2, IRExpr *data3, IRExpr *data4)
-{
-	IRExpr **argv = mkIRExprVec_6(addr, data1, data2, data3, data4, mkIRExpr_HWord(inst_addr));
-
-#ifndef MMT_64BIT
-	if (size == 4)
-		addCall(bb, "trace_store_4_4_4_4", mmt_trace_store_bin_4_4_4_4_ia, argv);
-#else
-	if (size == 8)
-		addCall(bb, "trace_store_8_8_8_8", mmt_trace_store_bin_8_8_8_8_ia, argv);
-#endif
-	else
-		tl_assert(0);
-}
-static maybe_unused void
-__add_trace_store4(IRSB *bb, IRExpr *addr, Int size, Addr inst_addr,
-		IRExpr *data1, IRExpr *data2, IRExpr *data3, IRExpr *data4)
-{
-	IRExpr **argv = mkIRExprVec_5(addr, data1, data2, data3, data4);
-
-#ifndef MMT_64BIT
-	if (size == 4)
-		addCall(bb, "trace_store_4_4_4_4", mmt_trace_store_bin_4_4_4_4, argv);
-#else
-	if (size == 8)
-		addCall(bb, "trace_store_8_8_8_8", mmt_trace_store_bin_8_8_8_8, argv);
-#endif
-	else
-		tl_assert(0);
-}
-
-#ifdef MMT_PRINT_FILENAMES
-#define add_trace_store1 __add_trace_store1_ia
-#define add_trace_store2 __add_trace_store2_ia
-#define add_trace_store4 __add_trace_store4_ia
-#else
-#define add_trace_store1 __add_trace_store1
-#define add_trace_store2 __add_trace_store2
-#define add_trace_store4 __add_trace_store4
-#endif
+#define add_trace_store1 (want_inst_addr() ? __add_trace_store1_ia : __add_trace_store1)
+#define add_trace_store2 (want_inst_addr() ? __add_trace_store2_ia : __add_trace_store2)
 
 #ifdef MMT_64BIT
 static void add_trace_store(IRSB *bbOut, IRExpr *destAddr, Addr inst_addr,
-				IRType arg_ty, IRExpr *data_expr)
+				IREndness end, IRType arg_ty, IRExpr *data_expr)
 {
 	IRTemp t = IRTemp_INVALID;
 	IRStmt *cast = NULL;
-	IRExpr *data_expr1, *data_expr2, *data_expr3, *data_expr4;
 
 	Int size = sizeofIRType(arg_ty);
 
@@ -543,68 +472,19 @@ static void add_trace_store(IRSB *bbOut, IRExpr *destAddr, Addr inst_addr,
 		case Ity_I64:
 			add_trace_store1(bbOut, destAddr, size, inst_addr, data_expr);
 			break;
-		case Ity_V128:
-			// we cannot pass whole 128-bit value in one parameter, so we split it
-
-			// upper 64
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128HIto64, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr1 = IRExpr_RdTmp(t);
-
-			// lower 64
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128to64, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr2 = IRExpr_RdTmp(t);
-
-			add_trace_store2(bbOut, destAddr, sizeofIRType(Ity_I64), inst_addr,
-					data_expr1, data_expr2);
-
-			break;
-
-		case Ity_V256:
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_3, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr1 = IRExpr_RdTmp(t);
-
-			// 128
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_2, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr2 = IRExpr_RdTmp(t);
-
-			// 64
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_1, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr3 = IRExpr_RdTmp(t);
-
-			// 0
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V256to64_0, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr4 = IRExpr_RdTmp(t);
-
-			add_trace_store4(bbOut, destAddr, sizeofIRType(Ity_I64), inst_addr,
-					data_expr1, data_expr2, data_expr3, data_expr4);
-			break;
-
 		default:
-			VG_(message) (Vg_UserMsg, "Warning! we missed a write of 0x%08x\n", (UInt) arg_ty);
+			/* V128, V256 and other types wider than a machine word */
+			add_trace_spilled(bbOut, 'w', destAddr, inst_addr, end, data_expr, arg_ty);
 			break;
 	}
 }
 #else
 static void add_trace_store(IRSB *bbOut, IRExpr *destAddr, Addr inst_addr,
-				IRType arg_ty, IRExpr *data_expr)
+				IREndness end, IRType arg_ty, IRExpr *data_expr)
 {
 	IRTemp t = IRTemp_INVALID;
 	IRStmt *cast = NULL;
-	IRExpr *data_expr0;
 	IRExpr *data_expr1, *data_expr2;
-	IRExpr *data_expr3, *data_expr4;
 
 	Int size = sizeofIRType(arg_ty);
 
@@ -665,53 +545,236 @@ static void add_trace_store(IRSB *bbOut, IRExpr *destAddr, Addr inst_addr,
 
 			add_trace_store2(bbOut, destAddr, sizeofIRType(Ity_I32), inst_addr, data_expr1, data_expr2);
 			break;
-		case Ity_V128:
-			// upper 64
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128HIto64, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr0 = IRExpr_RdTmp(t);
+		default:
+			/* V128, V256 and other types wider than a machine word */
+			add_trace_spilled(bbOut, 'w', destAddr, inst_addr, end, data_expr, arg_ty);
+			break;
+	}
+}
+#endif
 
-			// upper 32 of upper 64
-			t = newIRTemp(bbOut->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64HIto32, data_expr0));
-			addStmtToIRSB(bbOut, cast);
-			data_expr1 = IRExpr_RdTmp(t);
+/*
+ * Stores are coalesced when they write to consecutive addresses computed
+ * from the same temporary (or constant) and nothing observable happens
+ * between them.
+ */
+struct addr_base
+{
+	IRTemp base; /* IRTemp_INVALID for constant addresses */
+	Long off;
+};
 
-			// lower 32 of upper 64
-			t = newIRTemp(bbOut->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64to32, data_expr0));
-			addStmtToIRSB(bbOut, cast);
-			data_expr2 = IRExpr_RdTmp(t);
+static void compute_bases(IRSB *bb, struct addr_base *bases)
+{
+	int i;
 
-			// lower 64
-			t = newIRTemp(bbOut->tyenv, Ity_I64);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_V128to64, data_expr));
-			addStmtToIRSB(bbOut, cast);
-			data_expr0 = IRExpr_RdTmp(t);
+	for (i = 0; i < bb->tyenv->types_used; ++i)
+	{
+		bases[i].base = i;
+		bases[i].off = 0;
+	}
 
-			// upper 32 of lower 64
-			t = newIRTemp(bbOut->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64HIto32, data_expr0));
-			addStmtToIRSB(bbOut, cast);
-			data_expr3 = IRExpr_RdTmp(t);
+	for (i = 0; i < bb->stmts_used; ++i)
+	{
+		IRStmt *st = bb->stmts[i];
+		IRExpr *e;
 
-			// lower 32 of lower 64
-			t = newIRTemp(bbOut->tyenv, Ity_I32);
-			cast = IRStmt_WrTmp(t, IRExpr_Unop(Iop_64to32, data_expr0));
-			addStmtToIRSB(bbOut, cast);
-			data_expr4 = IRExpr_RdTmp(t);
+		if (!st || st->tag != Ist_WrTmp)
+			continue;
+
+		e = st->Ist.WrTmp.data;
+		if (e->tag == Iex_RdTmp)
+			bases[st->Ist.WrTmp.tmp] = bases[e->Iex.RdTmp.tmp];
+		else if (e->tag == Iex_Binop &&
+				(e->Iex.Binop.op == Iop_Add64 || e->Iex.Binop.op == Iop_Sub64 ||
+				 e->Iex.Binop.op == Iop_Add32 || e->Iex.Binop.op == Iop_Sub32) &&
+				e->Iex.Binop.arg1->tag == Iex_RdTmp &&
+				e->Iex.Binop.arg2->tag == Iex_Const)
+		{
+			IRConst *c = e->Iex.Binop.arg2->Iex.Const.con;
+			Long val = c->tag == Ico_U64 ? (Long)c->Ico.U64 : (Long)c->Ico.U32;
 
-			add_trace_store4(bbOut, destAddr, sizeofIRType(Ity_I32), inst_addr,
-					data_expr1, data_expr2, data_expr3, data_expr4);
+			if (e->Iex.Binop.op == Iop_Sub64 || e->Iex.Binop.op == Iop_Sub32)
+				val = -val;
 
-			break;
+			bases[st->Ist.WrTmp.tmp] = bases[e->Iex.Binop.arg1->Iex.RdTmp.tmp];
+			bases[st->Ist.WrTmp.tmp].off += val;
+		}
+	}
+}
+
+static int addr_base(IRExpr *addr, const struct addr_base *bases, struct addr_base *res)
+{
+	if (addr->tag == Iex_RdTmp)
+	{
+		*res = bases[addr->Iex.RdTmp.tmp];
+		return True;
+	}
+
+	if (addr->tag == Iex_Const)
+	{
+		IRConst *c = addr->Iex.Const.con;
+		res->base = IRTemp_INVALID;
+		res->off = c->tag == Ico_U64 ? (Long)c->Ico.U64 : (Long)c->Ico.U32;
+		return True;
+	}
+
+	return False;
+}
+
+static int coalescable_type(IRType ty)
+{
+	switch (ty)
+	{
+		case Ity_I8: case Ity_I16: case Ity_I32: case Ity_I64:
+		case Ity_F32: case Ity_F64: case Ity_V128: case Ity_V256:
+			return True;
 		default:
-			VG_(message) (Vg_UserMsg, "Warning! we missed a write of 0x%08x\n", (UInt) arg_ty);
-			break;
+			return False;
 	}
 }
-#endif
+
+#define MAX_RUN_PUTS 8
+
+/*
+ * Temporaries of a run are computed before its first store (see
+ * add_trace_store_run), so a run must not contain a Get of guest state
+ * written by a Put earlier in the run.
+ */
+static int get_after_put(IRExpr *e, const Int *put_off, const Int *put_size,
+		int n_puts, int seen_puti)
+{
+	int i;
+
+	if (e->tag == Iex_GetI)
+		return n_puts > 0 || seen_puti;
+	if (e->tag != Iex_Get)
+		return False;
+	if (seen_puti)
+		return True;
+	for (i = 0; i < n_puts; ++i)
+		if (e->Iex.Get.offset < put_off[i] + put_size[i] &&
+				put_off[i] < e->Iex.Get.offset + sizeofIRType(e->Iex.Get.ty))
+			return True;
+	return False;
+}
+
+/*
+ * Returns index of the last store of a run starting at stmts[first]
+ * and its length in bytes.
+ */
+static int find_store_run(IRSB *bb, int first, const struct addr_base *bases, Int *len)
+{
+	IRStmt *st = bb->stmts[first];
+	struct addr_base start, cur;
+	IRType ty = typeOfIRExpr(bb->tyenv, st->Ist.Store.data);
+	Int put_off[MAX_RUN_PUTS], put_size[MAX_RUN_PUTS];
+	int n_puts = 0, seen_puti = False;
+	int last = first, i;
+
+	*len = 0;
+	if (!coalescable_type(ty) || !addr_base(st->Ist.Store.addr, bases, &start))
+		return first;
+	*len = sizeofIRType(ty);
+
+	for (i = first + 1; i < bb->stmts_used; ++i)
+	{
+		st = bb->stmts[i];
+		if (!st)
+			continue;
+
+		switch (st->tag)
+		{
+			case Ist_NoOp:
+			case Ist_IMark:
+			case Ist_AbiHint:
+				continue;
+			case Ist_Put:
+				if (n_puts == MAX_RUN_PUTS)
+					return last;
+				put_off[n_puts] = st->Ist.Put.offset;
+				put_size[n_puts] = sizeofIRType(typeOfIRExpr(bb->tyenv, st->Ist.Put.data));
+				n_puts++;
+				continue;
+			case Ist_PutI:
+				seen_puti = True;
+				continue;
+			case Ist_WrTmp:
+				if (st->Ist.WrTmp.data->tag == Iex_Load ||
+						get_after_put(st->Ist.WrTmp.data, put_off, put_size,
+							n_puts, seen_puti))
+					return last;
+				continue;
+			case Ist_Store:
+				ty = typeOfIRExpr(bb->tyenv, st->Ist.Store.data);
+				if (!coalescable_type(ty) ||
+						!addr_base(st->Ist.Store.addr, bases, &cur) ||
+						cur.base != start.base ||
+						cur.off != start.off + *len ||
+						*len + sizeofIRType(ty) > MMT_BULK_MAX)
+					return last;
+				*len += sizeofIRType(ty);
+				last = i;
+				continue;
+			default:
+				return last;
+		}
+	}
+
+	return last;
+}
+
+/*
+ * Copies the data of the run's stores to mmt_bulk_data and emits one call
+ * for all of them.  Like the per-store path, this happens before any of the
+ * stores reach memory, so the trace (and --mmt-sync-file) sees each write
+ * before the device does, and snapshot pages are saved with the old data.
+ * The caller emits the run's temporaries before and its other statements
+ * after this.
+ */
+static void add_trace_store_run(IRSB *bbOut, IRSB *bbIn, int first, int last,
+		Int len, Addr inst_addr, IRExpr *guard)
+{
+	IRExpr *addr = bbIn->stmts[first]->Ist.Store.addr;
+	IRExpr **argv;
+	IRDirty *di;
+	Int off = 0;
+	int i;
+
+	for (i = first; i <= last; ++i)
+	{
+		IRStmt *st = bbIn->stmts[i];
+		if (!st || st->tag != Ist_Store)
+			continue;
+
+		addStmtToIRSB(bbOut, IRStmt_Store(st->Ist.Store.end,
+				mkIRExpr_HWord((HWord)(mmt_bulk_data + off)),
+				st->Ist.Store.data));
+		off += sizeofIRType(typeOfIRExpr(bbIn->tyenv, st->Ist.Store.data));
+	}
+
+	if (want_inst_addr())
+	{
+		argv = mkIRExprVec_3(addr, mkIRExpr_HWord(len), mkIRExpr_HWord(inst_addr));
+		di = unsafeIRDirty_0_N(2, "trace_store_bulk",
+				VG_(fnptr_to_fnentry)(mmt_trace_store_bin_bulk_ia), argv);
+	}
+	else
+	{
+		argv = mkIRExprVec_2(addr, mkIRExpr_HWord(len));
+		di = unsafeIRDirty_0_N(2, "trace_store_bulk",
+				VG_(fnptr_to_fnentry)(mmt_trace_store_bin_bulk), argv);
+	}
+
+	/* helper reads the copy, not the destination */
+	di->mFx = Ifx_Read;
+	di->mAddr = mkIRExpr_HWord((HWord)mmt_bulk_data);
+	di->mSize = len;
+	if (guard)
+		di->guard = guard;
+
+	addStmtToIRSB(bbOut, IRStmt_Dirty(di));
+}
 
 IRSB *mmt_instrument(VgCallbackClosure *closure,
 				IRSB *bbIn,
@@ -721,8 +784,12 @@ IRSB *mmt_instrument(VgCallbackClosure *closure,
 				IRType gWordTy, IRType hWordTy)
 {
 	IRSB *bbOut;
-	int i = 0;
+	int i = 0, last;
+	Int len;
 	Addr inst_addr;
+	/* tracing all memory makes the filter useless */
+	int filter = mmt_inline_filter && !all_mem;
+	struct addr_base *bases = NULL;
 
 	if (gWordTy != hWordTy)
 	{
@@ -742,6 +809,12 @@ IRSB *mmt_instrument(VgCallbackClosure *closure,
 
 	inst_addr = 0;
 
+	if (mmt_coalesce_stores && dump_store)
+	{
+		bases = VG_(malloc)("mmt.instrument", bbIn->tyenv->types_used * sizeof(bases[0]));
+		compute_bases(bbIn, bases);
+	}
+
 	for (; i < bbIn->stmts_used; i++)
 	{
 		IRStmt *st = bbIn->stmts[i];
@@ -756,14 +829,58 @@ IRSB *mmt_instrument(VgCallbackClosure *closure,
 			inst_addr = st->Ist.IMark.addr;
 			addStmtToIRSB(bbOut, st);
 		}
+		else if (st->tag == Ist_Store && dump_store && bases &&
+				(last = find_store_run(bbIn, i, bases, &len)) > i)
+		{
+			IRExpr *guard = NULL;
+			Addr first_inst_addr = inst_addr;
+			int j;
+
+			/* address and data temporaries first */
+			for (j = i; j <= last; ++j)
+			{
+				IRStmt *st2 = bbIn->stmts[j];
+				if (st2 && st2->tag == Ist_WrTmp)
+					addStmtToIRSB(bbOut, st2);
+			}
+
+			if (filter)
+			{
+				IRTemp t = newIRTemp(bbOut->tyenv, Ity_I1);
+				IRExpr *last_addr = bbIn->stmts[last]->Ist.Store.addr;
+
+				addStmtToIRSB(bbOut, IRStmt_WrTmp(t, IRExpr_Binop(Iop_Or1,
+						add_region_filter(bbOut, st->Ist.Store.addr, gWordTy),
+						add_region_filter(bbOut, last_addr, gWordTy))));
+				guard = IRExpr_RdTmp(t);
+			}
+
+			add_trace_store_run(bbOut, bbIn, i, last, len, first_inst_addr, guard);
+
+			/* then the stores, in order with the Puts, so that guest
+			 * state is exact if one of them faults */
+			for (j = i; j <= last; ++j)
+			{
+				IRStmt *st2 = bbIn->stmts[j];
+				if (!st2 || st2->tag == Ist_WrTmp)
+					continue;
+				if (st2->tag == Ist_IMark)
+					inst_addr = st2->Ist.IMark.addr;
+				addStmtToIRSB(bbOut, st2);
+			}
+			i = last;
+		}
 		else if (st->tag == Ist_Store && dump_store)
 		{
 			data_expr = st->Ist.Store.data;
 
 			arg_ty = typeOfIRExpr(bbIn->tyenv, data_expr);
 
+			if (filter)
+				call_guard = add_region_filter(bbOut, st->Ist.Store.addr, gWordTy);
 			add_trace_store(bbOut, st->Ist.Store.addr, inst_addr,
-					arg_ty, data_expr);
+					st->Ist.Store.end, arg_ty, data_expr);
+			call_guard = NULL;
 			addStmtToIRSB(bbOut, st);
 		}
 		else if (st->tag == Ist_WrTmp && dump_load)
@@ -781,9 +898,12 @@ IRSB *mmt_instrument(VgCallbackClosure *closure,
 
 				arg_ty = typeOfIRExpr(bbIn->tyenv, value);
 
+				if (filter)
+					call_guard = add_region_filter(bbOut, data_expr->Iex.Load.addr, gWordTy);
 				add_trace_load(bbOut, data_expr->Iex.Load.addr,
 						sizeofIRType(data_expr->Iex.Load.ty),
-						inst_addr, value, arg_ty);
+						inst_addr, data_expr->Iex.Load.end, value, arg_ty);
+				call_guard = NULL;
 			}
 			else
 				addStmtToIRSB(bbOut, st);
@@ -792,5 +912,9 @@ IRSB *mmt_instrument(VgCallbackClosure *closure,
 			addStmtToIRSB(bbOut, st);
 
 	}
+
+	if (bases)
+		VG_(free)(bases);
+
 	return bbOut;
 }
@@ -4,6 +4,8 @@
 #include "pub_tool_basics.h"
 #include "pub_tool_tooliface.h"
 
+extern int mmt_coalesce_stores;
+
 IRSB *mmt_instrument(VgCallbackClosure *closure,
 				IRSB *bbIn,
 				const VexGuestLayout *layout,
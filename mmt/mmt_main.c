@@ -36,11 +36,18 @@
 
 #include <fcntl.h>
 
+#include "mmt_blob.h"
 #include "mmt_fglrx_ioctl.h"
 #include "mmt_nv_ioctl.h"
 #include "mmt_nouveau_ioctl.h"
 #include "mmt_instrument.h"
+#include "mmt_policy.h"
+#include "mmt_profile.h"
+#include "mmt_ring.h"
+#include "mmt_snapshot.h"
 #include "mmt_trace.h"
+#include "mmt_trace_bin.h"
+#include "mmt_writer.h"
 
 #define TF_OPT "--mmt-trace-file="
 #define TN_OPT "--mmt-trace-nvidia-ioctls"
@@ -55,8 +62,33 @@
 #define OT_OPT "--mmt-object-ctr="
 #define FC_OPT "--mmt-ioctl-call-fuzzer="
 #define SF_OPT "--mmt-sync-file="
+#define SW_OPT "--mmt-sync-window="
+#define AW_OPT "--mmt-async-writer"
+#define IF_OPT "--mmt-inline-filter"
+#define FMT_OPT "--mmt-trace-format="
+#define TZ_OPT "--mmt-trace-compress="
+#define CS_OPT "--mmt-coalesce-stores"
+#define SM_OPT "--mmt-snapshot-min-size="
+#define SN_OPT "--mmt-snapshot-nouveau-bos"
+#define PL_OPT "--mmt-policy="
+#define TR_OPT "--mmt-trace-range="
+#define PF_OPT "--mmt-profile="
+#define PT_OPT "--mmt-profile-top="
+#define ST_OPT "--mmt-stats="
+#define RG_OPT "--mmt-ring="
+#define RS_OPT "--mmt-ring-size="
+#define DD_OPT "--mmt-dedup-dumps"
+#define TT_OPT "--mmt-timestamps"
 
 static char *mmt_sync_file = NULL;
+
+/* the ring takes records one by one, so they can't be compressed in blocks */
+static void check_ring_compress(const HChar *arg)
+{
+	if (mmt_ring_file && mmt_trace_compress == MMT_COMPRESS_FAST)
+		VG_(fmsg_bad_option)(arg, "--mmt-ring and " TZ_OPT "fast cannot be used together\n");
+}
+
 static Bool mmt_process_cmd_line_option(const HChar *arg)
 {
 //	VG_(printf)("arg: %s\n", arg);
@@ -161,11 +193,147 @@ static Bool mmt_process_cmd_line_option(const HChar *arg)
 		mmt_sync_file = VG_(strdup)("mmt.options-parsing", val);
 		return True;
 	}
+	else if (VG_(strncmp)(arg, SW_OPT, VG_(strlen(SW_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(SW_OPT));
+		HChar *end;
+		Long win = VG_(strtoll10)(val, &end);
+		if (*end || win < 1 || win > 1000000)
+			return False;
+		mmt_sync_window = win;
+		return True;
+	}
 	else if (VG_(strcmp)(arg, TMEM_OPT) == 0)
 	{
 		all_mem = 1;
 		return True;
 	}
+	else if (VG_(strcmp)(arg, AW_OPT) == 0)
+	{
+		mmt_async_writer = True;
+		return True;
+	}
+	else if (VG_(strncmp)(arg, FMT_OPT, VG_(strlen(FMT_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(FMT_OPT));
+		if (val[0] >= '1' && val[0] <= '2' && val[1] == 0)
+		{
+			mmt_trace_format = val[0] - '0';
+			return True;
+		}
+		return False;
+	}
+	else if (VG_(strncmp)(arg, TZ_OPT, VG_(strlen(TZ_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(TZ_OPT));
+		if (VG_(strcmp)(val, "fast") == 0)
+			mmt_trace_compress = MMT_COMPRESS_FAST;
+		else if (VG_(strcmp)(val, "none") == 0)
+			mmt_trace_compress = MMT_COMPRESS_NONE;
+		else
+			return False;
+		check_ring_compress(arg);
+		return True;
+	}
+	else if (VG_(strcmp)(arg, CS_OPT) == 0)
+	{
+		mmt_coalesce_stores = True;
+		return True;
+	}
+	else if (VG_(strncmp)(arg, SM_OPT, VG_(strlen(SM_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(SM_OPT));
+		HChar *end;
+		Long size = VG_(strtoll10)(val, &end);
+		if (*end || size < 0)
+			return False;
+		mmt_snapshot_min_size = size;
+		return True;
+	}
+	else if (VG_(strcmp)(arg, SN_OPT) == 0)
+	{
+		mmt_snapshot_nouveau_bos = True;
+		return True;
+	}
+	else if (VG_(strncmp)(arg, PL_OPT, VG_(strlen(PL_OPT))) == 0)
+	{
+		if (!mmt_policy_add_rule(arg + VG_(strlen(PL_OPT))))
+		{
+			VG_(printf)("invalid or too many policy rules\n");
+			return False;
+		}
+		return True;
+	}
+	else if (VG_(strncmp)(arg, TR_OPT, VG_(strlen(TR_OPT))) == 0)
+	{
+		if (!mmt_policy_add_range(arg + VG_(strlen(TR_OPT))))
+		{
+			VG_(printf)("invalid or too many trace ranges\n");
+			return False;
+		}
+		return True;
+	}
+	else if (VG_(strncmp)(arg, PF_OPT, VG_(strlen(PF_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(PF_OPT));
+		if (!*val)
+			return False;
+		mmt_profile_file = VG_(strdup)("mmt.options-parsing", val);
+		mmt_profile = True;
+		return True;
+	}
+	else if (VG_(strncmp)(arg, PT_OPT, VG_(strlen(PT_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(PT_OPT));
+		HChar *end;
+		Long n = VG_(strtoll10)(val, &end);
+		if (*end || n < 0)
+			return False;
+		mmt_profile_top = n;
+		return True;
+	}
+	else if (VG_(strncmp)(arg, ST_OPT, VG_(strlen(ST_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(ST_OPT));
+		if (!*val)
+			return False;
+		mmt_stats_file = VG_(strdup)("mmt.options-parsing", val);
+		return True;
+	}
+	else if (VG_(strncmp)(arg, RG_OPT, VG_(strlen(RG_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(RG_OPT));
+		if (!*val)
+			return False;
+		mmt_ring_file = VG_(strdup)("mmt.options-parsing", val);
+		check_ring_compress(arg);
+		return True;
+	}
+	else if (VG_(strncmp)(arg, RS_OPT, VG_(strlen(RS_OPT))) == 0)
+	{
+		const HChar *val = arg + VG_(strlen(RS_OPT));
+		HChar *end;
+		Long mb = VG_(strtoll10)(val, &end);
+		if (*end || mb < 1 || mb > MMT_RING_MAX_SIZE_MB)
+			return False;
+		mmt_ring_size_mb = mb;
+		return True;
+	}
+	else if (VG_(strcmp)(arg, TT_OPT) == 0)
+	{
+		mmt_timestamps = True;
+		return True;
+	}
+	else if (VG_(strcmp)(arg, DD_OPT) == 0)
+	{
+		mmt_dedup_dumps = True;
+		return True;
+	}
+	else if (VG_(strcmp)(arg, IF_OPT) == 0)
+	{
+		mmt_inline_filter = True;
+		return True;
+	}
 
 	return False;
 }
@@ -187,6 +355,23 @@ static void mmt_print_usage(void)
 	VG_(printf)("    " OT_OPT          "class,cargs sets the number of u32 constructor args(dec)\n\t\t\t\tfor specified class(hex)\n");
 	VG_(printf)("    " FC_OPT        "    0-disabled (default), 1-enabled\n");
 	VG_(printf)("    " SF_OPT"path        emit synchronization markers in output stream\n\t\t\t\tand wait for replies from specified file\n");
+	VG_(printf)("    " SW_OPT "n         with " SF_OPT " wait only every n memory\n\t\t\t\taccesses (syscalls and ioctls always wait)\n\t\t\t\t(default: 1)\n");
+	VG_(printf)("    " AW_OPT "          write trace from a helper process\n");
+	VG_(printf)("    " IF_OPT "         skip tracing helpers inline for accesses\n\t\t\t\tfar from traced regions\n");
+	VG_(printf)("    " FMT_OPT "         1-classic (default), 2-compact memory\n\t\t\t\taccess records\n");
+	VG_(printf)("    " TZ_OPT "       none (default), fast - compress trace in\n\t\t\t\tblocks (LZO1X), see mmt-unpack\n");
+	VG_(printf)("    " CS_OPT "       record runs of stores to consecutive\n\t\t\t\taddresses in one superblock as one write\n");
+	VG_(printf)("    " SM_OPT "n   record stores to mappings of at least\n\t\t\t\tn bytes as diffs of written pages, made\n\t\t\t\tbefore the next syscall (default: 0 - off)\n");
+	VG_(printf)("    " SN_OPT "  same for buffers submitted by nouveau's\n\t\t\t\tGEM_PUSHBUF\n");
+	VG_(printf)("    " PL_OPT "policy:selector  what to record for regions matching\n\t\t\t\tselector (all, fd=n, path=pattern,\n\t\t\t\tclass=hex - nvrm object class), policy is\n\t\t\t\ttrace (default), count - per-offset access\n\t\t\t\tcounts only, or ignore; first matching rule\n\t\t\t\twins, can be passed multiple times\n");
+	VG_(printf)("    " TR_OPT "selector:start-end  trace only offsets [start, end)\n\t\t\t\t(hex) of regions matching selector (as in\n\t\t\t\t--mmt-policy), can be passed multiple times\n");
+	VG_(printf)("    " PF_OPT "file          do not trace accesses, write per-offset\n\t\t\t\taccess counts (by instruction) and polling\n\t\t\t\tloops to file at exit (%%p is replaced\n\t\t\t\twith pid)\n");
+	VG_(printf)("    " PT_OPT "n         list only n hottest offsets (default:\n\t\t\t\t32, 0 - all)\n");
+	VG_(printf)("    " ST_OPT "file            write number of traced accesses, trace size\n\t\t\t\tand rates to file at exit\n");
+	VG_(printf)("    " RG_OPT "file             write trace to a shared memory ring in file\n\t\t\t\t(e.g. /dev/shm/mmt.%%p), to be read by\n\t\t\t\tmmt-ring-cat while the program runs;\n\t\t\t\tignores " AW_OPT ", can't be used\n\t\t\t\twith " TZ_OPT "fast\n");
+	VG_(printf)("    " RS_OPT "n           size of the ring in MB (default: %d)\n", MMT_RING_DEFAULT_SIZE_MB);
+	VG_(printf)("    " DD_OPT "           write every distinct content of memory\n\t\t\t\tdumped for ioctls once, as a blob, and\n\t\t\t\trefer to it from dumps by id\n");
+	VG_(printf)("    " TT_OPT "            close groups of records with timestamps,\n\t\t\t\tso traces of many processes (--log-file=\n\t\t\t\tname.%%p) can be merged with mmt-merge;\n\t\t\t\twith --mmt-trace-format=2 polling loops\n\t\t\t\tare timed, see mmt-polls\n");
 }
 
 static void mmt_print_debug_usage(void)
@@ -195,12 +380,18 @@ static void mmt_print_debug_usage(void)
 
 static void mmt_fini(Int exitcode)
 {
+	mmt_snapshot_barrier();
+	mmt_policy_fini();
+	mmt_profile_fini();
 	mmt_nv_ioctl_fini();
+	mmt_bin_fini();
 }
 
 static void mmt_post_clo_init(void)
 {
 	mmt_nv_ioctl_post_clo_init();
+	mmt_bin_init();
+	mmt_trace_inherited_fds();
 
 	if (mmt_sync_file)
 	{
@@ -227,6 +418,8 @@ static void mmt_pre_clo_init(void)
 
 	VG_(needs_syscall_wrapper) (mmt_pre_syscall, mmt_post_syscall);
 
+	VG_(needs_client_requests) (mmt_handle_client_request);
+
 	FD_ZERO(&trace_fds);
 }
 
@@ -0,0 +1,168 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Merges traces of many processes, written with --mmt-timestamps and
+ * --log-file=name.%p, into one stream ordered by time.
+ *
+ * Every trace is split into groups of records closed by 'T' records (see
+ * mmt_trace_bin.c), which are then interleaved by their timestamps. 'T'
+ * records are kept, so readers can tell which process the preceding group
+ * comes from; ids (regions, blobs) are per process. Records after the last
+ * 'T' (of a process which crashed) go at the end. Trace written by a
+ * traced child before execve is kept in name.<pid>.1 (and so on).
+ *
+ * Compressed traces have to be unpacked (mmt-unpack) first.
+ *
+ * Usage: mmt-merge trace... > merged-trace
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmt_reader.h"
+
+struct input
+{
+	const char *name;
+	const unsigned char *data;
+	size_t len;
+
+	/* current group */
+	size_t start, end;
+	unsigned long long time;
+};
+
+/* finds the group starting at in->end, returns 0 at the end of trace */
+static int next_group(struct input *in)
+{
+	size_t pos = in->end;
+	long len;
+
+	in->start = pos;
+	if (pos == in->len)
+		return 0;
+
+	while (pos < in->len)
+	{
+		const unsigned char *p = in->data + pos;
+
+		len = mmt_record_len(p, in->len - pos);
+		if (len == MMT_READER_TRUNCATED)
+		{
+			fprintf(stderr, "%s: truncated record at %zu\n", in->name, pos);
+			break;
+		}
+		if (len < 0)
+		{
+			fprintf(stderr, "%s: %s at %zu\n", in->name, mmt_reader_error(len), pos);
+			exit(1);
+		}
+		pos += len;
+
+		if (p[0] == 'T')
+		{
+			in->end = pos;
+			memcpy(&in->time, p + 5, sizeof(in->time));
+			return 1;
+		}
+	}
+
+	/* no timestamp at the end */
+	in->end = in->len;
+	in->time = ~0ULL;
+	return 1;
+}
+
+static void open_input(struct input *in, const char *name)
+{
+	struct stat st;
+	int fd;
+
+	in->name = name;
+	fd = open(name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror(name);
+		exit(1);
+	}
+
+	in->len = st.st_size;
+	in->data = NULL;
+	if (in->len)
+	{
+		in->data = mmap(NULL, in->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in->data == MAP_FAILED)
+		{
+			perror(name);
+			exit(1);
+		}
+	}
+	close(fd);
+
+	in->end = 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct input *inputs;
+	int n = argc - 1, i, best;
+
+	if (n < 1)
+	{
+		fprintf(stderr, "usage: %s trace... > merged-trace\n", argv[0]);
+		return 1;
+	}
+
+	inputs = calloc(n, sizeof(*inputs));
+	for (i = 0; i < n; ++i)
+	{
+		open_input(&inputs[i], argv[i + 1]);
+		if (!next_group(&inputs[i]))
+			inputs[i].data = NULL;
+	}
+
+	for (;;)
+	{
+		best = -1;
+		for (i = 0; i < n; ++i)
+			if (inputs[i].data && (best < 0 || inputs[i].time < inputs[best].time))
+				best = i;
+		if (best < 0)
+			break;
+
+		if (fwrite(inputs[best].data + inputs[best].start, 1,
+				inputs[best].end - inputs[best].start, stdout) !=
+				inputs[best].end - inputs[best].start)
+		{
+			perror("write");
+			return 1;
+		}
+
+		if (!next_group(&inputs[best]))
+			inputs[best].data = NULL;
+	}
+
+	return 0;
+}
@@ -19,25 +19,79 @@
    The GNU General Public License is contained in the file COPYING.
 */
 
+#include "mmt_blob.h"
 #include "mmt_nouveau_ioctl.h"
+#include "mmt_snapshot.h"
 #include "mmt_trace_bin.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_oset.h"
 #include "vki-linux-drm-nouveau.h"
 
 #include <sys/select.h>
 
 int mmt_trace_nouveau_ioctls = False;
 
+/* mmap offsets of buffer objects, for --mmt-snapshot-nouveau-bos */
+struct bo_handle
+{
+	ULong key; /* fd << 32 | handle */
+	ULong map_handle;
+};
+
+static OSet *bo_handles;
+
+static void remember_bo(int fd, struct vki_drm_nouveau_gem_info *info)
+{
+	ULong key = ((ULong)fd << 32) | info->handle;
+	struct bo_handle *bo;
+
+	if (UNLIKELY(!bo_handles))
+		bo_handles = VG_(OSetGen_Create)(offsetof(struct bo_handle, key),
+				NULL, VG_(malloc), "mmt.nouveau.bos", VG_(free));
+
+	bo = VG_(OSetGen_Lookup)(bo_handles, &key);
+	if (!bo)
+	{
+		bo = VG_(OSetGen_AllocNode)(bo_handles, sizeof(*bo));
+		bo->key = key;
+		VG_(OSetGen_Insert)(bo_handles, bo);
+	}
+	bo->map_handle = info->map_handle;
+}
+
+/* records further CPU writes to submitted buffers as snapshots */
+static void snapshot_pushbuf_bos(int fd, struct vki_drm_nouveau_gem_pushbuf *pushbuf)
+{
+	struct vki_drm_nouveau_gem_pushbuf_bo *bos = (void *)(Addr)pushbuf->buffers;
+	struct mmt_mmap_data *region;
+	struct bo_handle *bo;
+	ULong key;
+	UInt i;
+
+	if (!bo_handles || !bos)
+		return;
+
+	for (i = 0; i < pushbuf->nr_buffers; ++i)
+	{
+		key = ((ULong)fd << 32) | bos[i].handle;
+		bo = VG_(OSetGen_Lookup)(bo_handles, &key);
+		if (!bo)
+			continue;
+
+		region = mmt_find_region_by_offset(fd, bo->map_handle);
+		if (region)
+			mmt_snapshot_tag(region);
+	}
+}
+
 static void dumpmem(Addr addr, UInt size)
 {
 	if (!addr || !size)
 		return;
 
-	mmt_bin_write_1('y');
-	mmt_bin_write_8(addr);
-	mmt_bin_write_buffer((UChar *)addr, size);
-	mmt_bin_end();
+	mmt_dump_memory(addr, (UChar *)addr, size);
 }
 
 static void mmt_nouveau_pushbuf(struct vki_drm_nouveau_gem_pushbuf *pushbuf)
@@ -69,7 +123,11 @@ int mmt_nouveau_ioctl_pre(UWord *args)
 	mmt_bin_end();
 
 	if (id == VKI_DRM_IOCTL_NOUVEAU_GEM_PUSHBUF)
+	{
 		mmt_nouveau_pushbuf((void *)data);
+		if (mmt_snapshot_nouveau_bos)
+			snapshot_pushbuf_bos(fd, (void *)data);
+	}
 	else if (id == VKI_DRM_IOCTL_VERSION)
 	{
 		struct vki_drm_version *d = (void *)data;
@@ -115,6 +173,13 @@ int mmt_nouveau_ioctl_post(UWord *args, SysRes res)
 		dumpmem((Addr)d->date, d->date_len);
 		dumpmem((Addr)d->desc, d->desc_len);
 	}
+	else if (mmt_snapshot_nouveau_bos && !sr_isError(res))
+	{
+		if (id == VKI_DRM_IOCTL_NOUVEAU_GEM_NEW)
+			remember_bo(fd, &((struct vki_drm_nouveau_gem_new *)data)->info);
+		else if (id == VKI_DRM_IOCTL_NOUVEAU_GEM_INFO)
+			remember_bo(fd, data);
+	}
 
 	mmt_bin_sync();
 
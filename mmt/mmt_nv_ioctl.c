@@ -20,9 +20,13 @@
 
    The GNU General Public License is contained in the file COPYING.
 */
+#include "mmt_blob.h"
 #include "mmt_nv_ioctl.h"
+#include "mmt_policy.h"
 #include "mmt_trace_bin.h"
 #include "pub_tool_libcproc.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_oset.h"
 #include "pub_tool_vkiscnums.h"
 #include "coregrind/pub_core_syscall.h"
 #include "coregrind/pub_core_aspacemgr.h"
@@ -204,15 +208,10 @@ static void dumpmem(Addr addr, UInt size)
 	if (!addr || !size)
 		return;
 
-	mmt_bin_write_1('y');
-	mmt_bin_write_8(addr);
-
 	if ((addr & 0xffff0000) == 0xbeef0000) // TODO: is it still needed?
-		mmt_bin_write_buffer(NULL, 0);
+		mmt_dump_memory(addr, NULL, 0);
 	else
-		mmt_bin_write_buffer((UChar *)addr, size);
-
-	mmt_bin_end();
+		mmt_dump_memory(addr, (UChar *)addr, size);
 }
 
 static const struct nv_object_type *find_objtype(UInt id)
@@ -620,6 +619,112 @@ int mmt_nv_ioctl_pre(UWord *args)
 	return 1;
 }
 
+/* classes of objects and of their host mappings, for class= policy rules */
+struct nv_class
+{
+	ULong key;
+	UInt cls;
+};
+
+/* cid << 32 | handle -> class */
+static OSet *object_classes;
+/* mmap offset -> class */
+static OSet *map_classes;
+
+static void set_class(OSet **set, ULong key, UInt cls)
+{
+	struct nv_class *c;
+
+	if (!*set)
+		*set = VG_(OSetGen_Create)(offsetof(struct nv_class, key),
+				NULL, VG_(malloc), "mmt.nv.classes", VG_(free));
+
+	c = VG_(OSetGen_Lookup)(*set, &key);
+	if (!c)
+	{
+		c = VG_(OSetGen_AllocNode)(*set, sizeof(*c));
+		c->key = key;
+		VG_(OSetGen_Insert)(*set, c);
+	}
+	c->cls = cls;
+}
+
+static void track_classes(UInt id, void *data)
+{
+	switch (id)
+	{
+		case NVRM_IOCTL_CREATE:
+		{
+			struct nvrm_ioctl_create *s = data;
+			if (s->status == NVRM_STATUS_SUCCESS)
+				set_class(&object_classes, ((ULong)s->cid << 32) | s->handle, s->cls);
+			break;
+		}
+		case NVRM_IOCTL_CREATE_SIMPLE:
+		{
+			struct nvrm_ioctl_create_simple *s = data;
+			if (s->status == NVRM_STATUS_SUCCESS)
+				set_class(&object_classes, ((ULong)s->cid << 32) | s->handle, s->cls);
+			break;
+		}
+		case NVRM_IOCTL_CREATE_DRV_OBJ:
+		{
+			struct nvrm_ioctl_create_drv_obj *s = data;
+			if (s->status == NVRM_STATUS_SUCCESS)
+				set_class(&object_classes, ((ULong)s->cid << 32) | s->handle, s->cls);
+			break;
+		}
+		case NVRM_IOCTL_CREATE_VSPACE:
+		{
+			struct nvrm_ioctl_create_vspace *s = data;
+			if (s->status != NVRM_STATUS_SUCCESS)
+				break;
+			set_class(&object_classes, ((ULong)s->cid << 32) | s->handle, s->cls);
+			if (s->foffset)
+				set_class(&map_classes, s->foffset, s->cls);
+			break;
+		}
+		case NVRM_IOCTL_HOST_MAP:
+		{
+			struct nvrm_ioctl_host_map *s = data;
+			ULong key = ((ULong)s->cid << 32) | s->handle;
+			struct nv_class *c;
+
+			if (s->status != NVRM_STATUS_SUCCESS || !object_classes)
+				break;
+			c = VG_(OSetGen_Lookup)(object_classes, &key);
+			if (c)
+				set_class(&map_classes, s->foffset, c->cls);
+			break;
+		}
+		case NVRM_IOCTL_DESTROY:
+		{
+			struct nvrm_ioctl_destroy *s = data;
+			ULong key = ((ULong)s->cid << 32) | s->handle;
+			struct nv_class *c;
+
+			if (s->status != NVRM_STATUS_SUCCESS || !object_classes)
+				break;
+			c = VG_(OSetGen_Remove)(object_classes, &key);
+			if (c)
+				VG_(OSetGen_FreeNode)(object_classes, c);
+			break;
+		}
+	}
+}
+
+Long mmt_nv_object_class(Off64T foffset)
+{
+	ULong key = foffset;
+	struct nv_class *c;
+
+	if (!map_classes)
+		return -1;
+
+	c = VG_(OSetGen_Lookup)(map_classes, &key);
+	return c ? c->cls : -1;
+}
+
 static void inject_get_chipset(int fd, struct nvrm_ioctl_create *s)
 {
 	// inject GET_CHIPSET ioctl
@@ -689,6 +794,9 @@ int mmt_nv_ioctl_post(UWord *args, SysRes res)
 	mmt_bin_write_buffer((UChar *)data, size);
 	mmt_bin_end();
 
+	if (mmt_policy_need_classes && !sr_isError(res))
+		track_classes(id, data);
+
 	switch (id)
 	{
 		case NVRM_IOCTL_CREATE_DEV_OBJ:
@@ -23,4 +23,7 @@ void mmt_nv_ioctl_post_clo_init(void);
 int mmt_nv_ioctl_pre(UWord *args);
 int mmt_nv_ioctl_post(UWord *args, SysRes res);
 
+/* class of object mapped at given mmap offset, -1 if unknown */
+Long mmt_nv_object_class(Off64T foffset);
+
 #endif /* NVIDIA_IOCTL_H_ */
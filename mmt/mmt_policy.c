@@ -0,0 +1,628 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Per-region trace policies.
+ *
+ * Every traced region gets a policy when it is mapped: the first rule
+ * (--mmt-policy=<policy>:<selector>) matching it wins, regions not matched
+ * by any rule are traced. Policy of existing regions can be changed with
+ * client requests (see mmt.h) and monitor commands ("monitor help" in gdb
+ * or vgdb), so the scope of a long capture can be adjusted without restarting.
+ *
+ * Regions with "count" policy keep a number of reads and writes for each
+ * accessed offset, written out as 'c' records (region id, offset, reads,
+ * writes) sorted by offset when the region is unmapped, its policy changes
+ * or the program exits.
+ *
+ * Tracing can be limited to ranges of offsets within regions
+ * (--mmt-trace-range=<selector>:<start>-<end>, MMT_TRACE_RANGE client
+ * request). Accesses outside of them are rejected by the tracing helpers
+ * right after the region lookup.
+ */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_clientstate.h"
+#include "pub_tool_gdbserver.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_seqmatch.h"
+#include "pub_tool_tooliface.h"
+
+#include "mmt_nv_ioctl.h"
+#include "mmt_policy.h"
+#include "mmt_snapshot.h"
+#include "mmt_trace_bin.h"
+
+#define SEL_ALL		0
+#define SEL_FD		1
+#define SEL_PATH	2
+#define SEL_CLASS	3
+
+struct rule
+{
+	int policy;
+	int sel;
+	Long value; /* fd or class */
+	HChar *pattern;
+};
+
+static struct rule rules[MMT_MAX_POLICY_RULES];
+static int rules_num;
+
+struct range_rule
+{
+	struct rule sel;
+	ULong start, end;
+};
+
+static struct range_rule range_rules[MMT_MAX_RANGE_RULES];
+static int range_rules_num;
+
+int mmt_policy_need_classes = False;
+
+static HChar *fd_paths[FD_SETSIZE];
+
+static const HChar *policy_names[] = { "trace", "count", "ignore" };
+
+struct offset_count
+{
+	/* VgHashNode */
+	struct offset_count *next;
+	UWord offset;
+
+	ULong reads;
+	ULong writes;
+};
+
+static int parse_policy(const HChar *str, SizeT len)
+{
+	int i;
+
+	for (i = 0; i <= MMT_POLICY_IGNORE; ++i)
+		if (VG_(strlen)(policy_names[i]) == len &&
+				VG_(strncmp)(str, policy_names[i], len) == 0)
+			return i;
+
+	return -1;
+}
+
+/* all, fd=<n>, path=<pattern> or class=<hex> */
+static Bool parse_selector(const HChar *sel, struct rule *r)
+{
+	HChar *end;
+
+	r->pattern = NULL;
+	if (VG_(strcmp)(sel, "all") == 0)
+		r->sel = SEL_ALL;
+	else if (VG_(strncmp)(sel, "fd=", 3) == 0)
+	{
+		r->sel = SEL_FD;
+		r->value = VG_(strtoll10)(sel + 3, &end);
+		if (*end || end == sel + 3 || r->value < 0)
+			return False;
+	}
+	else if (VG_(strncmp)(sel, "path=", 5) == 0)
+	{
+		if (!sel[5])
+			return False;
+		r->sel = SEL_PATH;
+		r->pattern = VG_(strdup)("mmt.policy", sel + 5);
+	}
+	else if (VG_(strncmp)(sel, "class=", 6) == 0)
+	{
+		r->sel = SEL_CLASS;
+		r->value = VG_(strtoll16)(sel + 6, &end);
+		if (*end || end == sel + 6)
+			return False;
+		mmt_policy_need_classes = True;
+	}
+	else
+		return False;
+
+	return True;
+}
+
+/* <policy>:<selector> */
+static Bool parse_rule(const HChar *spec, struct rule *r)
+{
+	const HChar *colon = VG_(strchr)(spec, ':');
+
+	if (!colon)
+		return False;
+
+	r->policy = parse_policy(spec, colon - spec);
+	if (r->policy < 0)
+		return False;
+
+	return parse_selector(colon + 1, r);
+}
+
+/* rules added at runtime take precedence over existing ones */
+static Bool insert_rule(const struct rule *r, Bool first)
+{
+	if (rules_num >= MMT_MAX_POLICY_RULES)
+		return False;
+
+	if (first)
+	{
+		VG_(memmove)(rules + 1, rules, rules_num * sizeof(rules[0]));
+		rules[0] = *r;
+	}
+	else
+		rules[rules_num] = *r;
+	rules_num++;
+
+	return True;
+}
+
+Bool mmt_policy_add_rule(const HChar *spec)
+{
+	struct rule r;
+
+	if (!parse_rule(spec, &r))
+		return False;
+
+	return insert_rule(&r, False);
+}
+
+static Bool rule_matches(const struct rule *r, const struct mmt_mmap_data *region)
+{
+	switch (r->sel)
+	{
+		case SEL_ALL:
+			return True;
+		case SEL_FD:
+			return region->fd == r->value;
+		case SEL_PATH:
+			return region->fd >= 0 && region->fd < FD_SETSIZE &&
+					fd_paths[region->fd] &&
+					VG_(string_match)(r->pattern, fd_paths[region->fd]);
+		case SEL_CLASS:
+			return mmt_nv_object_class(region->offset) == r->value;
+	}
+
+	return False;
+}
+
+void mmt_policy_open(int fd, const HChar *path)
+{
+	if (fd < 0 || fd >= FD_SETSIZE)
+		return;
+
+	mmt_policy_close(fd);
+	fd_paths[fd] = VG_(strdup)("mmt.policy.path", path);
+}
+
+const HChar *mmt_policy_fd_path(int fd)
+{
+	if (fd < 0 || fd >= FD_SETSIZE)
+		return NULL;
+	return fd_paths[fd];
+}
+
+void mmt_policy_dup(int oldfd, int newfd)
+{
+	if (oldfd < 0 || oldfd >= FD_SETSIZE || !fd_paths[oldfd])
+		return;
+
+	mmt_policy_open(newfd, fd_paths[oldfd]);
+}
+
+void mmt_policy_close(int fd)
+{
+	if (fd < 0 || fd >= FD_SETSIZE || !fd_paths[fd])
+		return;
+
+	VG_(free)(fd_paths[fd]);
+	fd_paths[fd] = NULL;
+}
+
+/* <start>-<end>, hex */
+static Bool parse_range(const HChar *str, ULong *start, ULong *end)
+{
+	HChar *e;
+
+	*start = VG_(strtoll16)(str, &e);
+	if (e == str || *e != '-')
+		return False;
+	str = e + 1;
+	*end = VG_(strtoll16)(str, &e);
+	if (e == str || *e || *end <= *start)
+		return False;
+
+	return True;
+}
+
+/* <selector>:<start>-<end>, offsets within the region */
+Bool mmt_policy_add_range(const HChar *spec)
+{
+	const HChar *colon = VG_(strrchr)(spec, ':');
+	struct range_rule *r;
+	HChar *sel;
+	Bool ok;
+
+	if (!colon || range_rules_num >= MMT_MAX_RANGE_RULES)
+		return False;
+
+	r = &range_rules[range_rules_num];
+	if (!parse_range(colon + 1, &r->start, &r->end))
+		return False;
+
+	sel = VG_(strdup)("mmt.policy.range", spec);
+	sel[colon - spec] = 0;
+	ok = parse_selector(sel, &r->sel);
+	VG_(free)(sel);
+	if (!ok)
+		return False;
+
+	range_rules_num++;
+	return True;
+}
+
+static void add_range(struct mmt_mmap_data *region, ULong start, ULong end)
+{
+	struct mmt_range *ranges;
+	UInt i, j, n = region->ranges_num;
+
+	/* merge with ranges it overlaps or touches */
+	for (i = 0; i < n && region->ranges[i].end < start; ++i)
+		;
+	for (j = i; j < n && region->ranges[j].start <= end; ++j)
+	{
+		if (region->ranges[j].start < start)
+			start = region->ranges[j].start;
+		if (region->ranges[j].end > end)
+			end = region->ranges[j].end;
+	}
+
+	ranges = VG_(malloc)("mmt.policy.ranges",
+			(n - (j - i) + 1) * sizeof(ranges[0]));
+	VG_(memcpy)(ranges, region->ranges, i * sizeof(ranges[0]));
+	ranges[i].start = start;
+	ranges[i].end = end;
+	VG_(memcpy)(ranges + i + 1, region->ranges + j, (n - j) * sizeof(ranges[0]));
+
+	if (region->ranges)
+		VG_(free)(region->ranges);
+	region->ranges = ranges;
+	region->ranges_num = n - (j - i) + 1;
+}
+
+Bool mmt_range_hit(const struct mmt_mmap_data *region, ULong offset, UInt len)
+{
+	UInt i;
+
+	for (i = 0; i < region->ranges_num; ++i)
+	{
+		if (offset + len <= region->ranges[i].start)
+			return False;
+		if (offset < region->ranges[i].end)
+			return True;
+	}
+
+	return False;
+}
+
+void mmt_policy_map(struct mmt_mmap_data *region)
+{
+	int i;
+
+	region->policy = MMT_POLICY_TRACE;
+	for (i = 0; i < rules_num; ++i)
+		if (rule_matches(&rules[i], region))
+		{
+			region->policy = rules[i].policy;
+			break;
+		}
+
+	for (i = 0; i < range_rules_num; ++i)
+		if (rule_matches(&range_rules[i].sel, region))
+			add_range(region, range_rules[i].start, range_rules[i].end);
+}
+
+void mmt_policy_unmap(struct mmt_mmap_data *region)
+{
+	if (region->ranges)
+		VG_(free)(region->ranges);
+	region->ranges = NULL;
+	region->ranges_num = 0;
+}
+
+void mmt_policy_set(struct mmt_mmap_data *region, int policy)
+{
+	if (region->policy == policy)
+		return;
+
+	/* stores buffered so far were made under the old policy */
+	mmt_snapshot_barrier();
+
+	if (region->policy == MMT_POLICY_COUNT)
+		mmt_policy_write_counts(region);
+
+	region->policy = policy;
+}
+
+void mmt_policy_count(struct mmt_mmap_data *region, UChar type, Addr addr)
+{
+	UWord offset = addr - region->start;
+	struct offset_count *c;
+
+	if (UNLIKELY(!region->counts))
+		region->counts = VG_(HT_construct)("mmt.policy.counts");
+
+	c = VG_(HT_lookup)(region->counts, offset);
+	if (UNLIKELY(!c))
+	{
+		c = VG_(calloc)("mmt.policy.count", 1, sizeof(*c));
+		c->offset = offset;
+		VG_(HT_add_node)(region->counts, c);
+	}
+
+	if (type == 'w')
+		c->writes++;
+	else
+		c->reads++;
+}
+
+static Int cmp_offsets(const void *a, const void *b)
+{
+	const struct offset_count *c1 = *(const struct offset_count * const *)a;
+	const struct offset_count *c2 = *(const struct offset_count * const *)b;
+
+	if (c1->offset < c2->offset)
+		return -1;
+	return c1->offset > c2->offset;
+}
+
+void mmt_policy_write_counts(struct mmt_mmap_data *region)
+{
+	struct offset_count *c;
+	VgHashNode **nodes;
+	UInt n, i;
+
+	if (!region->counts)
+		return;
+
+	nodes = VG_(HT_to_array)(region->counts, &n);
+	VG_(ssort)(nodes, n, sizeof(nodes[0]), cmp_offsets);
+
+	for (i = 0; i < n; ++i)
+	{
+		c = (struct offset_count *)nodes[i];
+		mmt_bin_write_1('c');
+		mmt_bin_write_4(region->id);
+		mmt_bin_write_4(c->offset);
+		mmt_bin_write_8(c->reads);
+		mmt_bin_write_8(c->writes);
+		mmt_bin_end();
+	}
+
+	VG_(free)(nodes);
+	VG_(HT_destruct)(region->counts, VG_(free));
+	region->counts = NULL;
+
+	mmt_bin_sync();
+}
+
+static void write_counts_cb(struct mmt_mmap_data *region, void *arg)
+{
+	mmt_policy_write_counts(region);
+}
+
+void mmt_policy_fini(void)
+{
+	mmt_for_each_region(write_counts_cb, NULL);
+}
+
+static void apply_rule_cb(struct mmt_mmap_data *region, void *arg)
+{
+	const struct rule *r = arg;
+
+	if (rule_matches(r, region))
+		mmt_policy_set(region, r->policy);
+}
+
+static Bool add_runtime_rule(struct rule *r)
+{
+	if (!insert_rule(r, True))
+		return False;
+
+	mmt_for_each_region(apply_rule_cb, r);
+	return True;
+}
+
+static void print_region_cb(struct mmt_mmap_data *region, void *arg)
+{
+	const HChar *path = NULL;
+	UInt i;
+
+	if (region->fd >= 0 && region->fd < FD_SETSIZE)
+		path = fd_paths[region->fd];
+
+	VG_(gdb_printf)("%5u 0x%016lx-0x%016lx fd %d%s%s: %s",
+			region->id, region->start, region->end, region->fd,
+			path ? " " : "", path ? path : "",
+			policy_names[region->policy]);
+	if (region->counts)
+		VG_(gdb_printf)(", %u offsets counted",
+				VG_(HT_count_nodes)(region->counts));
+	for (i = 0; i < region->ranges_num; ++i)
+		VG_(gdb_printf)("%s0x%llx-0x%llx", i ? " " : ", ranges ",
+				region->ranges[i].start, region->ranges[i].end);
+	VG_(gdb_printf)("\n");
+}
+
+static void set_policy_cb(struct mmt_mmap_data *region, void *arg)
+{
+	const int *policy = arg;
+
+	mmt_policy_set(region, *policy);
+}
+
+static void set_policy_by_id_cb(struct mmt_mmap_data *region, void *arg)
+{
+	const UWord *id_policy = arg;
+
+	if (region->id == id_policy[0])
+		mmt_policy_set(region, id_policy[1]);
+}
+
+static void print_monitor_help(void)
+{
+	VG_(gdb_printf)(
+"\n"
+"mmt monitor commands:\n"
+"  regions\n"
+"        shows traced regions and their policies\n"
+"  policy <region id>|all trace|count|ignore\n"
+"        sets policy of traced region(s)\n"
+"  rule <policy>:all|fd=<n>|path=<pattern>|class=<hex>\n"
+"        adds a rule like --mmt-policy, which takes precedence over\n"
+"        existing rules and applies to already mapped regions too\n"
+"\n");
+}
+
+static Bool handle_gdb_monitor_command(ThreadId tid, HChar *req)
+{
+	HChar *wcmd, *arg;
+	HChar s[VG_(strlen)(req) + 1]; /* copy for strtok_r */
+	HChar *ssaveptr;
+
+	VG_(strcpy)(s, req);
+
+	wcmd = VG_(strtok_r)(s, " ", &ssaveptr);
+	switch (VG_(keyword_id)("help regions policy rule", wcmd,
+			kwd_report_duplicated_matches))
+	{
+		case -2: /* multiple matches */
+			return True;
+		case -1: /* not found */
+			return False;
+		case 0: /* help */
+			print_monitor_help();
+			return True;
+		case 1: /* regions */
+			mmt_for_each_region(print_region_cb, NULL);
+			return True;
+		case 2: /* policy */
+		{
+			HChar *region = VG_(strtok_r)(NULL, " ", &ssaveptr);
+			HChar *end;
+			int policy;
+
+			arg = VG_(strtok_r)(NULL, " ", &ssaveptr);
+			policy = arg ? parse_policy(arg, VG_(strlen)(arg)) : -1;
+			if (!region || policy < 0)
+			{
+				VG_(gdb_printf)("usage: policy <region id>|all trace|count|ignore\n");
+				return True;
+			}
+
+			if (VG_(strcmp)(region, "all") == 0)
+				mmt_for_each_region(set_policy_cb, &policy);
+			else
+			{
+				UWord id_policy[2];
+
+				id_policy[0] = VG_(strtoll10)(region, &end);
+				id_policy[1] = policy;
+				if (*end)
+				{
+					VG_(gdb_printf)("invalid region id '%s'\n", region);
+					return True;
+				}
+				mmt_for_each_region(set_policy_by_id_cb, id_policy);
+			}
+			return True;
+		}
+		case 3: /* rule */
+		{
+			struct rule r;
+
+			arg = VG_(strtok_r)(NULL, " ", &ssaveptr);
+			if (!arg || !parse_rule(arg, &r))
+				VG_(gdb_printf)("invalid rule\n");
+			else if (!add_runtime_rule(&r))
+				VG_(gdb_printf)("too many rules\n");
+			return True;
+		}
+	}
+
+	return False;
+}
+
+Bool mmt_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
+{
+	if (!VG_IS_TOOL_USERREQ('M', 'T', args[0]) &&
+			args[0] != VG_USERREQ__GDB_MONITOR_COMMAND)
+		return False;
+
+	switch (args[0])
+	{
+		case VG_USERREQ__MMT_SET_POLICY:
+		{
+			struct mmt_mmap_data *region = find_mmap(args[1]);
+
+			if (!region || args[2] > MMT_POLICY_IGNORE)
+			{
+				*ret = -1;
+				break;
+			}
+
+			mmt_policy_set(region, args[2]);
+			*ret = 0;
+			break;
+		}
+		case VG_USERREQ__MMT_SET_FD_POLICY:
+		{
+			struct rule r = { .policy = args[2], .sel = SEL_FD, .value = args[1] };
+
+			if (args[2] > MMT_POLICY_IGNORE || !add_runtime_rule(&r))
+				*ret = -1;
+			else
+				*ret = 0;
+			break;
+		}
+		case VG_USERREQ__MMT_TRACE_RANGE:
+		{
+			struct mmt_mmap_data *region = find_mmap(args[1]);
+
+			if (!region || args[2] == 0)
+			{
+				*ret = -1;
+				break;
+			}
+
+			add_range(region, args[1] - region->start,
+					args[1] - region->start + args[2]);
+			*ret = 0;
+			break;
+		}
+		case VG_USERREQ__GDB_MONITOR_COMMAND:
+			*ret = handle_gdb_monitor_command(tid, (HChar *)args[1]);
+			return *ret;
+		default:
+			return False;
+	}
+
+	return True;
+}
@@ -0,0 +1,33 @@
+#ifndef MMT_POLICY_H_
+#define MMT_POLICY_H_
+
+#include "pub_tool_basics.h"
+
+#include "mmt.h"
+#include "mmt_trace.h"
+
+#define MMT_MAX_POLICY_RULES 32
+#define MMT_MAX_RANGE_RULES 32
+
+/* nvrm object classes are tracked only when some rule needs them */
+extern int mmt_policy_need_classes;
+
+Bool mmt_policy_add_rule(const HChar *spec);
+Bool mmt_policy_add_range(const HChar *spec);
+
+void mmt_policy_open(int fd, const HChar *path);
+void mmt_policy_dup(int oldfd, int newfd);
+void mmt_policy_close(int fd);
+const HChar *mmt_policy_fd_path(int fd);
+
+void mmt_policy_map(struct mmt_mmap_data *region);
+void mmt_policy_unmap(struct mmt_mmap_data *region);
+void mmt_policy_set(struct mmt_mmap_data *region, int policy);
+
+void mmt_policy_count(struct mmt_mmap_data *region, UChar type, Addr addr);
+void mmt_policy_write_counts(struct mmt_mmap_data *region);
+void mmt_policy_fini(void);
+
+Bool mmt_handle_client_request(ThreadId tid, UWord *args, UWord *ret);
+
+#endif /* MMT_POLICY_H_ */
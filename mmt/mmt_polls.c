@@ -0,0 +1,429 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Finds polling loops in a binary trace: consecutive reads of the same
+ * offset returning the same value are collapsed into "polled N times over
+ * T" entries, and offsets are listed by the time spent polling them.
+ *
+ * Time comes from traces written with --mmt-timestamps. For compact access
+ * records (--mmt-trace-format=2) every run of repeated reads has the exact
+ * time of its 'p' record. Otherwise a loop is timed by the 'T' records
+ * around it, which gives an upper bound (marked with '<').
+ *
+ * Usage: mmt-polls [-a] [-m min-polls] [-n top] trace
+ *   -a  list every polling loop, in trace order
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmt_reader.h"
+
+#define NO_TIME (~0ULL)
+
+struct loop
+{
+	unsigned int region;
+	unsigned long long offset;
+	unsigned char data[128];
+	unsigned int len;
+
+	/* reads after the first one */
+	unsigned long long polls;
+
+	/* from 'p' records */
+	unsigned long long first, end;
+	/* from 'T' records, if there are no 'p' records */
+	unsigned long long before, after;
+};
+
+struct hotspot
+{
+	int used;
+	unsigned int region;
+	unsigned long long offset;
+
+	unsigned long long loops;
+	unsigned long long polls;
+	/* loops with known time */
+	unsigned long long timed;
+	unsigned long long ns;
+	unsigned long long longest_ns;
+	/* some of the times are upper bounds */
+	int bound;
+};
+
+static int list_all;
+static unsigned long long min_polls = 1;
+static unsigned int top = 32;
+
+static struct hotspot *hotspots;
+static size_t hotspots_size, hotspots_num;
+
+/* loop which may still continue */
+static struct loop cur;
+static int cur_valid;
+
+/* loops which ended, waiting for the next 'T' */
+static struct loop *pending;
+static size_t pending_num, pending_size;
+
+static unsigned long long last_time = NO_TIME;
+
+static size_t hash(unsigned int region, unsigned long long offset)
+{
+	return (offset * 0x9e3779b97f4a7c15ULL + region) >> 20;
+}
+
+static struct hotspot *get_hotspot(unsigned int region, unsigned long long offset)
+{
+	struct hotspot *h;
+	size_t i;
+
+	if (hotspots_num * 2 >= hotspots_size)
+	{
+		struct hotspot *old = hotspots;
+		size_t old_size = hotspots_size;
+
+		hotspots_size = old_size ? old_size * 2 : 1024;
+		hotspots = calloc(hotspots_size, sizeof(*hotspots));
+		if (!hotspots)
+		{
+			perror("calloc");
+			exit(1);
+		}
+		for (i = 0; i < old_size; ++i)
+		{
+			if (!old[i].used)
+				continue;
+			h = &hotspots[hash(old[i].region, old[i].offset) & (hotspots_size - 1)];
+			while (h->used)
+				if (++h == hotspots + hotspots_size)
+					h = hotspots;
+			*h = old[i];
+		}
+		free(old);
+	}
+
+	h = &hotspots[hash(region, offset) & (hotspots_size - 1)];
+	while (h->used && (h->region != region || h->offset != offset))
+		if (++h == hotspots + hotspots_size)
+			h = hotspots;
+
+	if (!h->used)
+	{
+		h->used = 1;
+		h->region = region;
+		h->offset = offset;
+		hotspots_num++;
+	}
+
+	return h;
+}
+
+static void print_time(unsigned long long ns, int bound)
+{
+	if (ns == NO_TIME)
+		printf("         -");
+	else
+		printf("%s%9llu.%03llu", bound ? "<" : " ", ns / 1000000,
+				ns / 1000 % 1000);
+}
+
+/* time of the loop in ns, NO_TIME if it is not known */
+static unsigned long long loop_time(const struct loop *l, int *bound)
+{
+	*bound = 0;
+	if (l->first != NO_TIME)
+		return l->end - l->first;
+
+	*bound = 1;
+	if (l->before == NO_TIME || l->after == NO_TIME)
+		return NO_TIME;
+	return l->after - l->before;
+}
+
+static void report_loop(const struct loop *l)
+{
+	unsigned long long ns;
+	struct hotspot *h;
+	unsigned int i;
+	int bound;
+
+	ns = loop_time(l, &bound);
+
+	if (list_all)
+	{
+		printf("region %u offset 0x%08llx value 0x", l->region, l->offset);
+		for (i = l->len; i > 0; --i)
+			printf("%02x", l->data[i - 1]);
+		printf(": polled %llu times over", l->polls);
+		print_time(ns, bound);
+		printf(" ms\n");
+	}
+
+	h = get_hotspot(l->region, l->offset);
+	h->loops++;
+	h->polls += l->polls;
+	if (ns == NO_TIME)
+		return;
+	h->timed++;
+	h->ns += ns;
+	if (ns > h->longest_ns)
+		h->longest_ns = ns;
+	h->bound |= bound;
+}
+
+static void flush_pending(void)
+{
+	size_t i;
+
+	for (i = 0; i < pending_num; ++i)
+	{
+		pending[i].after = last_time;
+		report_loop(&pending[i]);
+	}
+	pending_num = 0;
+}
+
+static void end_loop(void)
+{
+	if (!cur_valid)
+		return;
+	cur_valid = 0;
+
+	if (cur.polls < min_polls)
+		return;
+
+	if (cur.first != NO_TIME)
+	{
+		/* keep the order of loops for -a */
+		flush_pending();
+		report_loop(&cur);
+		return;
+	}
+
+	if (pending_num == pending_size)
+	{
+		pending_size = pending_size ? pending_size * 2 : 64;
+		pending = realloc(pending, pending_size * sizeof(*pending));
+		if (!pending)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+	pending[pending_num++] = cur;
+}
+
+static void trace_access(const struct mmt_access *a, unsigned long long cnt, int repeat)
+{
+	if (a->write)
+	{
+		end_loop();
+		return;
+	}
+
+	if (cur_valid && (repeat ||
+			(a->region == cur.region && a->offset == cur.offset &&
+			 a->len == cur.len && memcmp(a->data, cur.data, a->len) == 0)))
+	{
+		cur.polls += repeat ? cnt : 1;
+		return;
+	}
+
+	end_loop();
+
+	if (a->len > sizeof(cur.data))
+		return;
+
+	cur_valid = 1;
+	cur.region = a->region;
+	cur.offset = a->offset;
+	memcpy(cur.data, a->data, a->len);
+	cur.len = a->len;
+	cur.polls = 0;
+	cur.first = cur.end = NO_TIME;
+	cur.before = last_time;
+}
+
+static void read_trace(const char *name, const unsigned char *data, size_t size)
+{
+	struct mmt_reader_state st;
+	struct mmt_access a;
+	unsigned long long cnt, t;
+	size_t pos = 0;
+	long len;
+
+	mmt_reader_reset(&st);
+
+	while (pos < size)
+	{
+		const unsigned char *p = data + pos;
+
+		len = mmt_record_len(p, size - pos);
+		if (len < 0)
+		{
+			fprintf(stderr, "%s: %s at %zu\n", name, mmt_reader_error(len), pos);
+			if (len == MMT_READER_TRUNCATED)
+				break;
+			exit(1);
+		}
+		pos += len;
+
+		cnt = mmt_decode_access(&st, p, len, &a);
+		if (cnt)
+		{
+			trace_access(&a, cnt, (p[0] & MMT_V2_ACCESS) && (p[0] & MMT_V2_REPEAT));
+			continue;
+		}
+
+		switch (p[0])
+		{
+			case 'T':
+				memcpy(&last_time, p + 5, sizeof(last_time));
+				mmt_reader_reset(&st);
+				flush_pending();
+				break;
+			case 'p':
+				/* closes the repeat record before it */
+				if (!cur_valid)
+					break;
+				memcpy(&t, p + 1, sizeof(t));
+				if (cur.first == NO_TIME)
+					cur.first = t;
+				memcpy(&cur.end, p + 9, sizeof(cur.end));
+				break;
+			case 'v':
+				mmt_reader_reset(&st);
+				/* fall through */
+			default:
+				end_loop();
+				break;
+		}
+	}
+
+	end_loop();
+	last_time = NO_TIME;
+	flush_pending();
+}
+
+static int cmp_hotspots(const void *a, const void *b)
+{
+	const struct hotspot *h1 = a, *h2 = b;
+
+	if (h1->used != h2->used)
+		return h1->used ? -1 : 1;
+	if (h1->ns != h2->ns)
+		return h1->ns > h2->ns ? -1 : 1;
+	if (h1->polls != h2->polls)
+		return h1->polls > h2->polls ? -1 : 1;
+	if (h1->region != h2->region)
+		return h1->region < h2->region ? -1 : 1;
+	return h1->offset < h2->offset ? -1 : h1->offset > h2->offset;
+}
+
+static void report(void)
+{
+	size_t i;
+
+	if (!hotspots_num)
+	{
+		printf("no polling\n");
+		return;
+	}
+
+	qsort(hotspots, hotspots_size, sizeof(*hotspots), cmp_hotspots);
+
+	if (list_all)
+		printf("\n");
+	printf("region  offset          loops        polls     time [ms]  longest [ms]\n");
+	for (i = 0; i < hotspots_num && (!top || i < top); ++i)
+	{
+		struct hotspot *h = &hotspots[i];
+
+		printf("%6u  0x%08llx %10llu %12llu ", h->region, h->offset,
+				h->loops, h->polls);
+		print_time(h->timed ? h->ns : NO_TIME, h->bound);
+		printf(" ");
+		print_time(h->timed ? h->longest_ns : NO_TIME, h->bound);
+		printf("\n");
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-a] [-m min-polls] [-n top] trace\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned char *data = NULL;
+	struct stat st;
+	int fd, c;
+
+	while ((c = getopt(argc, argv, "am:n:")) != -1)
+	{
+		switch (c)
+		{
+			case 'a':
+				list_all = 1;
+				break;
+			case 'm':
+				min_polls = strtoull(optarg, NULL, 0);
+				break;
+			case 'n':
+				top = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	if (st.st_size)
+	{
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	close(fd);
+
+	read_trace(argv[optind], data, st.st_size);
+	report();
+
+	return 0;
+}
@@ -0,0 +1,380 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Access profile (--mmt-profile=file).
+ *
+ * Accesses to traced regions are not written to the trace. Instead, every
+ * offset keeps a number of reads and writes, split by instruction doing
+ * them, and a number of reads which returned the same value as the previous
+ * access (polling). Mappings of the same offset of the same file share
+ * counters, so buffers mapped and unmapped many times show up once.
+ *
+ * At exit the hottest offsets and the longest polling loops are written to
+ * the file as text. Everything else (mmaps, ioctls) is still traced.
+ */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_options.h"
+#include "pub_tool_vki.h"
+
+#include "mmt_policy.h"
+#include "mmt_profile.h"
+#include "mmt_trace_bin.h"
+
+/* instructions listed for each hot offset */
+#define MAX_REPORTED_IAS 4
+
+struct ia_count
+{
+	struct ia_count *next;
+	Addr inst_addr;
+
+	ULong reads;
+	ULong writes;
+};
+
+struct offset_profile
+{
+	/* VgHashNode */
+	struct offset_profile *next;
+	UWord offset;
+
+	struct mmt_profile_area *area;
+
+	ULong reads;
+	ULong writes;
+	/* reads returning the same value as the previous access */
+	ULong polls;
+	ULong poll_ms;
+
+	/* most recently used first */
+	struct ia_count *ias;
+};
+
+struct mmt_profile_area
+{
+	struct mmt_profile_area *next;
+	UInt id;
+
+	int fd;
+	HChar *path;
+	Off64T offset;
+	UWord size;
+	UInt maps;
+
+	VgHashTable *offsets;
+};
+
+int mmt_profile = False;
+HChar *mmt_profile_file = NULL;
+UInt mmt_profile_top = 32;
+
+static struct mmt_profile_area *areas, **areas_tail = &areas;
+static UInt areas_num;
+
+/* last read, as long as it may be a part of a polling loop */
+static struct
+{
+	struct offset_profile *o;
+	UChar data[32];
+	UInt len;
+
+	UInt polls;
+	UInt start;
+} poll;
+
+void mmt_profile_map(struct mmt_mmap_data *region)
+{
+	const HChar *path = mmt_policy_fd_path(region->fd);
+	struct mmt_profile_area *area;
+
+	for (area = areas; area; area = area->next)
+	{
+		if (area->fd != region->fd || area->offset != region->offset)
+			continue;
+		if (path ? area->path && VG_(strcmp)(path, area->path) == 0 : !area->path)
+			break;
+	}
+
+	if (!area)
+	{
+		area = VG_(calloc)("mmt.profile.area", 1, sizeof(*area));
+		area->id = ++areas_num;
+		area->fd = region->fd;
+		if (path)
+			area->path = VG_(strdup)("mmt.profile.path", path);
+		area->offset = region->offset;
+		area->offsets = VG_(HT_construct)("mmt.profile.offsets");
+
+		*areas_tail = area;
+		areas_tail = &area->next;
+	}
+
+	if (region->end - region->start > area->size)
+		area->size = region->end - region->start;
+	area->maps++;
+
+	region->profile = area;
+}
+
+static void end_poll(void)
+{
+	if (poll.polls)
+		poll.o->poll_ms += VG_(read_millisecond_timer)() - poll.start;
+
+	poll.o = NULL;
+	poll.polls = 0;
+}
+
+void mmt_profile_access(struct mmt_mmap_data *region, UChar type, Addr addr,
+		const UChar *data, UInt len, Addr inst_addr)
+{
+	struct mmt_profile_area *area = region->profile;
+	UWord offset = addr - region->start;
+	struct offset_profile *o;
+	struct ia_count *ia, **p;
+
+	o = VG_(HT_lookup)(area->offsets, offset);
+	if (UNLIKELY(!o))
+	{
+		o = VG_(calloc)("mmt.profile.offset", 1, sizeof(*o));
+		o->offset = offset;
+		o->area = area;
+		VG_(HT_add_node)(area->offsets, o);
+	}
+
+	if (type == 'w')
+		o->writes++;
+	else
+		o->reads++;
+
+	if (inst_addr)
+	{
+		for (p = &o->ias; (ia = *p) != NULL; p = &ia->next)
+			if (ia->inst_addr == inst_addr)
+				break;
+
+		if (ia)
+			*p = ia->next;
+		else
+		{
+			ia = VG_(calloc)("mmt.profile.ia", 1, sizeof(*ia));
+			ia->inst_addr = inst_addr;
+		}
+		ia->next = o->ias;
+		o->ias = ia;
+
+		if (type == 'w')
+			ia->writes++;
+		else
+			ia->reads++;
+	}
+
+	if (type == 'r' && o == poll.o && len == poll.len &&
+			VG_(memcmp)(data, poll.data, len) == 0)
+	{
+		/* time of the first read is lost, but it is not worth a syscall
+		 * for every read */
+		if (poll.polls++ == 0)
+			poll.start = VG_(read_millisecond_timer)();
+		o->polls++;
+		return;
+	}
+
+	end_poll();
+
+	if (type == 'r' && len <= sizeof(poll.data))
+	{
+		poll.o = o;
+		VG_(memcpy)(poll.data, data, len);
+		poll.len = len;
+	}
+}
+
+static int report_fd;
+
+static void PRINTF_CHECK(1, 2) out(const HChar *format, ...)
+{
+	HChar buf[512];
+	va_list vargs;
+
+	va_start(vargs, format);
+	VG_(vsnprintf)(buf, sizeof(buf), format, vargs);
+	va_end(vargs);
+
+	VG_(write)(report_fd, buf, VG_(strlen)(buf));
+}
+
+static Int cmp_accesses(const void *a, const void *b)
+{
+	const struct offset_profile *o1 = *(const struct offset_profile * const *)a;
+	const struct offset_profile *o2 = *(const struct offset_profile * const *)b;
+	ULong n1 = o1->reads + o1->writes, n2 = o2->reads + o2->writes;
+
+	if (n1 != n2)
+		return n1 > n2 ? -1 : 1;
+	if (o1->area->id != o2->area->id)
+		return o1->area->id < o2->area->id ? -1 : 1;
+	return o1->offset < o2->offset ? -1 : o1->offset > o2->offset;
+}
+
+static Int cmp_polls(const void *a, const void *b)
+{
+	const struct offset_profile *o1 = *(const struct offset_profile * const *)a;
+	const struct offset_profile *o2 = *(const struct offset_profile * const *)b;
+
+	if (o1->poll_ms != o2->poll_ms)
+		return o1->poll_ms > o2->poll_ms ? -1 : 1;
+	if (o1->polls != o2->polls)
+		return o1->polls > o2->polls ? -1 : 1;
+	return cmp_accesses(a, b);
+}
+
+static Int cmp_ias(const void *a, const void *b)
+{
+	const struct ia_count *i1 = *(const struct ia_count * const *)a;
+	const struct ia_count *i2 = *(const struct ia_count * const *)b;
+	ULong n1 = i1->reads + i1->writes, n2 = i2->reads + i2->writes;
+
+	if (n1 != n2)
+		return n1 > n2 ? -1 : 1;
+	return i1->inst_addr < i2->inst_addr ? -1 : i1->inst_addr > i2->inst_addr;
+}
+
+static void report_ias(const struct offset_profile *o)
+{
+	struct ia_count *ia, **ias;
+	HChar namestr[256];
+	UInt n = 0, i;
+
+	for (ia = o->ias; ia; ia = ia->next)
+		n++;
+	if (!n)
+		return;
+
+	ias = VG_(malloc)("mmt.profile.report", n * sizeof(ias[0]));
+	for (ia = o->ias, i = 0; ia; ia = ia->next)
+		ias[i++] = ia;
+	VG_(ssort)(ias, n, sizeof(ias[0]), cmp_ias);
+
+	for (i = 0; i < n && i < MAX_REPORTED_IAS; ++i)
+	{
+		mydescribe(ias[i]->inst_addr, namestr, sizeof(namestr));
+		out("%18s %10llu %10llu  %s\n", "",
+				ias[i]->reads, ias[i]->writes, namestr);
+	}
+	if (n > MAX_REPORTED_IAS)
+		out("%18s %u more instructions\n", "", n - MAX_REPORTED_IAS);
+
+	VG_(free)(ias);
+}
+
+static void report(struct offset_profile **all, UInt n)
+{
+	struct mmt_profile_area *area;
+	ULong reads = 0, writes = 0;
+	UInt i, shown;
+
+	for (i = 0; i < n; ++i)
+	{
+		reads += all[i]->reads;
+		writes += all[i]->writes;
+	}
+
+	out("mmt access profile: %llu reads, %llu writes, %u offsets\n\n",
+			reads, writes, n);
+
+	out("area  fd  file offset         size        maps  file\n");
+	for (area = areas; area; area = area->next)
+		out("%4u %3d  0x%016llx  0x%08lx %5u  %s\n", area->id, area->fd,
+				(ULong)area->offset, area->size, area->maps,
+				area->path ? area->path : "?");
+
+	VG_(ssort)(all, n, sizeof(all[0]), cmp_accesses);
+
+	out("\nhottest offsets:\n");
+	out("area  offset           reads     writes\n");
+	for (i = 0; i < n && (!mmt_profile_top || i < mmt_profile_top); ++i)
+	{
+		out("%4u  0x%08lx %12llu %10llu\n", all[i]->area->id,
+				all[i]->offset, all[i]->reads, all[i]->writes);
+		report_ias(all[i]);
+	}
+
+	VG_(ssort)(all, n, sizeof(all[0]), cmp_polls);
+
+	out("\npolling (reads returning the same value as the previous access):\n");
+	out("area  offset\n");
+	for (i = 0, shown = 0; i < n && all[i]->polls &&
+			(!mmt_profile_top || shown < mmt_profile_top); ++i, ++shown)
+		out("%4u  0x%08lx  polled %llu times over %llu.%03llu s\n",
+				all[i]->area->id, all[i]->offset, all[i]->polls,
+				all[i]->poll_ms / 1000, all[i]->poll_ms % 1000);
+	if (!shown)
+		out("none\n");
+}
+
+void mmt_profile_fini(void)
+{
+	struct mmt_profile_area *area;
+	struct offset_profile **all;
+	VgHashNode **nodes;
+	UInt n = 0, cnt, i;
+	HChar *name;
+	SysRes r;
+
+	if (!mmt_profile)
+		return;
+
+	end_poll();
+
+	for (area = areas; area; area = area->next)
+		n += VG_(HT_count_nodes)(area->offsets);
+
+	all = VG_(malloc)("mmt.profile.report", (n ? n : 1) * sizeof(all[0]));
+	n = 0;
+	for (area = areas; area; area = area->next)
+	{
+		nodes = VG_(HT_to_array)(area->offsets, &cnt);
+		for (i = 0; i < cnt; ++i)
+			all[n++] = (struct offset_profile *)nodes[i];
+		VG_(free)(nodes);
+	}
+
+	name = VG_(expand_file_name)("--mmt-profile", mmt_profile_file);
+	r = VG_(open)(name, VKI_O_CREAT | VKI_O_WRONLY | VKI_O_TRUNC, 0644);
+	if (sr_isError(r))
+		VG_(message)(Vg_UserMsg, "cannot open profile file %s\n", name);
+	else
+	{
+		report_fd = sr_Res(r);
+		report(all, n);
+		VG_(close)(report_fd);
+	}
+
+	VG_(free)(name);
+	VG_(free)(all);
+}
@@ -0,0 +1,17 @@
+#ifndef MMT_PROFILE_H_
+#define MMT_PROFILE_H_
+
+#include "pub_tool_basics.h"
+
+#include "mmt_trace.h"
+
+extern int mmt_profile;
+extern HChar *mmt_profile_file;
+extern UInt mmt_profile_top;
+
+void mmt_profile_map(struct mmt_mmap_data *region);
+void mmt_profile_access(struct mmt_mmap_data *region, UChar type, Addr addr,
+		const UChar *data, UInt len, Addr inst_addr);
+void mmt_profile_fini(void);
+
+#endif /* MMT_PROFILE_H_ */
@@ -0,0 +1,279 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include <string.h>
+
+#include "mmt_reader.h"
+
+static const unsigned char *rec;
+static size_t rec_avail, rec_pos;
+
+static int need(size_t n)
+{
+	if (rec_pos + n > rec_avail)
+		return -1;
+	rec_pos += n;
+	return 0;
+}
+
+static unsigned int get4(size_t pos)
+{
+	return rec[pos] | (rec[pos + 1] << 8) | (rec[pos + 2] << 16) |
+			((unsigned int)rec[pos + 3] << 24);
+}
+
+static int buffer(void)
+{
+	size_t pos = rec_pos;
+
+	if (need(4))
+		return -1;
+	return need(get4(pos));
+}
+
+static int varint(unsigned long long *val)
+{
+	int shift = 0;
+
+	*val = 0;
+	do
+	{
+		if (rec_pos >= rec_avail)
+			return -1;
+		*val |= (unsigned long long)(rec[rec_pos] & 0x7f) << shift;
+		shift += 7;
+	}
+	while (rec[rec_pos++] & 0x80);
+
+	return 0;
+}
+
+static int compact_access(void)
+{
+	unsigned char hdr = rec[0];
+	unsigned long long size, tmp, cnt;
+
+	if (hdr & MMT_V2_REPEAT)
+		return varint(&tmp);
+
+	size = 1ULL << ((hdr >> MMT_V2_SIZE_SHIFT) & 7);
+	if (((hdr >> MMT_V2_SIZE_SHIFT) & 7) == MMT_V2_SIZE_VAR && varint(&size))
+		return -1;
+	if ((hdr & MMT_V2_REGION) && varint(&tmp))
+		return -1;
+	if (varint(&tmp))
+		return -1;
+	if (hdr & MMT_V2_RANGE)
+	{
+		if (varint(&cnt) || varint(&tmp))
+			return -1;
+		size *= cnt;
+	}
+	return need(size);
+}
+
+long mmt_record_len(const unsigned char *p, size_t avail)
+{
+	int r;
+
+	rec = p;
+	rec_avail = avail;
+	rec_pos = 1;
+
+	if (p[0] & MMT_V2_ACCESS)
+		return compact_access() ? MMT_READER_TRUNCATED : (long)rec_pos;
+
+	switch (p[0])
+	{
+		case '=':
+		case '-':
+		{
+			const unsigned char *nl = memchr(p, '\n', avail);
+			return nl ? nl - p + 1 : MMT_READER_TRUNCATED;
+		}
+		case 'r': case 'w':
+		case 'R': case 'W':
+			/* region id and offset or address, then size */
+			r = need(9) || need(rec[9]);
+			break;
+		case 'M':
+			r = need(8 + 4 * 4 + 8 + 8);
+			break;
+		case 'u':
+			r = need(8 + 4 + 8 * 4);
+			break;
+		case 'e':
+			r = need(8 + 4 + 8 * 6);
+			break;
+		case 'd':
+		case 'c':
+			r = need(8) || (p[0] == 'c' && need(16));
+			break;
+		case 'o':
+			r = need(12) || buffer();
+			break;
+		case 'i':
+			r = need(8) || buffer();
+			break;
+		case 'j':
+			r = need(24) || buffer();
+			break;
+		case 'y':
+			r = need(8) || buffer();
+			break;
+		case 'Y':
+			r = need(12);
+			break;
+		case 'b':
+		case 't':
+			r = need(4) || buffer();
+			break;
+		case 's':
+		case 'x':
+			r = buffer();
+			break;
+		case 'S':
+		case 'v':
+			r = need(4);
+			break;
+		case 'n':
+			r = need(1) || buffer();
+			break;
+		case 'T':
+			r = need(12);
+			break;
+		case 'p':
+			r = need(16);
+			break;
+		case 'z':
+			return MMT_READER_COMPRESSED;
+		default:
+			return MMT_READER_UNKNOWN;
+	}
+
+	if (r || need(1))
+		return MMT_READER_TRUNCATED;
+	if (rec[rec_pos - 1] != '\n')
+		return MMT_READER_CORRUPTED;
+
+	return rec_pos;
+}
+
+const char *mmt_reader_error(long err)
+{
+	switch (err)
+	{
+		case MMT_READER_TRUNCATED:
+			return "truncated record";
+		case MMT_READER_CORRUPTED:
+			return "corrupted record";
+		case MMT_READER_UNKNOWN:
+			return "unknown record";
+		case MMT_READER_COMPRESSED:
+			return "compressed trace, unpack it first (mmt-unpack)";
+	}
+	return "?";
+}
+
+void mmt_reader_reset(struct mmt_reader_state *st)
+{
+	st->valid = 0;
+}
+
+unsigned long long mmt_decode_access(struct mmt_reader_state *st,
+		const unsigned char *p, long len, struct mmt_access *a)
+{
+	unsigned long long size, val, cnt;
+	unsigned char hdr = p[0];
+	long long delta;
+
+	rec = p;
+	rec_avail = len;
+	rec_pos = 1;
+
+	if (hdr == 'r' || hdr == 'w')
+	{
+		a->write = hdr == 'w';
+		a->region = get4(1);
+		a->offset = get4(5);
+		a->len = p[9];
+		a->data = p + 10;
+		a->range = 0;
+		a->stride = 0;
+		return 1;
+	}
+	if (hdr == 'R' || hdr == 'W')
+	{
+		a->write = hdr == 'W';
+		a->region = 0;
+		a->offset = get4(1) | (unsigned long long)get4(5) << 32;
+		a->len = p[9];
+		a->data = p + 10;
+		a->range = 0;
+		a->stride = 0;
+		return 1;
+	}
+	if (!(hdr & MMT_V2_ACCESS))
+		return 0;
+
+	if (hdr & MMT_V2_REPEAT)
+	{
+		varint(&val);
+		*a = st->last;
+		return val;
+	}
+
+	size = 1ULL << ((hdr >> MMT_V2_SIZE_SHIFT) & 7);
+	if (((hdr >> MMT_V2_SIZE_SHIFT) & 7) == MMT_V2_SIZE_VAR)
+		varint(&size);
+	if (hdr & MMT_V2_REGION)
+	{
+		varint(&val);
+		st->last.region = val;
+		st->last.offset = 0;
+	}
+	varint(&val);
+	delta = (long long)(val >> 1) ^ -(long long)(val & 1);
+
+	st->valid = 1;
+	st->last.write = !!(hdr & MMT_V2_WRITE);
+	st->last.offset += delta;
+	st->last.len = size;
+	st->last.range = 0;
+	st->last.stride = 0;
+
+	if (!(hdr & MMT_V2_RANGE))
+	{
+		st->last.data = p + rec_pos;
+		*a = st->last;
+		return 1;
+	}
+
+	varint(&cnt);
+	varint(&val);
+	*a = st->last;
+	a->range = 1;
+	a->stride = (long long)(val >> 1) ^ -(long long)(val & 1);
+	a->data = p + rec_pos;
+
+	/* the next record continues from the last write */
+	st->last.offset += (cnt - 1) * a->stride;
+	st->last.data = a->data + (cnt - 1) * size;
+	return cnt;
+}
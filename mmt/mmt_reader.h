@@ -0,0 +1,63 @@
+#ifndef MMT_READER_H_
+#define MMT_READER_H_
+
+#include <stddef.h>
+
+/*
+ * Reading of binary traces, for tools running outside of valgrind
+ * (mmt-merge, mmt-polls). See mmt_trace.c for the list of records.
+ */
+
+/* compact access records, as in mmt_trace_bin.h */
+#define MMT_V2_ACCESS		0x80
+#define MMT_V2_WRITE		0x40
+#define MMT_V2_SIZE_SHIFT	3
+#define MMT_V2_SIZE_VAR		7
+#define MMT_V2_REGION		0x04
+#define MMT_V2_REPEAT		0x02
+#define MMT_V2_RANGE		0x01
+
+#define MMT_READER_TRUNCATED	-1
+#define MMT_READER_CORRUPTED	-2
+#define MMT_READER_UNKNOWN	-3
+#define MMT_READER_COMPRESSED	-4
+
+/* returns the length of the record at p (of at most avail bytes) or one of
+ * MMT_READER_* */
+long mmt_record_len(const unsigned char *p, size_t avail);
+
+const char *mmt_reader_error(long err);
+
+struct mmt_access
+{
+	int write;
+	/* 0 for accesses outside of traced regions, offset is the address then */
+	unsigned int region;
+	unsigned long long offset;
+	const unsigned char *data;
+	unsigned int len;
+
+	/* range of writes: access i is at offset + i * stride, with data at
+	 * data + i * len */
+	int range;
+	long long stride;
+};
+
+/* state of compact access records */
+struct mmt_reader_state
+{
+	int valid;
+	struct mmt_access last;
+};
+
+/* for 'v' and 'T' records */
+void mmt_reader_reset(struct mmt_reader_state *st);
+
+/* Decodes an access record (p and len as returned by mmt_record_len).
+ * Returns the number of accesses it stands for - more than one for
+ * repetitions of the previous read and for ranges - or 0 if it is not an
+ * access. */
+unsigned long long mmt_decode_access(struct mmt_reader_state *st,
+		const unsigned char *p, long len, struct mmt_access *a);
+
+#endif /* MMT_READER_H_ */
@@ -0,0 +1,596 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Replays a binary trace against a device model (see mmt_replay.h):
+ * opens, mmaps, memory writes and ioctls are passed to the model, memory
+ * reads and ioctl results it returns are compared with the traced ones.
+ * Trace is read sequentially, so it can come from a pipe (mmt-unpack,
+ * mmt-ring-cat).
+ *
+ * Without -d accesses are only counted. "-d ram" is a built-in model of
+ * plain memory: reads return what was written before, or the traced value
+ * if nothing was.
+ *
+ * Usage: mmt-replay [-d model.so[:args]] [-m max-errors] [-q] trace|-
+ * Exit status is 1 if the model did not reproduce the trace.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmt_reader.h"
+#include "mmt_replay.h"
+
+#define BUF_SIZE (1 << 20)
+
+static const struct mmt_replay_model *model;
+static void *model_priv;
+
+static unsigned long long max_errors = 10;
+static int quiet;
+
+static struct
+{
+	unsigned long long reads, writes, ioctls, mmaps, syncs;
+	unsigned long long bad_reads, bad_ioctls;
+} stats;
+
+/* copy of the data of the last compact access, for repeat records */
+static unsigned char *last_data;
+static size_t last_data_size;
+
+static unsigned char *tmp;
+static size_t tmp_size;
+
+/* ioctl argument from 'i' record, waiting for 'j' */
+static unsigned char *ioctl_data;
+static size_t ioctl_data_size;
+static unsigned int ioctl_len;
+static long long ioctl_res;
+static int ioctl_pending;
+
+static void *grow(void *ptr, size_t *size, size_t need)
+{
+	if (need <= *size)
+		return ptr;
+
+	while (*size < need)
+		*size = *size ? *size * 2 : 256;
+	ptr = realloc(ptr, *size);
+	if (!ptr)
+	{
+		perror("realloc");
+		exit(1);
+	}
+	return ptr;
+}
+
+static unsigned int get4(const unsigned char *p)
+{
+	unsigned int v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned long long get8(const unsigned char *p)
+{
+	unsigned long long v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void print_value(const unsigned char *data, unsigned int len)
+{
+	unsigned int i;
+
+	printf("0x");
+	for (i = len; i > 0; --i)
+		printf("%02x", data[i - 1]);
+}
+
+/* called after every mismatch, returns whether to print it */
+static int report_mismatch(void)
+{
+	unsigned long long n = stats.bad_reads + stats.bad_ioctls;
+
+	if (quiet)
+		return 0;
+	if (n == max_errors + 1)
+		printf("too many errors, not reporting more\n");
+	return n <= max_errors;
+}
+
+static void replay_access(const struct mmt_access *a, unsigned long long cnt,
+		unsigned long long pos)
+{
+	if (a->write)
+	{
+		unsigned long long i;
+
+		stats.writes += cnt;
+		if (model && model->write)
+			for (i = 0; i < cnt; ++i)
+				model->write(model_priv, a->region, a->offset + i * a->stride,
+						a->data + (a->range ? i * a->len : 0), a->len);
+		return;
+	}
+
+	stats.reads += cnt;
+	if (!model || !model->read)
+		return;
+
+	tmp = grow(tmp, &tmp_size, a->len);
+	while (cnt--)
+	{
+		memcpy(tmp, a->data, a->len);
+		model->read(model_priv, a->region, a->offset, tmp, a->len);
+		if (memcmp(tmp, a->data, a->len) == 0)
+			continue;
+
+		stats.bad_reads++;
+		if (report_mismatch())
+		{
+			printf("%llu: read of region %u offset 0x%08llx returned ", pos,
+					a->region, a->offset);
+			print_value(tmp, a->len);
+			printf(", traced ");
+			print_value(a->data, a->len);
+			printf("\n");
+		}
+	}
+}
+
+static void ioctl_pre(const unsigned char *p)
+{
+	int fd = get4(p + 1);
+	unsigned int id = get4(p + 5);
+	unsigned int len = get4(p + 9);
+
+	stats.ioctls++;
+	ioctl_pending = 0;
+	if (!model || !model->ioctl)
+		return;
+
+	ioctl_data = grow(ioctl_data, &ioctl_data_size, len);
+	memcpy(ioctl_data, p + 13, len);
+	ioctl_len = len;
+	ioctl_res = model->ioctl(model_priv, fd, id, ioctl_data, len);
+	ioctl_pending = 1;
+}
+
+static void ioctl_post(const unsigned char *p, unsigned long long pos)
+{
+	unsigned int id = get4(p + 5);
+	unsigned long long res = get8(p + 9), err = get8(p + 17);
+	unsigned int len = get4(p + 25);
+	long long expected = err ? -(long long)err : (long long)res;
+
+	if (!ioctl_pending)
+		return;
+	ioctl_pending = 0;
+
+	if (ioctl_res == expected && len == ioctl_len &&
+			memcmp(ioctl_data, p + 29, len) == 0)
+		return;
+
+	stats.bad_ioctls++;
+	if (report_mismatch())
+	{
+		if (ioctl_res != expected)
+			printf("%llu: ioctl 0x%08x returned %lld, traced %lld\n", pos,
+					id, ioctl_res, expected);
+		else
+			printf("%llu: ioctl 0x%08x argument differs from the traced one\n",
+					pos, id);
+	}
+}
+
+static void replay_record(const unsigned char *p, unsigned long long pos)
+{
+	switch (p[0])
+	{
+		case 'o':
+			if (model && model->open)
+				model->open(model_priv, get4(p + 9), (const char *)p + 17);
+			break;
+		case 'd':
+			if (model && model->dup)
+				model->dup(model_priv, get4(p + 1), get4(p + 5));
+			break;
+		case 'M':
+			stats.mmaps++;
+			if (model && model->mmap)
+				model->mmap(model_priv, get4(p + 21), get4(p + 17), get8(p + 1),
+						get8(p + 33));
+			break;
+		case 'u':
+			if (model && model->munmap)
+				model->munmap(model_priv, get4(p + 9));
+			break;
+		case 'e':
+			/* mremap keeps the region id and file offset */
+			if (model && model->munmap)
+				model->munmap(model_priv, get4(p + 9));
+			if (model && model->mmap)
+				model->mmap(model_priv, get4(p + 9), -1, get8(p + 1), get8(p + 53));
+			break;
+		case 'i':
+			ioctl_pre(p);
+			break;
+		case 'j':
+			ioctl_post(p, pos);
+			break;
+		case 'S':
+			stats.syncs++;
+			if (model && model->sync)
+				model->sync(model_priv, get4(p + 1));
+			break;
+	}
+}
+
+/* Returns 0 on success. */
+static int replay(const char *name, int fd)
+{
+	struct mmt_reader_state st;
+	struct mmt_access a;
+	unsigned char *buf;
+	size_t size = BUF_SIZE, start = 0, end = 0;
+	unsigned long long base = 0, cnt;
+	int eof = 0;
+	long len;
+
+	buf = malloc(size);
+	if (!buf)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	mmt_reader_reset(&st);
+
+	for (;;)
+	{
+		const unsigned char *p = buf + start;
+
+		len = start < end ? mmt_record_len(p, end - start) : MMT_READER_TRUNCATED;
+		if (len == MMT_READER_TRUNCATED)
+		{
+			ssize_t r;
+
+			if (eof)
+				break;
+
+			/* keep the incomplete record and read more */
+			memmove(buf, buf + start, end - start);
+			base += start;
+			end -= start;
+			start = 0;
+			if (end == size)
+			{
+				size *= 2;
+				buf = realloc(buf, size);
+				if (!buf)
+				{
+					perror("realloc");
+					exit(1);
+				}
+			}
+
+			r = read(fd, buf + end, size - end);
+			if (r < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				perror(name);
+				return 1;
+			}
+			if (r == 0)
+				eof = 1;
+			end += r;
+			continue;
+		}
+		if (len < 0)
+		{
+			fprintf(stderr, "%s: %s at %llu\n", name, mmt_reader_error(len),
+					base + start);
+			return 1;
+		}
+
+		cnt = mmt_decode_access(&st, p, len, &a);
+		if (cnt)
+		{
+			if ((p[0] & MMT_V2_ACCESS) && !(p[0] & MMT_V2_REPEAT))
+			{
+				/* the buffer can move before the repeat record */
+				last_data = grow(last_data, &last_data_size, st.last.len);
+				memcpy(last_data, st.last.data, st.last.len);
+				st.last.data = last_data;
+			}
+			replay_access(&a, cnt, base + start);
+		}
+		else if (p[0] == 'v' || p[0] == 'T')
+			mmt_reader_reset(&st);
+		else
+			replay_record(p, base + start);
+
+		start += len;
+	}
+
+	if (start < end)
+		fprintf(stderr, "%s: truncated record at %llu\n", name, base + start);
+	free(buf);
+
+	return 0;
+}
+
+/*
+ * Built-in "ram" model: sparse memory, 4kB pages per region.
+ */
+
+struct ram_page
+{
+	struct ram_page *next;
+	unsigned int region;
+	unsigned long long index;
+	unsigned char data[4096];
+	unsigned char valid[4096 / 8];
+};
+
+#define RAM_HASH_SIZE 4096
+
+struct ram
+{
+	struct ram_page *hash[RAM_HASH_SIZE];
+};
+
+static void *ram_init(const char *args)
+{
+	struct ram *ram = calloc(1, sizeof(*ram));
+
+	(void)args;
+	if (!ram)
+	{
+		perror("calloc");
+		exit(1);
+	}
+	return ram;
+}
+
+static void ram_fini(void *priv)
+{
+	struct ram *ram = priv;
+	struct ram_page *pg, *next;
+	unsigned int i;
+
+	for (i = 0; i < RAM_HASH_SIZE; ++i)
+		for (pg = ram->hash[i]; pg; pg = next)
+		{
+			next = pg->next;
+			free(pg);
+		}
+	free(ram);
+}
+
+static struct ram_page *ram_page(struct ram *ram, unsigned int region,
+		unsigned long long index, int create)
+{
+	struct ram_page **head, *pg;
+
+	head = &ram->hash[(index * 31 + region) & (RAM_HASH_SIZE - 1)];
+	for (pg = *head; pg; pg = pg->next)
+		if (pg->region == region && pg->index == index)
+			return pg;
+
+	if (!create)
+		return NULL;
+
+	pg = calloc(1, sizeof(*pg));
+	if (!pg)
+	{
+		perror("calloc");
+		exit(1);
+	}
+	pg->region = region;
+	pg->index = index;
+	pg->next = *head;
+	*head = pg;
+	return pg;
+}
+
+static void ram_munmap(void *priv, unsigned int region)
+{
+	struct ram *ram = priv;
+	struct ram_page **pp, *pg;
+	unsigned int i;
+
+	/* region ids are reused */
+	for (i = 0; i < RAM_HASH_SIZE; ++i)
+		for (pp = &ram->hash[i]; (pg = *pp); )
+		{
+			if (pg->region == region)
+			{
+				*pp = pg->next;
+				free(pg);
+			}
+			else
+				pp = &pg->next;
+		}
+}
+
+static void ram_write(void *priv, unsigned int region, unsigned long long offset,
+		const void *data, unsigned int len)
+{
+	const unsigned char *d = data;
+	struct ram_page *pg = NULL;
+	unsigned int i;
+
+	for (i = 0; i < len; ++i, ++offset)
+	{
+		unsigned int o = offset & 4095;
+
+		if (!pg || o == 0)
+			pg = ram_page(priv, region, offset >> 12, 1);
+		pg->data[o] = d[i];
+		pg->valid[o / 8] |= 1 << (o % 8);
+	}
+}
+
+static void ram_read(void *priv, unsigned int region, unsigned long long offset,
+		void *data, unsigned int len)
+{
+	unsigned char *d = data;
+	struct ram_page *pg = NULL;
+	unsigned int i;
+
+	for (i = 0; i < len; ++i, ++offset)
+	{
+		unsigned int o = offset & 4095;
+
+		if (i == 0 || o == 0)
+			pg = ram_page(priv, region, offset >> 12, 0);
+		if (pg && (pg->valid[o / 8] & (1 << (o % 8))))
+			d[i] = pg->data[o];
+	}
+}
+
+static const struct mmt_replay_model ram_model =
+{
+	.version = MMT_REPLAY_MODEL_VERSION,
+	.name = "ram",
+	.init = ram_init,
+	.fini = ram_fini,
+	.munmap = ram_munmap,
+	.write = ram_write,
+	.read = ram_read,
+};
+
+static void load_model(char *spec)
+{
+	const struct mmt_replay_model *(*get)(void);
+	char *args = strchr(spec, ':');
+	void *lib;
+
+	if (args)
+		*args++ = 0;
+
+	if (strcmp(spec, "ram") == 0)
+		model = &ram_model;
+	else
+	{
+		lib = dlopen(spec, RTLD_NOW | RTLD_LOCAL);
+		if (!lib)
+		{
+			fprintf(stderr, "%s\n", dlerror());
+			exit(1);
+		}
+		get = (const struct mmt_replay_model *(*)(void))
+				dlsym(lib, "mmt_replay_model_get");
+		if (!get || !(model = get()))
+		{
+			fprintf(stderr, "%s: no device model\n", spec);
+			exit(1);
+		}
+	}
+
+	if (model->version != MMT_REPLAY_MODEL_VERSION)
+	{
+		fprintf(stderr, "%s: unsupported model version %d\n", spec,
+				model->version);
+		exit(1);
+	}
+
+	if (model->init)
+		model_priv = model->init(args);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d model.so[:args]] [-m max-errors] [-q] trace|-\n",
+			name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec t0, t1;
+	double secs;
+	int fd, c, r;
+
+	while ((c = getopt(argc, argv, "d:m:q")) != -1)
+	{
+		switch (c)
+		{
+			case 'd':
+				load_model(optarg);
+				break;
+			case 'm':
+				max_errors = strtoull(optarg, NULL, 0);
+				break;
+			case 'q':
+				quiet = 1;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if (strcmp(argv[optind], "-") == 0)
+		fd = 0;
+	else
+	{
+		fd = open(argv[optind], O_RDONLY);
+		if (fd < 0)
+		{
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	r = replay(argv[optind], fd);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (fd)
+		close(fd);
+
+	if (model && model->fini)
+		model->fini(model_priv);
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	fprintf(stderr, "%llu reads, %llu writes, %llu ioctls, %llu mmaps, "
+			"%llu syncs in %.3f s\n", stats.reads, stats.writes, stats.ioctls,
+			stats.mmaps, stats.syncs, secs);
+	if (model)
+		fprintf(stderr, "model %s: %llu reads and %llu ioctls differ\n",
+				model->name ? model->name : "?", stats.bad_reads,
+				stats.bad_ioctls);
+
+	if (r)
+		return 2;
+	return stats.bad_reads || stats.bad_ioctls;
+}
@@ -0,0 +1,52 @@
+#ifndef MMT_REPLAY_H_
+#define MMT_REPLAY_H_
+
+/*
+ * Interface of device models driven by mmt-replay.
+ *
+ * A model is a shared library exporting mmt_replay_model_get(), loaded with
+ * "mmt-replay -d library.so[:args] trace". Every callback may be NULL.
+ * Regions, fds and ioctl numbers are the ones of the traced process;
+ * region 0 stands for accesses outside of traced regions
+ * (--mmt-trace-all-mem), with the address as offset.
+ */
+
+#define MMT_REPLAY_MODEL_VERSION 1
+
+struct mmt_replay_model
+{
+	/* MMT_REPLAY_MODEL_VERSION */
+	int version;
+	const char *name;
+
+	/* args is the part of -d argument after ':' (or NULL), returns the
+	 * private data passed to other callbacks */
+	void *(*init)(const char *args);
+	void (*fini)(void *priv);
+
+	void (*open)(void *priv, int fd, const char *path);
+	void (*dup)(void *priv, int oldfd, int newfd);
+	/* fd is -1 for mremap, which comes as munmap and mmap */
+	void (*mmap)(void *priv, unsigned int region, int fd,
+			unsigned long long offset, unsigned long long len);
+	void (*munmap)(void *priv, unsigned int region);
+
+	void (*write)(void *priv, unsigned int region, unsigned long long offset,
+			const void *data, unsigned int len);
+	/* stores the value the device returns in data, which holds the traced
+	 * value on entry */
+	void (*read)(void *priv, unsigned int region, unsigned long long offset,
+			void *data, unsigned int len);
+
+	/* data holds the argument from before the ioctl, the model updates it
+	 * and returns the result (negative errno on error) */
+	long long (*ioctl)(void *priv, int fd, unsigned int id, void *data,
+			unsigned int len);
+
+	/* sync marker (--mmt-sync-file) */
+	void (*sync)(void *priv, unsigned int id);
+};
+
+const struct mmt_replay_model *mmt_replay_model_get(void);
+
+#endif /* MMT_REPLAY_H_ */
@@ -0,0 +1,199 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Shared memory trace output (--mmt-ring=file).
+ *
+ * Trace goes into a ring in a file (normally on /dev/shm) mapped by both
+ * valgrind and a reader process, which can parse it while the traced
+ * program runs. Writing a chunk of trace is a memcpy and an update of the
+ * head counter; the traced process blocks only when the ring is full.
+ *
+ * The file is recreated on startup. The reader is expected to unlink it
+ * once it has mapped it. See mmt_ring.h for the layout.
+ */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_options.h"
+#include "pub_tool_vki.h"
+#include "pub_tool_vkiscnums.h"
+#include "coregrind/pub_core_aspacemgr.h"
+#include "coregrind/pub_core_libcsignal.h"
+#include "coregrind/pub_core_syscall.h"
+
+#include "mmt_ring.h"
+
+HChar *mmt_ring_file = NULL;
+UInt mmt_ring_size_mb = MMT_RING_DEFAULT_SIZE_MB;
+
+static int active = False;
+
+static struct mmt_ring_header *hdr;
+static char *data;
+static UInt size;
+
+/* private copy of hdr->head */
+static UInt head;
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void futex_wait(volatile UInt *addr, UInt val)
+{
+	struct vki_timespec ts = { 0, 100 * 1000 * 1000 };
+
+	VG_(do_syscall4)(__NR_futex, (UWord)addr, VKI_FUTEX_WAIT, val, (UWord)&ts);
+}
+
+static void futex_wake(volatile UInt *addr)
+{
+	VG_(do_syscall3)(__NR_futex, (UWord)addr, VKI_FUTEX_WAKE, 0x7fffffff);
+}
+
+int mmt_ring_init(void)
+{
+	SizeT total;
+	HChar *name;
+	SysRes res;
+	int fd;
+
+	size = 1;
+	while (size < mmt_ring_size_mb)
+		size <<= 1;
+	size <<= 20;
+	total = MMT_RING_DATA_OFFSET + (SizeT)size;
+
+	name = VG_(expand_file_name)("--mmt-ring", mmt_ring_file);
+	VG_(unlink)(name);
+	res = VG_(open)(name, VKI_O_CREAT | VKI_O_EXCL | VKI_O_RDWR, 0600);
+	VG_(free)(name);
+	if (sr_isError(res))
+		return False;
+	fd = sr_Res(res);
+
+	res = VG_(do_syscall2)(__NR_ftruncate, fd, total);
+	if (sr_isError(res))
+	{
+		VG_(close)(fd);
+		return False;
+	}
+
+	res = VG_(am_shared_mmap_file_float_valgrind)(total,
+			VKI_PROT_READ | VKI_PROT_WRITE, fd, 0);
+	VG_(close)(fd);
+	if (sr_isError(res))
+		return False;
+
+	hdr = (struct mmt_ring_header *)sr_Res(res);
+	data = (char *)hdr + MMT_RING_DATA_OFFSET;
+
+	hdr->version = MMT_RING_VERSION;
+	hdr->size = size;
+	hdr->writer_pid = VG_(getpid)();
+	__sync_synchronize();
+	hdr->magic = MMT_RING_MAGIC;
+
+	head = 0;
+	active = True;
+
+	return True;
+}
+
+int mmt_ring_active(void)
+{
+	return active;
+}
+
+static void wait_for_reader(void)
+{
+	static int warned = False;
+	UInt tail = hdr->tail;
+
+	hdr->tail_waiters = 1;
+	__sync_synchronize();
+	if (hdr->tail == tail)
+		futex_wait(&hdr->tail, tail);
+	hdr->tail_waiters = 0;
+
+	if (hdr->tail != tail)
+		return;
+
+	/* no progress, most likely timed out */
+	if (hdr->reader_pid)
+		tl_assert2(VG_(kill)(hdr->reader_pid, 0) == 0, "trace reader died\n");
+	else if (!warned)
+	{
+		VG_(message)(Vg_UserMsg, "trace ring is full, waiting for a reader\n");
+		warned = True;
+	}
+}
+
+void mmt_ring_write(const char *buf, int len)
+{
+	while (len > 0)
+	{
+		UInt off = head & (size - 1);
+		UInt cnt = size - (head - hdr->tail);
+
+		if (cnt == 0)
+		{
+			wait_for_reader();
+			continue;
+		}
+		/* reader is done with the space it gave back */
+		__sync_synchronize();
+
+		cnt = MIN(cnt, (UInt)len);
+		cnt = MIN(cnt, size - off);
+		VG_(memcpy)(data + off, buf, cnt);
+		buf += cnt;
+		len -= cnt;
+		head += cnt;
+
+		__sync_synchronize();
+		hdr->head = head;
+		__sync_synchronize();
+		if (hdr->head_waiters)
+			futex_wake(&hdr->head);
+	}
+}
+
+/* Marks the end of trace. Called at exit and before execve - the new
+ * program (if traced at all) gets its own ring. */
+void mmt_ring_close(void)
+{
+	if (!active)
+		return;
+
+	hdr->closed = 1;
+	__sync_synchronize();
+	futex_wake(&hdr->head);
+	active = False;
+}
+
+/* Forked children leave the ring to the parent and write to the log file. */
+void mmt_ring_detach(void)
+{
+	active = False;
+}
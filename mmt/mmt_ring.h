@@ -0,0 +1,55 @@
+#ifndef MMT_RING_H_
+#define MMT_RING_H_
+
+#include "pub_tool_basics.h"
+
+/*
+ * Layout of the --mmt-ring file, shared with readers (see mmt-ring-cat).
+ *
+ * The header page is followed by "size" bytes of data. head and tail count
+ * bytes written and consumed (modulo 2^32), so head - tail is the amount of
+ * data available to the reader. Each side sleeps on the other's counter
+ * (futex) only after setting its *_waiters flag, so wakeups cost a syscall
+ * only when somebody actually waits.
+ */
+
+#define MMT_RING_MAGIC 0x52544d4d /* "MMTR" */
+#define MMT_RING_VERSION 1
+#define MMT_RING_DATA_OFFSET 4096
+
+#define MMT_RING_DEFAULT_SIZE_MB 64
+#define MMT_RING_MAX_SIZE_MB 1024
+
+struct mmt_ring_header
+{
+	/* written last, after everything else is set up */
+	volatile UInt magic;
+	UInt version;
+	/* of data, power of 2 */
+	UInt size;
+	UInt writer_pid;
+	/* set by the reader when it attaches */
+	volatile UInt reader_pid;
+	/* set by the writer after the last byte of trace */
+	volatile UInt closed;
+
+	volatile UInt head __attribute__((aligned(64)));
+	/* reader sleeps on head */
+	volatile UInt head_waiters;
+
+	volatile UInt tail __attribute__((aligned(64)));
+	/* writer sleeps on tail */
+	volatile UInt tail_waiters;
+};
+
+extern HChar *mmt_ring_file;
+extern UInt mmt_ring_size_mb;
+
+int mmt_ring_init(void);
+int mmt_ring_active(void);
+void mmt_ring_write(const char *buf, int len);
+
+void mmt_ring_close(void);
+void mmt_ring_detach(void);
+
+#endif /* MMT_RING_H_ */
@@ -0,0 +1,195 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Reads trace written with --mmt-ring and copies it to stdout, as it is
+ * produced. Waits for the ring to be created, so it can be started before
+ * valgrind. The ring file is unlinked once it is mapped.
+ *
+ * Usage: mmt-ring-cat ring-file | demmt
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "mmt_ring.h"
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = { 0, ms * 1000000L };
+
+	nanosleep(&ts, NULL);
+}
+
+static struct mmt_ring_header *attach(const char *path)
+{
+	struct mmt_ring_header *hdr;
+	struct stat st;
+	int fd;
+
+	for (;;)
+	{
+		fd = open(path, O_RDWR);
+		if (fd >= 0)
+		{
+			if (fstat(fd, &st) == 0 && st.st_size > MMT_RING_DATA_OFFSET)
+				break;
+			close(fd);
+		}
+		else if (errno != ENOENT)
+		{
+			perror(path);
+			exit(1);
+		}
+		sleep_ms(10);
+	}
+
+	hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+
+	while (hdr->magic != MMT_RING_MAGIC)
+		sleep_ms(10);
+	__sync_synchronize();
+
+	if (hdr->version != MMT_RING_VERSION ||
+			MMT_RING_DATA_OFFSET + (off_t)hdr->size != st.st_size)
+	{
+		fprintf(stderr, "%s: unsupported ring\n", path);
+		exit(1);
+	}
+
+	hdr->reader_pid = getpid();
+	unlink(path);
+
+	return hdr;
+}
+
+static int write_full(const char *buf, unsigned int len)
+{
+	while (len)
+	{
+		ssize_t r = write(1, buf, len);
+		if (r <= 0)
+			return -1;
+		buf += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/* Sleeps until the writer moves head, with a timeout, so a writer which
+ * died without closing the ring is noticed. Returns 0 if the writer is gone. */
+static int wait_for_writer(struct mmt_ring_header *hdr, unsigned int head)
+{
+	struct timespec ts = { 0, 100 * 1000000L };
+	int r;
+
+	hdr->head_waiters = 1;
+	__sync_synchronize();
+	if (hdr->head == head && !hdr->closed)
+	{
+		r = syscall(SYS_futex, &hdr->head, FUTEX_WAIT, head, &ts, NULL, 0);
+		if (r < 0 && errno == ETIMEDOUT &&
+				kill(hdr->writer_pid, 0) < 0 && errno == ESRCH)
+		{
+			hdr->head_waiters = 0;
+			return 0;
+		}
+	}
+	hdr->head_waiters = 0;
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct mmt_ring_header *hdr;
+	const char *data;
+	unsigned int tail = 0, size;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s ring-file\n", argv[0]);
+		return 1;
+	}
+
+	hdr = attach(argv[1]);
+	data = (const char *)hdr + MMT_RING_DATA_OFFSET;
+	size = hdr->size;
+
+	for (;;)
+	{
+		/* closed is set after the last update of head */
+		int closed = hdr->closed;
+		unsigned int head, off, cnt;
+
+		__sync_synchronize();
+		head = hdr->head;
+
+		if (head == tail)
+		{
+			if (closed)
+				break;
+			if (!wait_for_writer(hdr, head) && hdr->head == tail)
+			{
+				fprintf(stderr, "ring writer died\n");
+				return 2;
+			}
+			continue;
+		}
+		/* data written before head */
+		__sync_synchronize();
+
+		off = tail & (size - 1);
+		cnt = head - tail;
+		if (cnt > size - off)
+			cnt = size - off;
+
+		if (write_full(data + off, cnt))
+		{
+			perror("write");
+			return 1;
+		}
+		tail += cnt;
+
+		__sync_synchronize();
+		hdr->tail = tail;
+		__sync_synchronize();
+		if (hdr->tail_waiters)
+			syscall(SYS_futex, &hdr->tail, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,221 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Snapshot mode.
+ *
+ * Stores to snapshot regions (mappings of at least --mmt-snapshot-min-size
+ * bytes, nouveau buffers submitted by GEM_PUSHBUF with
+ * --mmt-snapshot-nouveau-bos) are not traced one by one. Tracing helpers
+ * only mark written pages dirty, saving contents of a page before the first
+ * store to it.
+ *
+ * Before anything can observe the data - on every syscall (ioctl submitting
+ * the buffer, futex waking up submitting thread, munmap), on traced access
+ * to other regions (doorbell write) and on read from a snapshot region -
+ * dirty pages are compared with saved copies and changed ranges are emitted
+ * as ordinary write records.
+ *
+ * Order and width of stores within a snapshot is lost and memory changed
+ * by the GPU between snapshots shows up as written by the CPU.
+ */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_mallocfree.h"
+
+#include "mmt_snapshot.h"
+#include "mmt_trace_bin.h"
+
+#define PAGE_SIZE (1UL << MMT_PAGE_SHIFT)
+#define BITS_PER_WORD (8 * sizeof(UWord))
+
+/* unchanged gaps shorter than this do not split written ranges */
+#define MERGE_GAP 16
+
+struct mmt_snapshot
+{
+	struct mmt_mmap_data *region;
+	UWord npages;
+	/* contents at the last snapshot, allocated when page is first written */
+	UChar **pages;
+	/* pages written since the last snapshot */
+	UWord *dirty;
+
+	struct mmt_snapshot *next_dirty;
+	Bool on_list;
+};
+
+ULong mmt_snapshot_min_size = 0;
+int mmt_snapshot_nouveau_bos = False;
+int mmt_snapshot_pending = False;
+
+static struct mmt_snapshot *dirty_list;
+
+void mmt_snapshot_tag(struct mmt_mmap_data *region)
+{
+	struct mmt_snapshot *s;
+
+	if (region->snapshot)
+		return;
+
+	s = VG_(calloc)("mmt.snapshot", 1, sizeof(*s));
+	s->region = region;
+	s->npages = (region->end - region->start) >> MMT_PAGE_SHIFT;
+	s->pages = VG_(calloc)("mmt.snapshot.pages", s->npages, sizeof(s->pages[0]));
+	s->dirty = VG_(calloc)("mmt.snapshot.dirty",
+			(s->npages + BITS_PER_WORD - 1) / BITS_PER_WORD, sizeof(UWord));
+
+	region->snapshot = s;
+}
+
+void mmt_snapshot_release(struct mmt_mmap_data *region)
+{
+	struct mmt_snapshot *s = region->snapshot, **p;
+	UWord i;
+
+	if (!s)
+		return;
+
+	if (s->on_list)
+	{
+		for (p = &dirty_list; *p != s; p = &(*p)->next_dirty)
+			;
+		*p = s->next_dirty;
+		mmt_snapshot_pending = dirty_list != NULL;
+	}
+
+	for (i = 0; i < s->npages; ++i)
+		if (s->pages[i])
+			VG_(free)(s->pages[i]);
+	VG_(free)(s->pages);
+	VG_(free)(s->dirty);
+	VG_(free)(s);
+
+	region->snapshot = NULL;
+}
+
+void mmt_snapshot_mark(struct mmt_mmap_data *region, Addr addr, UInt len)
+{
+	struct mmt_snapshot *s = region->snapshot;
+	UWord first = (addr - region->start) >> MMT_PAGE_SHIFT;
+	UWord last = (addr + len - 1 - region->start) >> MMT_PAGE_SHIFT;
+	UWord page, bit;
+
+	/* store crossing the end of region */
+	if (last >= s->npages)
+		last = s->npages - 1;
+
+	for (page = first; page <= last; ++page)
+	{
+		bit = 1UL << (page % BITS_PER_WORD);
+		if (LIKELY(s->dirty[page / BITS_PER_WORD] & bit))
+			continue;
+
+		/* helpers, also the one of a coalesced store run, are called
+		 * before the stores reach memory, so it still has old data */
+		if (!s->pages[page])
+		{
+			s->pages[page] = VG_(malloc)("mmt.snapshot.page", PAGE_SIZE);
+			VG_(memcpy)(s->pages[page],
+					(void *)(region->start + (page << MMT_PAGE_SHIFT)), PAGE_SIZE);
+		}
+
+		s->dirty[page / BITS_PER_WORD] |= bit;
+		if (!s->on_list)
+		{
+			s->next_dirty = dirty_list;
+			dirty_list = s;
+			s->on_list = True;
+			mmt_snapshot_pending = True;
+		}
+	}
+}
+
+static void write_range(struct mmt_mmap_data *region, Addr addr, UInt len)
+{
+	UInt cnt;
+
+	while (len)
+	{
+		cnt = len < MMT_BULK_MAX ? len : MMT_BULK_MAX;
+		mmt_bin_write_access('w', region, addr, (const UChar *)addr, cnt);
+		addr += cnt;
+		len -= cnt;
+	}
+}
+
+static void diff_page(struct mmt_mmap_data *region, Addr addr, UChar *saved)
+{
+	const UInt *cur = (const UInt *)addr;
+	const UInt *old = (const UInt *)saved;
+	const UInt words = PAGE_SIZE / 4;
+	UInt i = 0, start, end;
+
+	while (i < words)
+	{
+		if (cur[i] == old[i])
+		{
+			i++;
+			continue;
+		}
+
+		start = i;
+		end = ++i;
+		for (; i < words && (i - end) * 4 < MERGE_GAP; ++i)
+			if (cur[i] != old[i])
+				end = i + 1;
+
+		write_range(region, addr + start * 4, (end - start) * 4);
+		i = end;
+	}
+
+	VG_(memcpy)(saved, (void *)addr, PAGE_SIZE);
+}
+
+static void flush_region(struct mmt_snapshot *s)
+{
+	UWord w, page;
+
+	for (w = 0; w < (s->npages + BITS_PER_WORD - 1) / BITS_PER_WORD; ++w)
+	{
+		while (s->dirty[w])
+		{
+			page = w * BITS_PER_WORD + __builtin_ctzl(s->dirty[w]);
+			s->dirty[w] &= s->dirty[w] - 1;
+
+			diff_page(s->region, s->region->start + (page << MMT_PAGE_SHIFT),
+					s->pages[page]);
+		}
+	}
+}
+
+void mmt_snapshot_flush(void)
+{
+	struct mmt_snapshot *s;
+
+	mmt_snapshot_pending = False;
+
+	while ((s = dirty_list) != NULL)
+	{
+		dirty_list = s->next_dirty;
+		s->on_list = False;
+		flush_region(s);
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef MMT_SNAPSHOT_H_
+#define MMT_SNAPSHOT_H_
+
+#include "pub_tool_basics.h"
+
+#include "mmt_trace.h"
+
+extern ULong mmt_snapshot_min_size;
+extern int mmt_snapshot_nouveau_bos;
+
+/* some snapshot region has pages written since the last snapshot */
+extern int mmt_snapshot_pending;
+
+void mmt_snapshot_tag(struct mmt_mmap_data *region);
+void mmt_snapshot_release(struct mmt_mmap_data *region);
+
+void mmt_snapshot_mark(struct mmt_mmap_data *region, Addr addr, UInt len);
+void mmt_snapshot_flush(void);
+
+/* emits stores buffered in snapshots, before anything can observe them */
+#define mmt_snapshot_barrier() do { \
+		if (UNLIKELY(mmt_snapshot_pending)) \
+			mmt_snapshot_flush(); \
+	} while (0)
+
+#endif /* MMT_SNAPSHOT_H_ */
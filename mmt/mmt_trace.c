@@ -25,7 +25,11 @@
 #include "mmt_fglrx_ioctl.h"
 #include "mmt_nv_ioctl.h"
 #include "mmt_nouveau_ioctl.h"
+#include "mmt_policy.h"
+#include "mmt_profile.h"
+#include "mmt_ring.h"
 #include "mmt_trace_bin.h"
+#include "mmt_snapshot.h"
 #include "vki-linux-drm-nouveau.h"
 
 #include "pub_tool_libcbase.h"
@@ -33,10 +37,19 @@
 #include "pub_tool_vkiscnums.h"
 #include "pub_tool_debuginfo.h"
 #include "pub_tool_libcassert.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_oset.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_libcfile.h"
+#include "coregrind/pub_core_clientstate.h"
+#include "coregrind/pub_core_syscall.h"
+
 /*
  * Binary format message types: (some of them are not used anymore, so they are reserved)
  *     = = text
  *     - = text
+ *     b = blob (--mmt-dedup-dumps, see mmt_blob.c)
+ *     c = access counts of region with "count" policy
  *     d = dup syscall
  *     e = mremap syscall
  *     i = ioctl before
@@ -45,19 +58,53 @@
  *     M = mmap syscall
  *     n = nvidia/nouveau messages (see mmt_nv_ioctl.c for list of subtypes)
  *     o = open syscall
+ *     p = time of repeated reads (--mmt-timestamps, see mmt_trace_bin.c)
  *     r = memory read
  *     R = memory read (full address)
  *     s = info for next read
  *     S = sync marker
  *     t = write syscall
+ *     T = timestamp (--mmt-timestamps, see mmt_trace_bin.c)
  *     u = munmap syscall
+ *     v = trace format version (--mmt-trace-format=2 only)
  *     w = memory write
  *     W = memory write (full address)
  *     x = info for next write
  *     y = memory dump
+ *     Y = memory dump referring to a blob
+ *     z = compressed block (--mmt-trace-compress, see mmt_writer.c)
+ *
+ * Format 2 replaces r/w/R/W records with compact ones, which do not end
+ * with a newline. The first byte has bit 7 set and describes the rest:
+ *     bit 6 = write (read otherwise)
+ *     bits 5-3 = log2 of access size, 7 - size follows as varint
+ *     bit 2 = region id follows (otherwise same as in previous access)
+ *     bit 1 = previous access was repeated N more times, only varint N follows
+ *     bit 0 = range of writes (see below)
+ * then: [size (varint)], [region id (varint)], offset delta (zigzag varint),
+ * value.
+ * A range stands for N writes of the same size at a constant stride, e.g.
+ * of a loop uploading a buffer. Offset delta (of the first write) is
+ * followed by N (varint), stride (zigzag varint) and N values. Offset of
+ * the last write is the base of the next delta.
+ * Offset delta is relative to previous access in the same region, in
+ * --mmt-trace-all-mem mode region id is 0 and offset is the address.
+ * Format version and timestamp records reset this state.
  */
-static struct mmt_mmap_data mmt_mmaps[MMT_MAX_REGIONS];
-static int mmt_last_region = -1;
+static OSet *mmt_regions;
+
+/* regions by fd and file offset, for mmt_find_region_by_offset */
+struct region_by_offset
+{
+	/* VgHashNode, keyed by offset_key() */
+	struct region_by_offset *next;
+	UWord key;
+	int fd;
+	Off64T offset;
+	struct mmt_mmap_data *region;
+};
+
+static VgHashTable *regions_by_offset;
 
 static UInt mmt_current_item = 1;
 
@@ -73,39 +120,47 @@ int mmt_trace_stdout_stderr = False;
 static struct mmt_mmap_data null_region;
 struct mmt_mmap_data *last_used_region = &null_region;
 
-#define NEG_REGS 10
-struct negative_region neg_regions[NEG_REGS];
-static int neg_regions_number;
+struct mmt_page_dir *mmt_page_table[MMT_PT_TOP_SIZE];
 
-#define noinline	__attribute__((noinline))
+UInt mmt_granule_map[MMT_GRANULE_MAP_SIZE];
+int mmt_inline_filter = False;
 
 int all_mem = 0;
 
+static UWord offset_key(int fd, Off64T offset)
+{
+	return (UWord)(offset >> MMT_PAGE_SHIFT) * 31 + (UInt)fd;
+}
+
+static Word cmp_fd_offset(const void *node1, const void *node2)
+{
+	const struct region_by_offset *a = node1, *b = node2;
+
+	return a->fd != b->fd || a->offset != b->offset;
+}
+
+static Word cmp_region(const void *node1, const void *node2)
+{
+	const struct region_by_offset *a = node1, *b = node2;
+
+	return a->region != b->region;
+}
+
 static maybe_unused void dump_state(void)
 {
-	int i;
+	struct mmt_mmap_data *region;
+	int i = 0;
 
 	mmt_bin_flush();
 
-	if (neg_regions_number == 0)
-		VG_(printf)("NEGative cache empty\n");
-	else
-	{
-		VG_(printf)("NEG vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv\n");
-		struct negative_region *reg = neg_regions;
-		for (i = 0; i < neg_regions_number; ++i, ++reg)
-			VG_(printf)("NEG <0x%016lx 0x%016lx> %16d\n", reg->start, reg->end, reg->score);
-		VG_(printf)("NEG ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n");
-	}
-
-	if (mmt_last_region < 0)
+	if (!mmt_regions || VG_(OSetGen_Size)(mmt_regions) == 0)
 		VG_(printf)("POS mmap list empty\n");
 	else
 	{
 		VG_(printf)("POS vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv\n");
-		struct mmt_mmap_data *region = mmt_mmaps;
-		for (i = 0; i <= mmt_last_region; ++i, ++region)
-			VG_(printf)("POS %05d, id: %05d, start: 0x%016lx, end: 0x%016lx\n", i, region->id, region->start, region->end);
+		VG_(OSetGen_ResetIter)(mmt_regions);
+		while ((region = VG_(OSetGen_Next)(mmt_regions)) != NULL)
+			VG_(printf)("POS %05d, id: %05u, start: 0x%016lx, end: 0x%016lx\n", i++, region->id, region->start, region->end);
 		VG_(printf)("POS ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n");
 	}
 }
@@ -128,413 +183,158 @@ static maybe_unused void dump_state(void)
                               format, ##args),                          \
                               0)))
 
-static maybe_unused void __verify_state(void)
+/* walks the page table, returns pointer to the slot for given page */
+static struct mmt_mmap_data **page_slot(UWord page, int alloc)
 {
-	int i, j;
-	struct negative_region *neg1 = neg_regions;
-	struct negative_region *neg2;
-	struct mmt_mmap_data *pos1, *pos2;
-
-#ifdef MMT_DEBUG_VERBOSE
-	dump_state();
-#endif
+	struct mmt_page_dir **pdir = &mmt_page_table[page >> (2 * MMT_PT_BITS)];
+	struct mmt_page_leaf **pleaf;
 
-	for (i = 0; i < neg_regions_number; ++i, ++neg1)
+	if (!*pdir)
 	{
-		mmt_assert2(neg1->start <= neg1->end, "%p %p", (void *)neg1->start, (void *)neg1->end);
-
-		mmt_assert2(neg1->score >= 0, "score: %d", neg1->score);
-
-		/* score order */
-		if (i > 0)
-			mmt_assert2(neg1->score <= neg1[-1].score, "score: %d, prev score: %d", neg1->score, neg1[-1].score);
-
-		neg2 = neg_regions;
-		for (j = 0; j < neg_regions_number; ++j, ++neg2)
-		{
-			if (i == j)
-				continue;
-
-			/* negative regions should not be adjacent */
-			mmt_assert2(neg1->start != neg2->end, "<%p, %p> <%p, %p>",
-					(void *)neg1->start, (void *)neg1->end,
-					(void *)neg2->start, (void *)neg2->end);
-			mmt_assert2(neg1->end   != neg2->start, "<%p, %p> <%p, %p>",
-					(void *)neg1->start, (void *)neg1->end,
-					(void *)neg2->start, (void *)neg2->end);
-
-			/* start or end are not within other region */
-			mmt_assert2(neg1->start < neg2->start || neg1->start >= neg2->end,
-					"<%p, %p> <%p, %p>",
-					(void *)neg1->start, (void *)neg1->end,
-					(void *)neg2->start, (void *)neg2->end);
-			mmt_assert2(neg1->end   < neg2->start || neg1->end   >= neg2->end,
-					"<%p, %p> <%p, %p>",
-					(void *)neg1->start, (void *)neg1->end,
-					(void *)neg2->start, (void *)neg2->end);
-		}
+		if (!alloc)
+			return NULL;
+		*pdir = VG_(calloc)("mmt.pagedir", 1, sizeof(struct mmt_page_dir));
 	}
 
-	/* negative regions after last should be empty */
-	for (i = neg_regions_number; i < NEG_REGS; ++i, ++neg1)
-		mmt_assert(neg1->start == 0 && neg1->end == 0 && neg1->score == 0);
-
-	pos1 = mmt_mmaps;
-	for (i = 0; i <= mmt_last_region; ++i, ++pos1)
+	pleaf = &(*pdir)->leaves[(page >> MMT_PT_BITS) & MMT_PT_MASK];
+	if (!*pleaf)
 	{
-		/* order */
-		mmt_assert(pos1->start <= pos1->end);
-
-		/* all regions must have an id */
-		mmt_assert(pos1->id > 0);
-
-		/* if it's a real region, it must have a file descriptor */
-		if (pos1->end > 0)
-			mmt_assert(pos1->fd > 0);
+		if (!alloc)
+			return NULL;
+		*pleaf = VG_(calloc)("mmt.pageleaf", 1, sizeof(struct mmt_page_leaf));
+		(*pdir)->used++;
+	}
 
-		pos2 = mmt_mmaps;
-		for (j = 0; j <= mmt_last_region; ++j, ++pos2)
-		{
-			if (i == j)
-				continue;
+	return &(*pleaf)->regions[page & MMT_PT_MASK];
+}
 
-			/* start or end are not within other region */
-			mmt_assert2(pos1->start < pos2->start || pos1->start >= pos2->end,
-					"<%p, %p> <%p, %p>",
-					(void *)pos1->start, (void *)pos1->end,
-					(void *)pos2->start, (void *)pos2->end);
-			mmt_assert2(pos1->end  <= pos2->start || pos1->end   >= pos2->end,
-					"<%p, %p> <%p, %p>",
-					(void *)pos1->start, (void *)pos1->end,
-					(void *)pos2->start, (void *)pos2->end);
-		}
-	}
+static void set_pages(struct mmt_mmap_data *region)
+{
+	UWord page;
 
-	/* positive regions after last should be empty */
-	for (i = mmt_last_region + 1; i < MMT_MAX_REGIONS; ++i, ++pos1)
-	{
-		mmt_assert2(pos1->start == 0, "%p", (void *)pos1->start);
-		mmt_assert2(pos1->end == 0, "%p", (void *)pos1->end);
-		mmt_assert2(pos1->fd == 0, "%d", pos1->fd);
-		mmt_assert2(pos1->id == 0, "%u", pos1->id);
-		mmt_assert2(pos1->offset == 0, "%lld", pos1->offset);
-	}
+	mmt_assert2((region->end - 1) >> MMT_PAGE_SHIFT < MMT_PT_PAGES,
+			"region <%p, %p> out of supported address space",
+			(void *)region->start, (void *)region->end);
 
-	if (last_used_region && last_used_region != &null_region)
+	for (page = region->start >> MMT_PAGE_SHIFT;
+			page <= (region->end - 1) >> MMT_PAGE_SHIFT; ++page)
 	{
-		/* there must be at least one positive region, we are pointing at it! */
-		mmt_assert(mmt_last_region >= 0);
+		struct mmt_mmap_data **slot = page_slot(page, True);
 
-		/* within possible range */
-		mmt_assert(last_used_region >= &mmt_mmaps[0]);
-		mmt_assert(last_used_region <= &mmt_mmaps[mmt_last_region]);
+		mmt_assert2(*slot == NULL, "<%p, %p> overlaps <%p, %p>",
+				(void *)region->start, (void *)region->end,
+				(void *)(*slot)->start, (void *)(*slot)->end);
 
-		/* it must be real region */
-		mmt_assert(last_used_region->start < last_used_region->end);
+		*slot = region;
+		mmt_page_table[page >> (2 * MMT_PT_BITS)]->
+				leaves[(page >> MMT_PT_BITS) & MMT_PT_MASK]->used++;
 	}
 }
-static void verify_state(void)
-{
-#ifdef MMT_DEBUG
-	__verify_state();
-#endif
-}
 
-static force_inline struct mmt_mmap_data *__mmt_bsearch(Addr addr, int *next)
+static void clear_pages(struct mmt_mmap_data *region)
 {
-	int start = 0, end = mmt_last_region, middle;
-	struct mmt_mmap_data *tmp;
+	UWord page;
 
-	while (start <= end)
+	for (page = region->start >> MMT_PAGE_SHIFT;
+			page <= (region->end - 1) >> MMT_PAGE_SHIFT; ++page)
 	{
-		middle = start + (end - start) / 2;
-		tmp = &mmt_mmaps[middle];
-
-#ifdef MMT_DEBUG
-		mmt_assert2(start >= 0 && start <= mmt_last_region,
-				"%d %d", start, mmt_last_region);
-		mmt_assert2(middle >= 0 && middle <= mmt_last_region,
-				"%d %d", middle, mmt_last_region);
-		mmt_assert2(end >= 0 && end <= mmt_last_region,
-				"%d %d", end, mmt_last_region);
-#endif
+		struct mmt_page_dir **pdir = &mmt_page_table[page >> (2 * MMT_PT_BITS)];
+		struct mmt_page_leaf **pleaf = &(*pdir)->leaves[(page >> MMT_PT_BITS) & MMT_PT_MASK];
+
+		mmt_assert((*pleaf)->regions[page & MMT_PT_MASK] == region);
+		(*pleaf)->regions[page & MMT_PT_MASK] = NULL;
 
-		if (addr < tmp->start)
+		if (--(*pleaf)->used == 0)
 		{
-			if (end == middle)
-				break;
-			end = middle;
+			VG_(free)(*pleaf);
+			*pleaf = NULL;
+
+			if (--(*pdir)->used == 0)
+			{
+				VG_(free)(*pdir);
+				*pdir = NULL;
+			}
 		}
-		else if (addr >= tmp->end)
-			start = middle + 1;
-		else
-			return tmp;
 	}
-	*next = start;
-
-#ifdef MMT_DEBUG
-	for(start = 0; start <= mmt_last_region; ++start)
-		mmt_assert2(addr < mmt_mmaps[start].start || addr >= mmt_mmaps[start].end,
-				"%p in %d<%p, %p>", (void *)addr, start, (void *)mmt_mmaps[start].start,
-				(void *)mmt_mmaps[start].end);
-	mmt_assert2(*next <= mmt_last_region + 1, "*prev: %d, mmt_last_region: %d, addr: %p",
-			*next, mmt_last_region, (void *)addr);
-#endif
-
-	return NULL;
-}
-
-static void add_neg(Addr start, Addr end)
-{
-#ifdef MMT_DEBUG_VERBOSE
-	mmt_bin_flush();
-	VG_(printf)("adding negative entry: <%p, %p>\n", (void *)start, (void *)end);
-#endif
-
-	if (neg_regions_number < NEG_REGS)
-		neg_regions_number++;
-	neg_regions[neg_regions_number - 1].start = start;
-	neg_regions[neg_regions_number - 1].end = end;
-	neg_regions[neg_regions_number - 1].score = 0;
-
-	verify_state();
 }
 
-/* finds region to which addr belongs to */
-static noinline struct mmt_mmap_data *mmt_bsearch(Addr addr)
+static void update_granules(struct mmt_mmap_data *region, int delta)
 {
-	struct mmt_mmap_data *region;
-	int tmp;
-
-	if (UNLIKELY(mmt_last_region < 0))
-	{
-		add_neg(0, (Addr)-1);
-		return NULL;
-	}
-
-	/* before first? */
-	if (addr < mmt_mmaps[0].start)
-	{
-		add_neg(0, mmt_mmaps[0].start);
-		return NULL;
-	}
-
-	/* after last? */
-	if (addr >= mmt_mmaps[mmt_last_region].end)
-	{
-		add_neg(mmt_mmaps[mmt_last_region].end, (Addr)-1);
-		return NULL;
-	}
+	UWord granule = region->start >> MMT_GRANULE_SHIFT;
+	UWord last = (region->end - 1) >> MMT_GRANULE_SHIFT;
+	UWord cnt;
 
-	region = __mmt_bsearch(addr, &tmp);
-	if (region)
-		return region;
-
-	add_neg(mmt_mmaps[tmp - 1].end, mmt_mmaps[tmp].start);
-	return NULL;
+	/* huge regions touch every bucket, no need to count them more than once */
+	for (cnt = 0; granule <= last && cnt < MMT_GRANULE_MAP_SIZE; ++granule, ++cnt)
+		mmt_granule_map[granule & (MMT_GRANULE_MAP_SIZE - 1)] += delta;
 }
 
-/* finds index of region which follows addr, assuming it does not belong to any */
-static int mmt_bsearch_next(Addr addr)
+static maybe_unused void __verify_state(void)
 {
-	int index;
-	mmt_assert(__mmt_bsearch(addr, &index) == NULL);
-	return index;
-}
+	struct mmt_mmap_data *region, *prev = NULL;
 
-static noinline void score_higher(int i)
-{
-	struct negative_region tmp;
-	struct negative_region *curr = &neg_regions[i];
-	do
+	VG_(OSetGen_ResetIter)(mmt_regions);
+	while ((region = VG_(OSetGen_Next)(mmt_regions)) != NULL)
 	{
-		tmp = curr[-1];
-		curr[-1] = *curr;
-		*curr = tmp;
+		/* order */
+		mmt_assert(region->start < region->end);
 
-		i--;
-		curr--;
-	}
-	while (i > 1 && curr->score > curr[-1].score);
-}
+		/* all regions must have an id */
+		mmt_assert(region->id > 0);
 
-struct mmt_mmap_data *__find_mmap_slow(Addr addr)
-{
-	struct mmt_mmap_data *region;
-	struct negative_region *neg = neg_regions;
-	int i;
+		/* regions must not overlap */
+		if (prev)
+			mmt_assert2(prev->end <= region->start,
+					"<%p, %p> <%p, %p>",
+					(void *)prev->start, (void *)prev->end,
+					(void *)region->start, (void *)region->end);
 
-	/* if score of first negative entry grew too much - divide all entries;
-	 * it prevents overflowing and monopoly at the top */
-	if (UNLIKELY(neg->score > 1 << 24))
-		for (i = 0; i < neg_regions_number; ++i)
-			neg_regions[i].score >>= 10;
+		/* page table must point at this region */
+		mmt_assert(find_mmap(region->start) == region);
+		mmt_assert(find_mmap(region->end - 1) == region);
 
-	/* check all negative regions */
-	for (i = 1; i < neg_regions_number; ++i)
-	{
-		neg++;
-		if (LIKELY(addr >= neg->start && addr < neg->end))
-		{
-			neg->score++;
-			/* if current entry score is bigger than previous */
-			if (UNLIKELY(neg->score > neg[-1].score))
-				score_higher(i); /* then swap them */
-			return NULL;
-		}
+		prev = region;
 	}
 
-	region = mmt_bsearch(addr);
-
-	if (region)
-		last_used_region = region;
-
-	return region;
+	last_used_region = &null_region;
 }
 
-static void remove_neg_region(int idx)
+static void verify_state(void)
 {
-	VG_(memmove)(&neg_regions[idx], &neg_regions[idx + 1], (neg_regions_number - idx - 1) * sizeof(neg_regions[0]));
-	neg_regions_number--;
-	VG_(memset)(&neg_regions[neg_regions_number], 0, sizeof(neg_regions[0]));
+#ifdef MMT_DEBUG_VERBOSE
+	dump_state();
+	__verify_state();
+#endif
 }
 
 void mmt_free_region(struct mmt_mmap_data *m)
 {
-	int idx = m - &mmt_mmaps[0];
-	int i, found = -1;
-	Addr start = m->start;
-	Addr end = m->end;
-	int joined = 0;
+	struct mmt_mmap_data *removed;
+	struct region_by_offset key, *node;
 
 #ifdef MMT_DEBUG_VERBOSE
 	mmt_bin_flush();
-	VG_(printf)("freeing region: <%p, %p>\n", (void *)start, (void *)end);
+	VG_(printf)("freeing region: <%p, %p>\n", (void *)m->start, (void *)m->end);
 #endif
 
-	/* are we freeing region adjacent to negative region?
-	 * if yes, then extend negative region */
-	for (i = 0; i < neg_regions_number; ++i)
-	{
-		struct negative_region *neg = &neg_regions[i];
-
-		if (neg->end == start)
-		{
-			neg->end = end;
-			found = i;
-			break;
-		}
-		if (neg->start == end)
-		{
-			neg->start = start;
-			found = i;
-			break;
-		}
-	}
-
-	if (found >= 0)
-	{
-		/* now that we extended negative region, maybe we can join two negative regions? */
-		struct negative_region *found_reg = &neg_regions[found];
-		int score = found_reg->score;
-		start = found_reg->start;
-		end = found_reg->end;
-
-		for (i = 0; i < neg_regions_number; ++i)
-		{
-			struct negative_region *neg = &neg_regions[i];
-
-			if (neg->end == start)
-			{
-				/* there is another negative region which ends where our starts */
-
-				if (neg->score > score)
-				{
-					/* another is better */
-					neg->end = end;
-
-					remove_neg_region(found);
-				}
-				else
-				{
-					/* our is better */
-					found_reg->start = neg->start;
-
-					remove_neg_region(i);
-				}
-
-				joined = 1;
-				break;
-			}
-
-			if (neg->start == end)
-			{
-				/* there is another negative region which starts where our ends */
-
-				if (neg->score > score)
-				{
-					/* another is better */
-					neg->start = start;
-
-					remove_neg_region(found);
-				}
-				else
-				{
-					/* our is better */
-					found_reg->end = neg->end;
-
-					remove_neg_region(i);
-				}
-
-				joined = 1;
-				break;
-			}
-		}
-	}
-
-	if (mmt_last_region != idx)
-		VG_(memmove)(mmt_mmaps + idx, mmt_mmaps + idx + 1,
-				(mmt_last_region - idx) * sizeof(struct mmt_mmap_data));
-	VG_(memset)(&mmt_mmaps[mmt_last_region--], 0, sizeof(struct mmt_mmap_data));
-
 	/* if we are releasing last used region, then zero cache */
 	if (m == last_used_region)
 		last_used_region = &null_region;
-	else if (last_used_region > m && last_used_region != &null_region) /* if last used region was in area which just moved */
-	{
-		/* then move pointer by -1 */
-		last_used_region--;
-	}
 
-	if (found >= 0)
-	{
-		/* we could not join multiple negative regions, maybe we can extend it? */
-		if (!joined)
-		{
-			struct negative_region *found_reg = &neg_regions[found];
-			int tmp = 0;
-			struct mmt_mmap_data *region;
+	mmt_snapshot_release(m);
+	mmt_policy_write_counts(m);
+	clear_pages(m);
+	update_granules(m, -1);
 
-			if (start > 0)
-			{
-				region = __mmt_bsearch(start - 1, &tmp);
-				if (region == NULL)
-				{
-					if (tmp >= 1)
-						found_reg->start = mmt_mmaps[tmp - 1].end;
-				}
-			}
-			if (end < (Addr)-1)
-			{
-				region = __mmt_bsearch(end, &tmp);
-				if (region == NULL)
-				{
-					if (tmp <= mmt_last_region)
-						found_reg->end = mmt_mmaps[tmp].start;
-				}
-			}
-		}
-	}
+	key.key = offset_key(m->fd, m->offset);
+	key.region = m;
+	node = VG_(HT_gen_remove)(regions_by_offset, &key, cmp_region);
+	mmt_assert(node != NULL);
+	VG_(free)(node);
+
+	removed = VG_(OSetGen_Remove)(mmt_regions, &m->start);
+	mmt_assert(removed == m);
+	VG_(OSetGen_FreeNode)(mmt_regions, removed);
 
 	verify_state();
 }
@@ -543,7 +343,7 @@ struct mmt_mmap_data *mmt_add_region(int fd, Addr start, Addr end,
 		Off64T offset, UInt id)
 {
 	struct mmt_mmap_data *region;
-	int i;
+	struct region_by_offset *node;
 	end = (end + VKI_PAGE_SIZE - 1) & ~(VKI_PAGE_SIZE - 1);
 
 #ifdef MMT_DEBUG_VERBOSE
@@ -551,36 +351,13 @@ struct mmt_mmap_data *mmt_add_region(int fd, Addr start, Addr end,
 	VG_(printf)("adding region: <%p, %p>\n", (void *)start, (void *)end);
 #endif
 
-	mmt_assert2(mmt_last_region + 1 < MMT_MAX_REGIONS, "not enough space for new mmap!");
-
-	if (mmt_last_region < 0 || start >= mmt_mmaps[mmt_last_region].end)
-		region = &mmt_mmaps[++mmt_last_region];
-	else
-	{
-		i = mmt_bsearch_next(start);
-
-		region = &mmt_mmaps[i];
-		if (i != mmt_last_region + 1)
-		{
-			VG_(memmove)(&mmt_mmaps[i+1], &mmt_mmaps[i],
-					(mmt_last_region - i  + 1) * sizeof(mmt_mmaps[0]));
-
-			if (last_used_region >= region && last_used_region != &null_region)
-				last_used_region++;
-		}
-		mmt_last_region++;
-	}
-
-	/* look for negative regions overlapping new region */
-	for (i = 0; i < neg_regions_number; ++i)
-		if ((start >= neg_regions[i].start && start < neg_regions[i].end) ||
-			(end   >= neg_regions[i].start && end   < neg_regions[i].end))
-		{
-			/* just remove negative region */
-			remove_neg_region(i);
-			i--;
-		}
+	if (UNLIKELY(!mmt_regions))
+		mmt_regions = VG_(OSetGen_Create)(offsetof(struct mmt_mmap_data, start),
+				NULL, VG_(malloc), "mmt.regions", VG_(free));
+	if (UNLIKELY(!regions_by_offset))
+		regions_by_offset = VG_(HT_construct)("mmt.regions.by_offset");
 
+	region = VG_(OSetGen_AllocNode)(mmt_regions, sizeof(*region));
 	region->fd = fd;
 	if (id == 0)
 		region->id = mmt_current_item++;
@@ -589,6 +366,23 @@ struct mmt_mmap_data *mmt_add_region(int fd, Addr start, Addr end,
 	region->start = start;
 	region->end = end;
 	region->offset = offset;
+	region->snapshot = NULL;
+	region->policy = MMT_POLICY_TRACE;
+	region->profile = NULL;
+	region->counts = NULL;
+	region->ranges = NULL;
+	region->ranges_num = 0;
+
+	set_pages(region);
+	update_granules(region, 1);
+	VG_(OSetGen_Insert)(mmt_regions, region);
+
+	node = VG_(malloc)("mmt.regions.by_offset.node", sizeof(*node));
+	node->key = offset_key(fd, offset);
+	node->fd = fd;
+	node->offset = offset;
+	node->region = region;
+	VG_(HT_add_node)(regions_by_offset, node);
 
 	verify_state();
 
@@ -616,6 +410,10 @@ static void mmt_pre_write(UWord *args)
 
 void mmt_pre_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs)
 {
+	mmt_snapshot_barrier();
+	if (mmt_timestamps)
+		mmt_bin_syscall_timestamp();
+
 	if (syscallno == __NR_ioctl)
 	{
 		int fd = args[0];
@@ -641,6 +439,18 @@ void mmt_pre_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs)
 	}
 	else if (syscallno == __NR_exit_group || syscallno == __NR_exit)
 		mmt_bin_flush();
+	else if (syscallno == __NR_execve)
+	{
+		/* the trace may end here, close the last group as at exit */
+		if (mmt_timestamps)
+			mmt_bin_timestamp();
+		mmt_bin_flush();
+		if (mmt_timestamps)
+			mmt_bin_keep_trace((const HChar *)args[0],
+					(const HChar **)args[1]);
+		/* if execve fails, the rest goes to the log file */
+		mmt_ring_close();
+	}
 	else if (syscallno == __NR_write)
 		mmt_pre_write(args);
 }
@@ -660,40 +470,98 @@ void mmt_dump_open(UWord *args, SysRes res)
 	mmt_bin_sync();
 }
 
+static int is_traced_path(const char *path)
+{
+	int i;
+
+	if (mmt_trace_all_files)
+		return True;
+
+	for (i = 0; i < mmt_trace_files_num; ++i)
+		if (VG_(strcmp)(path, mmt_trace_files[i]) == 0)
+			return True;
+
+	if (mmt_trace_files_num == 0)
+	{
+		if (mmt_trace_nvidia_ioctls && VG_(strncmp)(path, "/dev/nvidia", 11) == 0)
+			return True;
+		if (mmt_trace_fglrx_ioctls && VG_(strncmp)(path, "/dev/ati/", 9) == 0)
+			return True;
+		// nouveau will be detected at ioctl time
+	}
+
+	return False;
+}
+
 static void post_open(ThreadId tid, UWord *args, UInt nArgs, SysRes res)
 {
 	const char *path = (const char *)args[0];
-	int i;
 
 	if (res._isError)
 		return;
 
-	if (mmt_trace_all_files)
+	if (is_traced_path(path))
 		FD_SET(res._val, &trace_fds);
-	else
+
+	mmt_policy_open(res._val, path);
+
+	if (mmt_trace_all_opens || FD_ISSET(res._val, &trace_fds))
+		mmt_dump_open(args, res);
+}
+
+/*
+ * Picks up traced files opened before exec by the parent (or this process,
+ * when it was started by a traced one with --trace-children=yes), except
+ * stdio. They are written out as opens with flags and mode 0.
+ */
+void mmt_trace_inherited_fds(void)
+{
+	HChar buf[4096], path[VKI_PATH_MAX], link[64];
+	struct vki_dirent64 *d;
+	UWord args[3];
+	SysRes r;
+	Int dirfd, n, pos, fd;
+	SSizeT len;
+
+	r = VG_(open)("/proc/self/fd", VKI_O_RDONLY, 0);
+	if (sr_isError(r))
+		return;
+	dirfd = sr_Res(r);
+
+	while ((n = VG_(getdents64)(dirfd, (struct vki_dirent64 *)buf, sizeof(buf))) > 0)
 	{
-		for (i = 0; i < mmt_trace_files_num; ++i)
+		for (pos = 0; pos < n; pos += d->d_reclen)
 		{
-			const char *path2 = mmt_trace_files[i];
-			if (VG_(strcmp)(path, path2) == 0)
-			{
-				FD_SET(res._val, &trace_fds);
-				break;
-			}
-		}
+			d = (struct vki_dirent64 *)(buf + pos);
+			if (d->d_name[0] < '0' || d->d_name[0] > '9')
+				continue;
 
-		if (mmt_trace_files_num == 0)
-		{
-			if (mmt_trace_nvidia_ioctls && VG_(strncmp)(path, "/dev/nvidia", 11) == 0)
-				FD_SET(res._val, &trace_fds);
-			else if (mmt_trace_fglrx_ioctls && VG_(strncmp)(path, "/dev/ati/", 9) == 0)
-				FD_SET(res._val, &trace_fds);
-			// nouveau will be detected at ioctl time
+			fd = VG_(strtoll10)(d->d_name, NULL);
+			/* valgrind's own fds live above the soft limit */
+			if (fd <= 2 || fd == dirfd || fd >= VG_(fd_soft_limit) ||
+					fd >= FD_SETSIZE)
+				continue;
+
+			VG_(snprintf)(link, sizeof(link), "/proc/self/fd/%d", fd);
+			len = VG_(readlink)(link, path, sizeof(path) - 1);
+			if (len <= 0 || path[0] != '/')
+				continue;
+			path[len] = 0;
+
+			if (!is_traced_path(path))
+				continue;
+
+			FD_SET(fd, &trace_fds);
+			mmt_policy_open(fd, path);
+
+			args[0] = (UWord)path;
+			args[1] = 0;
+			args[2] = 0;
+			mmt_dump_open(args, VG_(mk_SysRes_Success)(fd));
 		}
 	}
 
-	if (mmt_trace_all_opens || FD_ISSET(res._val, &trace_fds))
-		mmt_dump_open(args, res);
+	VG_(close)(dirfd);
 }
 
 static void post_close(ThreadId tid, UWord *args, UInt nArgs, SysRes res)
@@ -702,12 +570,20 @@ static void post_close(ThreadId tid, UWord *args, UInt nArgs, SysRes res)
 
 	if (FD_ISSET(fd, &trace_fds))
 		FD_CLR(fd, &trace_fds);
+
+	mmt_policy_close(fd);
 }
 
 struct mmt_mmap_data *mmt_map_region(int fd, Addr start, Addr end, Off64T offset, int prot, int flags)
 {
 	struct mmt_mmap_data *region = mmt_add_region(fd, start, end, offset, 0);
 
+	mmt_policy_map(region);
+	if (mmt_profile)
+		mmt_profile_map(region);
+	if (mmt_snapshot_min_size && end - start >= mmt_snapshot_min_size)
+		mmt_snapshot_tag(region);
+
 	mmt_bin_write_1('M');
 	mmt_bin_write_8(region->offset);
 	mmt_bin_write_4(prot);
@@ -744,6 +620,8 @@ static void post_mmap(ThreadId tid, UWord *args, UInt nArgs, SysRes res, int off
 
 void mmt_unmap_region(struct mmt_mmap_data *region)
 {
+	mmt_policy_write_counts(region);
+
 	mmt_bin_write_1('u');
 	mmt_bin_write_8(region->offset);
 	mmt_bin_write_4(region->id);
@@ -754,20 +632,49 @@ void mmt_unmap_region(struct mmt_mmap_data *region)
 	mmt_bin_end();
 	mmt_bin_sync();
 
+	mmt_policy_unmap(region);
 	mmt_free_region(region);
 }
 
+void mmt_for_each_region(void (*fn)(struct mmt_mmap_data *region, void *arg),
+		void *arg)
+{
+	struct mmt_mmap_data *region;
+
+	if (!mmt_regions)
+		return;
+
+	VG_(OSetGen_ResetIter)(mmt_regions);
+	while ((region = VG_(OSetGen_Next)(mmt_regions)) != NULL)
+		fn(region, arg);
+}
+
+/* if the same part of a file is mapped more than once, returns the latest mapping */
+struct mmt_mmap_data *mmt_find_region_by_offset(int fd, Off64T offset)
+{
+	struct region_by_offset key, *node;
+
+	if (!regions_by_offset)
+		return NULL;
+
+	key.key = offset_key(fd, offset);
+	key.fd = fd;
+	key.offset = offset;
+	node = VG_(HT_gen_lookup)(regions_by_offset, &key, cmp_fd_offset);
+
+	return node ? node->region : NULL;
+}
+
 static void post_munmap(ThreadId tid, UWord *args, UInt nArgs, SysRes res)
 {
 	Addr start = args[0];
 //	unsigned long len = args[1];
 	struct mmt_mmap_data *region;
-	int tmpi;
 
 	if (res._isError)
 		return;
 
-	region = __mmt_bsearch(start, &tmpi);
+	region = find_mmap(start);
 	if (!region)
 		return;
 
@@ -781,18 +688,26 @@ static void post_mremap(ThreadId tid, UWord *args, UInt nArgs, SysRes res)
 	unsigned long new_len = args[2];
 //	unsigned long flags = args[3];
 	struct mmt_mmap_data *region, tmp;
-	int tmpi;
 
 	if (res._isError)
 		return;
 
-	region = __mmt_bsearch(start, &tmpi);
+	region = find_mmap(start);
 	if (!region)
 		return;
 
 	tmp = *region;
+	/* the region lives on under the same id, so do its counts */
+	region->counts = NULL;
 	mmt_free_region(region);
 	region = mmt_add_region(tmp.fd, res._val, res._val + new_len, tmp.offset, tmp.id);
+	region->policy = tmp.policy;
+	region->profile = tmp.profile;
+	region->counts = tmp.counts;
+	region->ranges = tmp.ranges;
+	region->ranges_num = tmp.ranges_num;
+	if (tmp.snapshot)
+		mmt_snapshot_tag(region);
 
 	mmt_bin_write_1('e');
 	mmt_bin_write_8(region->offset);
@@ -810,7 +725,13 @@ static void post_mremap(ThreadId tid, UWord *args, UInt nArgs, SysRes res)
 void mmt_post_syscall(ThreadId tid, UInt syscallno, UWord *args,
 			UInt nArgs, SysRes res)
 {
-	if (syscallno == __NR_ioctl)
+	if (mmt_timestamps)
+		mmt_bin_syscall_timestamp();
+
+	/* only failed execve returns */
+	if (syscallno == __NR_execve)
+		mmt_bin_restore_trace();
+	else if (syscallno == __NR_ioctl)
 	{
 		int fd = args[0];
 		UInt id = args[1];
@@ -839,7 +760,7 @@ void mmt_post_syscall(ThreadId tid, UInt syscallno, UWord *args,
 				mmt_bin_sync();
 			}
 
-		mmt_bin_flush();
+		mmt_bin_submit();
 	}
 	else if (syscallno == __NR_open)
 		post_open(tid, args, nArgs, res);
@@ -870,27 +791,71 @@ void mmt_post_syscall(ThreadId tid, UInt syscallno, UWord *args,
 
 			FD_SET(sr_Res(res), &trace_fds);
 		}
+
+		if (!sr_isError(res))
+			mmt_policy_dup(fd, sr_Res(res));
 	}
 }
 
 int mmt_sync_fd = -1;
+int mmt_sync_window = 1;
+/* last emitted sync marker */
 static int sync_id = 0;
+/* last sync marker confirmed by consumer */
+static int synced_id = 0;
+/* accesses traced since last sync marker */
+static int unsynced = 0;
 
-void mmt_emit_sync_and_wait(void)
+static void emit_sync(void)
 {
-	char buf[4];
 	mmt_bin_write_1('S');
 	mmt_bin_write_4(++sync_id);
 	mmt_bin_end();
 	mmt_bin_flush_and_sync();
-	int cnt = 4;
-	while (cnt)
+	unsynced = 0;
+}
+
+static void wait_for_sync(int id)
+{
+	while (synced_id < id)
 	{
-		int r = VG_(read)(mmt_sync_fd, buf + 4 - cnt, cnt);
-		mmt_assert2(r > 0, "sync failed: %d", r);
+		char buf[4];
+		int cnt = 4;
+		while (cnt)
+		{
+			int r = VG_(read)(mmt_sync_fd, buf + 4 - cnt, cnt);
+			mmt_assert2(r > 0, "sync failed: %d", r);
 
-		cnt -= r;
+			cnt -= r;
+		}
+		int ret_sync = *(int *)((void *)buf);
+		mmt_assert2(ret_sync == synced_id + 1, "%d %d", ret_sync, synced_id + 1);
+		synced_id = ret_sync;
 	}
-	int ret_sync = *(int *)((void *)buf);
-	mmt_assert2(ret_sync == sync_id, "%d %d", ret_sync, sync_id);
+}
+
+void mmt_emit_sync_and_wait(void)
+{
+	emit_sync();
+	wait_for_sync(sync_id);
+}
+
+/*
+ * Called after every traced memory access. With window of N accesses
+ * a marker is emitted every N accesses and we wait only for the previous
+ * one, so consumer can process one window while we produce the next.
+ */
+void mmt_sync_access(void)
+{
+	if (mmt_sync_window <= 1)
+	{
+		mmt_emit_sync_and_wait();
+		return;
+	}
+
+	if (++unsynced < mmt_sync_window)
+		return;
+
+	emit_sync();
+	wait_for_sync(sync_id - 1);
 }
@@ -2,6 +2,7 @@
 #define MMT_TRACE_H_
 
 #include "pub_tool_basics.h"
+#include "pub_tool_hashtable.h"
 
 #include <sys/select.h>
 
@@ -13,7 +14,15 @@
 #define MMT_DEBUG
 //#define MMT_DEBUG_VERBOSE
 #define MMT_MAX_TRACE_FILES 10
-#define MMT_MAX_REGIONS 5000
+
+struct mmt_snapshot;
+struct mmt_profile_area;
+
+/* offsets [start, end) of a region */
+struct mmt_range {
+	ULong start;
+	ULong end;
+};
 
 struct mmt_mmap_data {
 	Addr start;
@@ -21,6 +30,17 @@ struct mmt_mmap_data {
 	int fd;
 	Off64T offset;
 	UInt id;
+	/* stores are recorded in page snapshots, see mmt_snapshot.c */
+	struct mmt_snapshot *snapshot;
+	/* see mmt_policy.c */
+	int policy;
+	VgHashTable *counts;
+	/* if there are any, only accesses touching these (sorted, disjoint)
+	 * ranges are traced */
+	struct mmt_range *ranges;
+	UInt ranges_num;
+	/* see mmt_profile.c */
+	struct mmt_profile_area *profile;
 };
 
 extern fd_set trace_fds;
@@ -39,43 +59,110 @@ struct mmt_mmap_data *mmt_add_region(int fd, Addr start, Addr end,
 
 struct mmt_mmap_data *mmt_map_region(int fd, Addr start, Addr end, Off64T offset, int prot, int flags);
 void mmt_unmap_region(struct mmt_mmap_data *region);
+struct mmt_mmap_data *mmt_find_region_by_offset(int fd, Off64T offset);
+void mmt_for_each_region(void (*fn)(struct mmt_mmap_data *region, void *arg),
+		void *arg);
 
 void mmt_pre_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs);
 
 void mmt_post_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs, SysRes res);
 
 void mmt_dump_open(UWord *args, SysRes res);
-
-struct mmt_mmap_data *__find_mmap_slow(Addr addr);
+void mmt_trace_inherited_fds(void);
 
 #define force_inline	inline __attribute__((always_inline))
 
-struct negative_region {
-	Addr start, end;
-	int score;
+/*
+ * Traced regions are indexed by page. Page table has 3 levels of
+ * MMT_PT_BITS bits each, intermediate levels are allocated on demand
+ * and released when they become empty.
+ */
+#define MMT_PAGE_SHIFT 12
+#define MMT_PT_BITS 12
+#define MMT_PT_MASK ((1UL << MMT_PT_BITS) - 1)
+#ifdef MMT_64BIT
+/* 48-bit address space */
+#define MMT_PT_PAGES (1UL << (3 * MMT_PT_BITS))
+#define MMT_PT_TOP_SIZE (1UL << MMT_PT_BITS)
+#else
+#define MMT_PT_PAGES (1UL << (32 - MMT_PAGE_SHIFT))
+#define MMT_PT_TOP_SIZE 1
+#endif
+
+struct mmt_page_leaf {
+	struct mmt_mmap_data *regions[1 << MMT_PT_BITS];
+	UInt used;
 };
 
-extern struct negative_region neg_regions[];
+struct mmt_page_dir {
+	struct mmt_page_leaf *leaves[1 << MMT_PT_BITS];
+	UInt used;
+};
+
+extern struct mmt_page_dir *mmt_page_table[MMT_PT_TOP_SIZE];
+
+/*
+ * Number of traced regions touching each granule (hashed by address bits
+ * above MMT_GRANULE_SHIFT). Tested inline by instrumented code, so accesses
+ * to granules without any traced region do not call into the tool at all.
+ */
+#define MMT_GRANULE_SHIFT 16
+#define MMT_GRANULE_MAP_BITS 16
+#define MMT_GRANULE_MAP_SIZE (1 << MMT_GRANULE_MAP_BITS)
+
+extern UInt mmt_granule_map[MMT_GRANULE_MAP_SIZE];
+extern int mmt_inline_filter;
 extern struct mmt_mmap_data *last_used_region;
 extern int all_mem;
 
 static force_inline struct mmt_mmap_data *find_mmap(Addr addr)
 {
-	struct negative_region *neg = neg_regions;
-
-	if (LIKELY(addr >= neg->start && addr < neg->end))
-	{
-		neg->score++;
-		return NULL;
-	}
+	UWord page = addr >> MMT_PAGE_SHIFT;
+	struct mmt_page_dir *dir;
+	struct mmt_page_leaf *leaf;
+	struct mmt_mmap_data *region;
 
 	if (LIKELY(addr >= last_used_region->start && addr < last_used_region->end))
 		return last_used_region;
 
-	return __find_mmap_slow(addr);
+#ifdef MMT_64BIT
+	if (UNLIKELY(page >= MMT_PT_PAGES))
+		return NULL;
+#endif
+
+	dir = mmt_page_table[page >> (2 * MMT_PT_BITS)];
+	if (LIKELY(!dir))
+		return NULL;
+
+	leaf = dir->leaves[(page >> MMT_PT_BITS) & MMT_PT_MASK];
+	if (LIKELY(!leaf))
+		return NULL;
+
+	region = leaf->regions[page & MMT_PT_MASK];
+	if (region)
+		last_used_region = region;
+
+	return region;
+}
+
+Bool mmt_range_hit(const struct mmt_mmap_data *region, ULong offset, UInt len);
+
+/* find_mmap for an access of len bytes, NULL also if it is outside of
+ * traced ranges of the region (--mmt-trace-range) */
+static force_inline struct mmt_mmap_data *find_traced_mmap(Addr addr, UInt len)
+{
+	struct mmt_mmap_data *region = find_mmap(addr);
+
+	if (LIKELY(!region) || LIKELY(!region->ranges_num))
+		return region;
+	if (!mmt_range_hit(region, addr - region->start, len))
+		return NULL;
+	return region;
 }
 
 extern int mmt_sync_fd;
+extern int mmt_sync_window;
 void mmt_emit_sync_and_wait(void);
+void mmt_sync_access(void);
 
 #endif /* MMT_TRACE_H_ */
@@ -21,13 +21,26 @@
    The GNU General Public License is contained in the file COPYING.
 */
 
+#include "pub_tool_aspacemgr.h"
 #include "pub_tool_debuginfo.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_options.h"
+#include "pub_tool_vki.h"
 #include "pub_tool_vkiscnums.h"
+#include "coregrind/pub_core_options.h"
 #include "coregrind/pub_core_syscall.h"
 
+#include "mmt_blob.h"
+#include "mmt_policy.h"
+#include "mmt_profile.h"
+#include "mmt_snapshot.h"
 #include "mmt_trace_bin.h"
+#include "mmt_ring.h"
+#include "mmt_writer.h"
 
-static void mydescribe(Addr inst_addr, char *namestr, int len)
+void mydescribe(Addr inst_addr, char *namestr, int len)
 {
 	DiEpoch ep = VG_(current_DiEpoch)();
 	const char* filename;
@@ -42,30 +55,11 @@ static void mydescribe(Addr inst_addr, char *namestr, int len)
 		VG_(snprintf) (namestr, len, "@%08lx", inst_addr);
 }
 
-#define print_begin(type) do { \
-		mmt_bin_write_1(type); \
-		mmt_bin_write_4(region->id); \
-		mmt_bin_write_4((UInt)(addr - region->start)); \
-	} while (0)
-
-#define print_begin2(type) do { \
-		mmt_bin_write_1(type); \
-		mmt_bin_write_8(addr); \
-	} while (0)
+#define print_store_begin() \
+		struct mmt_access acc = { .len = 0 }
 
-#define print_store_begin() do { \
-		if (all_mem) \
-			print_begin2('W'); \
-		else \
-			print_begin('w'); \
-	} while (0)
-
-#define print_load_begin() do { \
-		if (all_mem) \
-			print_begin2('R'); \
-		else \
-			print_begin('r'); \
-	} while (0)
+#define print_load_begin() \
+		struct mmt_access acc = { .len = 0 }
 
 #define print_info(type, namestr) do { \
 		mmt_bin_write_1(type); \
@@ -73,56 +67,81 @@ static void mydescribe(Addr inst_addr, char *namestr, int len)
 		mmt_bin_end(); \
 	} while (0)
 
-#define print_load_info() \
-		print_info('s', namestr)
+#define print_load_info() do { \
+		char namestr[256]; \
+		if (region && (region->policy != MMT_POLICY_TRACE || region->profile)) \
+			break; \
+		mmt_snapshot_barrier(); \
+		mydescribe(inst_addr, namestr, 256); \
+		print_info('s', namestr); \
+	} while (0)
 
-#define print_store_info() \
-		print_info('x', namestr)
+#define print_store_info() do { \
+		char namestr[256]; \
+		if (region && (region->policy != MMT_POLICY_TRACE || region->profile || \
+				region->snapshot)) \
+			break; \
+		mmt_snapshot_barrier(); \
+		mydescribe(inst_addr, namestr, 256); \
+		print_info('x', namestr); \
+	} while (0)
+
+#define print_value(value, size) do { \
+		UWord __v = value; \
+		VG_(memcpy)(acc.data + acc.len, &__v, size); \
+		acc.len += size; \
+	} while (0)
 
 #define print_1(value) \
-		mmt_bin_write_1(1); \
-		mmt_bin_write_1(value);
+		print_value(value, 1);
 
 #define print_2(value) \
-		mmt_bin_write_1(2); \
-		mmt_bin_write_2(value);
+		print_value(value, 2);
 
 #define print_4(value) \
-		mmt_bin_write_1(4); \
-		mmt_bin_write_4(value);
+		print_value(value, 4);
 
 #define print_4_4(value1, value2) \
-		mmt_bin_write_1(8); \
-		mmt_bin_write_4(value2); \
-		mmt_bin_write_4(value1);
-
-#define print_4_4_4_4(value1, value2, value3, value4) \
-		mmt_bin_write_1(16); \
-		mmt_bin_write_4(value4); \
-		mmt_bin_write_4(value3); \
-		mmt_bin_write_4(value2); \
-		mmt_bin_write_4(value1);
+		print_value(value2, 4); \
+		print_value(value1, 4);
 
 #define print_8(value) \
-		mmt_bin_write_1(8); \
-		mmt_bin_write_8(value);
+		print_value(value, 8);
 
-#define print_8_8(value1, value2) \
-		mmt_bin_write_1(16); \
-		mmt_bin_write_8(value2); \
-		mmt_bin_write_8(value1);
+#define print_str(str) mmt_bin_write_str(str)
 
-#define print_8_8_8_8(value1, value2, value3, value4) \
-		mmt_bin_write_1(32); \
-		mmt_bin_write_8(value4); \
-		mmt_bin_write_8(value3); \
-		mmt_bin_write_8(value2); \
-		mmt_bin_write_8(value1);
+/* returns False if access was not written out (yet) */
+static inline int trace_access(UChar type, struct mmt_mmap_data *region,
+		Addr addr, const UChar *data, UInt len, Addr inst_addr)
+{
+	if (UNLIKELY(region && region->policy != MMT_POLICY_TRACE))
+	{
+		if (region->policy == MMT_POLICY_COUNT)
+			mmt_policy_count(region, type, addr);
+		return False;
+	}
 
-#define print_str(str) mmt_bin_write_str(str)
+	if (UNLIKELY(region && region->profile))
+	{
+		mmt_profile_access(region, type, addr, data, len, inst_addr);
+		return False;
+	}
 
-#define print_store_end() do { mmt_bin_end(); mmt_bin_sync(); } while (0)
-#define print_load_end() do { mmt_bin_end(); mmt_bin_sync(); } while (0)
+	if (UNLIKELY(region && region->snapshot) && type == 'w')
+	{
+		mmt_snapshot_mark(region, addr, len);
+		return False;
+	}
+
+	mmt_snapshot_barrier();
+	mmt_bin_write_access(type, region, addr, data, len);
+	return True;
+}
+
+#define print_store_end() do { if (trace_access('w', region, addr, acc.data, acc.len, 0)) mmt_bin_sync_access(); } while (0)
+#define print_load_end() do { if (trace_access('r', region, addr, acc.data, acc.len, 0)) mmt_bin_sync_access(); } while (0)
+#define print_store_end_ia() do { if (trace_access('w', region, addr, acc.data, acc.len, inst_addr)) mmt_bin_sync_access(); } while (0)
+#define print_load_end_ia() do { if (trace_access('r', region, addr, acc.data, acc.len, inst_addr)) mmt_bin_sync_access(); } while (0)
 
 VG_REGPARM(2)
 void mmt_trace_store_bin_1(Addr addr, UWord value)
@@ -131,7 +150,7 @@ void mmt_trace_store_bin_1(Addr addr, UWord value)
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 1);
 		if (LIKELY(!region))
 			return;
 	}
@@ -145,21 +164,18 @@ VG_REGPARM(2)
 void mmt_trace_store_bin_1_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 1);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_store_info();
 	print_store_begin();
 	print_1(value);
-	print_store_end();
+	print_store_end_ia();
 }
 
 VG_REGPARM(2)
@@ -169,7 +185,7 @@ void mmt_trace_store_bin_2(Addr addr, UWord value)
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 2);
 		if (LIKELY(!region))
 			return;
 	}
@@ -183,21 +199,18 @@ VG_REGPARM(2)
 void mmt_trace_store_bin_2_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 2);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_store_info();
 	print_store_begin();
 	print_2(value);
-	print_store_end();
+	print_store_end_ia();
 }
 
 VG_REGPARM(2)
@@ -207,7 +220,7 @@ void mmt_trace_store_bin_4(Addr addr, UWord value)
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 4);
 		if (LIKELY(!region))
 			return;
 	}
@@ -221,21 +234,18 @@ VG_REGPARM(2)
 void mmt_trace_store_bin_4_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 4);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_store_info();
 	print_store_begin();
 	print_4(value);
-	print_store_end();
+	print_store_end_ia();
 }
 
 #ifdef MMT_64BIT
@@ -246,7 +256,7 @@ void mmt_trace_store_bin_8(Addr addr, UWord value)
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
@@ -260,21 +270,18 @@ VG_REGPARM(2)
 void mmt_trace_store_bin_8_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_store_info();
 	print_store_begin();
 	print_8(value);
-	print_store_end();
+	print_store_end_ia();
 }
 #endif
 
@@ -285,7 +292,7 @@ void mmt_trace_store_bin_4_4(Addr addr, UWord value1, UWord value2)
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
@@ -299,463 +306,720 @@ VG_REGPARM(2)
 void mmt_trace_store_bin_4_4_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_store_info();
 	print_store_begin();
 	print_4_4(value1, value2);
-	print_store_end();
+	print_store_end_ia();
 }
 
-#ifdef MMT_64BIT
 VG_REGPARM(2)
-void mmt_trace_store_bin_8_8(Addr addr, UWord value1, UWord value2)
+void mmt_trace_load_bin_1(Addr addr, UWord value)
 {
 	struct mmt_mmap_data *region = NULL;
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 1);
 		if (LIKELY(!region))
 			return;
 	}
 
-	print_store_begin();
-	print_8_8(value1, value2);
-	print_store_end();
+	print_load_begin();
+	print_1(value);
+	print_load_end();
 }
 
 VG_REGPARM(2)
-void mmt_trace_store_bin_8_8_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr)
+void mmt_trace_load_bin_1_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 1);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
-	print_store_info();
-	print_store_begin();
-	print_8_8(value1, value2);
-	print_store_end();
+	print_load_info();
+	print_load_begin();
+	print_1(value);
+	print_load_end_ia();
 }
 
 VG_REGPARM(2)
-void mmt_trace_store_bin_8_8_8_8(Addr addr, UWord value1, UWord value2,
-		UWord value3, UWord value4)
+void mmt_trace_load_bin_2(Addr addr, UWord value)
 {
 	struct mmt_mmap_data *region = NULL;
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 2);
 		if (LIKELY(!region))
 			return;
 	}
 
-	print_store_begin();
-	print_8_8_8_8(value1, value2, value3, value4);
-	print_store_end();
+	print_load_begin();
+	print_2(value);
+	print_load_end();
 }
 
 VG_REGPARM(2)
-void mmt_trace_store_bin_8_8_8_8_ia(Addr addr, UWord value1, UWord value2,
-		UWord value3, UWord value4, UWord inst_addr)
+void mmt_trace_load_bin_2_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 2);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
-	print_store_info();
-	print_store_begin();
-	print_8_8_8_8(value1, value2, value3, value4);
-	print_store_end();
+	print_load_info();
+	print_load_begin();
+	print_2(value);
+	print_load_end_ia();
 }
-#endif
 
-#ifndef MMT_64BIT
 VG_REGPARM(2)
-void mmt_trace_store_bin_4_4_4_4(Addr addr, UWord value1, UWord value2,
-		UWord value3, UWord value4)
+void mmt_trace_load_bin_4(Addr addr, UWord value)
 {
 	struct mmt_mmap_data *region = NULL;
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 4);
 		if (LIKELY(!region))
 			return;
 	}
 
-	print_store_begin();
-	print_4_4_4_4(value1, value2, value3, value4);
-	print_store_end();
+	print_load_begin();
+	print_4(value);
+	print_load_end();
 }
+
 VG_REGPARM(2)
-void mmt_trace_store_bin_4_4_4_4_ia(Addr addr, UWord value1, UWord value2,
-		UWord value3, UWord value4, Addr inst_addr)
+void mmt_trace_load_bin_4_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 4);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
-	print_store_info();
-	print_store_begin();
-	print_4_4_4_4(value1, value2, value3, value4);
-	print_store_end();
+	print_load_info();
+	print_load_begin();
+	print_4(value);
+	print_load_end_ia();
 }
-#endif
 
+#ifdef MMT_64BIT
 VG_REGPARM(2)
-void mmt_trace_load_bin_1(Addr addr, UWord value)
+void mmt_trace_load_bin_8(Addr addr, UWord value)
 {
 	struct mmt_mmap_data *region = NULL;
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
 
 	print_load_begin();
-	print_1(value);
+	print_8(value);
 	print_load_end();
 }
 
 VG_REGPARM(2)
-void mmt_trace_load_bin_1_ia(Addr addr, UWord value, Addr inst_addr)
+void mmt_trace_load_bin_8_ia(Addr addr, UWord value, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_load_info();
 	print_load_begin();
-	print_1(value);
-	print_load_end();
+	print_8(value);
+	print_load_end_ia();
 }
+#endif
 
 VG_REGPARM(2)
-void mmt_trace_load_bin_2(Addr addr, UWord value)
+void mmt_trace_load_bin_4_4(Addr addr, UWord value1, UWord value2)
 {
 	struct mmt_mmap_data *region = NULL;
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
 
 	print_load_begin();
-	print_2(value);
+	print_4_4(value1, value2);
 	print_load_end();
 }
 
 VG_REGPARM(2)
-void mmt_trace_load_bin_2_ia(Addr addr, UWord value, Addr inst_addr)
+void mmt_trace_load_bin_4_4_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, 8);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_load_info();
 	print_load_begin();
-	print_2(value);
-	print_load_end();
+	print_4_4(value1, value2);
+	print_load_end_ia();
 }
 
-VG_REGPARM(2)
-void mmt_trace_load_bin_4(Addr addr, UWord value)
+UChar mmt_bulk_data[MMT_BULK_MAX];
+
+/* traces parts of the run within traced ranges of the region */
+static void trace_bulk_ranges(UChar type, struct mmt_mmap_data *region,
+		Addr addr, const UChar *data, UWord len, Addr inst_addr)
 {
-	struct mmt_mmap_data *region = NULL;
+	ULong off = addr - region->start;
+	UInt i;
 
-	if (LIKELY(!all_mem))
+	for (i = 0; i < region->ranges_num; ++i)
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		const struct mmt_range *r = &region->ranges[i];
+		ULong start = off > r->start ? off : r->start;
+		ULong end = off + len < r->end ? off + len : r->end;
+
+		if (start >= end)
+			continue;
+		if (trace_access(type, region, region->start + start,
+				data + (start - off), end - start, inst_addr))
+			mmt_bin_sync_access();
 	}
-
-	print_load_begin();
-	print_4(value);
-	print_load_end();
 }
 
-VG_REGPARM(2)
-void mmt_trace_load_bin_4_ia(Addr addr, UWord value, Addr inst_addr)
+/* data of the whole access is in mmt_bulk_data */
+static void trace_bulk(UChar type, Addr addr, UWord len, Addr inst_addr)
 {
-	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
+	UWord pos = 0;
 
-	if (LIKELY(!all_mem))
+	if (all_mem)
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		trace_access(type, NULL, addr, mmt_bulk_data, len, inst_addr);
+		mmt_bin_sync_access();
+		return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
+	/* run may cross region boundaries */
+	while (pos < len)
+	{
+		Addr cur = addr + pos;
+		struct mmt_mmap_data *region = find_mmap(cur);
+		UWord cnt;
+
+		if (!region)
+		{
+			/* regions are page aligned */
+			pos += VG_ROUNDUP(cur + 1, VKI_PAGE_SIZE) - cur;
+			continue;
+		}
+
+		cnt = len - pos;
+		if (cnt > region->end - cur)
+			cnt = region->end - cur;
+
+		if (UNLIKELY(region->ranges_num))
+			trace_bulk_ranges(type, region, cur, mmt_bulk_data + pos, cnt,
+					inst_addr);
+		else if (trace_access(type, region, cur, mmt_bulk_data + pos, cnt, inst_addr))
+			mmt_bin_sync_access();
+		pos += cnt;
+	}
+}
 
-	print_load_info();
-	print_load_begin();
-	print_4(value);
-	print_load_end();
+VG_REGPARM(2)
+void mmt_trace_store_bin_bulk(Addr addr, UWord len)
+{
+	trace_bulk('w', addr, len, 0);
 }
 
-#ifdef MMT_64BIT
 VG_REGPARM(2)
-void mmt_trace_load_bin_8(Addr addr, UWord value)
+void mmt_trace_store_bin_bulk_ia(Addr addr, UWord len, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, len);
+		if (!region)
+			region = find_traced_mmap(addr + len - 1, 1);
 		if (LIKELY(!region))
 			return;
 	}
 
-	print_load_begin();
-	print_8(value);
-	print_load_end();
+	print_store_info();
+	trace_bulk('w', addr, len, inst_addr);
 }
 
 VG_REGPARM(2)
-void mmt_trace_load_bin_8_ia(Addr addr, UWord value, Addr inst_addr)
+void mmt_trace_load_bin_bulk(Addr addr, UWord len)
+{
+	trace_bulk('r', addr, len, 0);
+}
+
+VG_REGPARM(2)
+void mmt_trace_load_bin_bulk_ia(Addr addr, UWord len, Addr inst_addr)
 {
 	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
 
 	if (LIKELY(!all_mem))
 	{
-		region = find_mmap(addr);
+		region = find_traced_mmap(addr, len);
+		if (!region)
+			region = find_traced_mmap(addr + len - 1, 1);
 		if (LIKELY(!region))
 			return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
 	print_load_info();
-	print_load_begin();
-	print_8(value);
-	print_load_end();
+	trace_bulk('r', addr, len, inst_addr);
 }
-#endif
 
-VG_REGPARM(2)
-void mmt_trace_load_bin_4_4(Addr addr, UWord value1, UWord value2)
+#define BUF_SIZE MMT_WRITER_CHUNK_SIZE
+static char static_buffer[BUF_SIZE];
+static char *buffer = static_buffer;
+static int written = 0;
+
+int mmt_trace_format = 1;
+HChar *mmt_stats_file = NULL;
+
+static ULong stats_accesses, stats_bytes;
+static UInt stats_start;
+
+int mmt_timestamps = False;
+static UInt ts_pid;
+/* stream position (stats_bytes + written) after the last 'T' record */
+static ULong ts_pos;
+/* bytes of access records written since then */
+static ULong ts_access_bytes;
+
+/* minimal distance between 'T' records in a stream of accesses */
+#define TS_ACCESS_INTERVAL 4096
+
+/* state of compact (v2) access records */
+static struct
 {
-	struct mmt_mmap_data *region = NULL;
+	int valid;
+	UInt region_id;
+	ULong offset;
+	UChar type;
+	UChar data[MMT_BULK_MAX];
+	UInt len;
+
+	/* number of not yet written repetitions of last access */
+	UInt repeats;
+	/* time of the first repetition, with --mmt-timestamps */
+	ULong poll_start;
+} last;
+
+/* maximum size of values of a range record */
+#define RUN_MAX 4096
+/* shorter runs are written as separate accesses */
+#define RUN_MIN 3
+
+/* writes of the same size at a constant stride, not written out yet */
+static struct
+{
+	UInt count;
+	UInt region_id;
+	ULong start;
+	Long stride;
+	UInt len;
+	UChar data[RUN_MAX];
+} run;
+
+static void flush_repeats(void);
+static void flush_run(void);
+
+static ULong time_ns(void)
+{
+	struct vki_timespec ts;
 
-	if (LIKELY(!all_mem))
+	VG_(do_syscall2)(__NR_clock_gettime, VKI_CLOCK_MONOTONIC, (UWord)&ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void reserve(int len)
+{
+	if (UNLIKELY(last.repeats))
+		flush_repeats();
+	if (UNLIKELY(run.count))
+		flush_run();
+	if (BUF_SIZE - written < len)
+		mmt_bin_submit();
+}
+
+static inline void put_varint(ULong val)
+{
+	reserve(10);
+	while (val >= 0x80)
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		buffer[written++] = (val & 0x7f) | 0x80;
+		val >>= 7;
 	}
+	buffer[written++] = val;
+}
 
-	print_load_begin();
-	print_4_4(value1, value2);
-	print_load_end();
+static void flush_repeats(void)
+{
+	UInt cnt = last.repeats;
+
+	last.repeats = 0;
+	mmt_bin_write_1(MMT_V2_ACCESS | MMT_V2_REPEAT);
+	put_varint(cnt);
+
+	/*
+	 * With --mmt-timestamps, a run of repeated reads (a polling loop) is
+	 * followed by
+	 *
+	 *   'p' first(8) end(8) '\n'
+	 *
+	 * - time of the first repetition and of the end of the run (when
+	 * something else was traced).
+	 */
+	if (UNLIKELY(mmt_timestamps))
+	{
+		mmt_bin_write_1('p');
+		mmt_bin_write_8(last.poll_start);
+		mmt_bin_write_8(time_ns());
+		mmt_bin_end();
+	}
 }
 
-VG_REGPARM(2)
-void mmt_trace_load_bin_4_4_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr)
+static void write_header(void)
 {
-	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
+	last.valid = False;
+	last.repeats = 0;
 
-	if (LIKELY(!all_mem))
+	mmt_bin_write_1('v');
+	mmt_bin_write_4(mmt_trace_format);
+	mmt_bin_end();
+}
+
+static void put_access_v2(UChar type, UInt region_id, ULong offset,
+		const UChar *data, UInt len, UInt count, Long stride)
+{
+	UChar hdr = MMT_V2_ACCESS;
+	Int size_log2 = VG_(log2)(len);
+	Long delta;
+
+	if (type == 'w')
+		hdr |= MMT_V2_WRITE;
+	if (size_log2 < 0 || size_log2 >= MMT_V2_SIZE_VAR)
+		size_log2 = MMT_V2_SIZE_VAR;
+	hdr |= size_log2 << MMT_V2_SIZE_SHIFT;
+	if (!last.valid || region_id != last.region_id)
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		hdr |= MMT_V2_REGION;
+		last.offset = 0;
+	}
+	if (count > 1)
+		hdr |= MMT_V2_RANGE;
+
+	delta = offset - last.offset;
+
+	mmt_bin_write_1(hdr);
+	if (size_log2 == MMT_V2_SIZE_VAR)
+		put_varint(len);
+	if (hdr & MMT_V2_REGION)
+		put_varint(region_id);
+	/* zigzag, so small negative deltas are small too */
+	put_varint(((ULong)delta << 1) ^ (ULong)(delta >> 63));
+	if (count > 1)
+	{
+		put_varint(count);
+		put_varint(((ULong)stride << 1) ^ (ULong)(stride >> 63));
 	}
 
-	mydescribe(inst_addr, namestr, 256);
+	reserve(len * count);
+	VG_(memcpy)(buffer + written, data, len * count);
+	written += len * count;
 
-	print_load_info();
-	print_load_begin();
-	print_4_4(value1, value2);
-	print_load_end();
+	last.valid = True;
+	last.type = type;
+	last.region_id = region_id;
+	last.offset = offset + (count - 1) * stride;
+	VG_(memcpy)(last.data, data + (count - 1) * len, len);
+	last.len = len;
 }
 
-#ifdef MMT_64BIT
-VG_REGPARM(2)
-void mmt_trace_load_bin_8_8(Addr addr, UWord value1, UWord value2)
+static void flush_run(void)
 {
-	struct mmt_mmap_data *region = NULL;
+	UInt cnt = run.count, i;
 
-	if (LIKELY(!all_mem))
+	run.count = 0;
+	if (cnt >= RUN_MIN)
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		put_access_v2('w', run.region_id, run.start, run.data, run.len, cnt,
+				run.stride);
+		return;
 	}
 
-	print_load_begin();
-	print_8_8(value1, value2);
-	print_load_end();
+	for (i = 0; i < cnt; ++i)
+		put_access_v2('w', run.region_id, run.start + i * run.stride,
+				run.data + i * run.len, run.len, 1, 0);
 }
 
-VG_REGPARM(2)
-void mmt_trace_load_bin_8_8_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr)
+static void write_access_v2(UChar type, UInt region_id, ULong offset,
+		const UChar *data, UInt len)
 {
-	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
-
-	if (LIKELY(!all_mem))
+	if (type == 'w')
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
+		/* uploads to buffers and pushes to fifos: extend the run, if this
+		 * write continues it */
+		if (run.count && region_id == run.region_id && len == run.len &&
+				(run.count + 1) * len <= RUN_MAX &&
+				(run.count == 1 || offset == run.start + run.count * run.stride))
+		{
+			if (run.count == 1)
+				run.stride = offset - run.start;
+			VG_(memcpy)(run.data + run.count * len, data, len);
+			run.count++;
 			return;
+		}
+
+		if (run.count)
+			flush_run();
+		run.region_id = region_id;
+		run.start = offset;
+		run.stride = 0;
+		run.len = len;
+		VG_(memcpy)(run.data, data, len);
+		run.count = 1;
+		return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
+	if (UNLIKELY(run.count))
+		flush_run();
 
-	print_load_info();
-	print_load_begin();
-	print_8_8(value1, value2);
-	print_load_end();
+	if (last.valid && last.type == 'r' &&
+			last.region_id == region_id && last.offset == offset &&
+			last.len == len && VG_(memcmp)(last.data, data, len) == 0)
+	{
+		/* polling the same register */
+		if (last.repeats++ == 0 && UNLIKELY(mmt_timestamps))
+			last.poll_start = time_ns();
+		return;
+	}
+
+	put_access_v2(type, region_id, offset, data, len, 1, 0);
 }
 
-VG_REGPARM(2)
-void mmt_trace_load_bin_8_8_8_8(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4)
+/*
+ * With --mmt-timestamps, groups of records are closed by
+ *
+ *   'T' pid(4) time(8) '\n'
+ *
+ * where time is CLOCK_MONOTONIC in ns, taken after the last record of the
+ * group was written. Groups are closed on entry to and exit from syscalls
+ * (if anything other than accesses was written since the previous one)
+ * and every few KB of accesses. mmt-merge interleaves groups from traces of many processes
+ * by time, so a group does not depend on state (compact access records)
+ * left by the previous one.
+ */
+void mmt_bin_timestamp(void)
 {
-	struct mmt_mmap_data *region = NULL;
+	if (stats_bytes + written == ts_pos && !last.repeats && !run.count)
+		return;
 
-	if (LIKELY(!all_mem))
-	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
-	}
+	mmt_bin_write_1('T');
+	mmt_bin_write_4(ts_pid);
+	mmt_bin_write_8(time_ns());
+	mmt_bin_end();
 
-	print_load_begin();
-	print_8_8_8_8(value1, value2, value3, value4);
-	print_load_end();
+	ts_pos = stats_bytes + written;
+	ts_access_bytes = 0;
+	last.valid = False;
 }
 
-VG_REGPARM(2)
-void mmt_trace_load_bin_8_8_8_8_ia(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4, Addr inst_addr)
+void mmt_bin_syscall_timestamp(void)
 {
-	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
+	/* Nothing but accesses since the last 'T' - do not split them from
+	 * the accesses after the syscall, so polling loops calling e.g.
+	 * nanosleep are still collapsed into repeats. */
+	if (stats_bytes + written - ts_pos == ts_access_bytes)
+		return;
 
-	if (LIKELY(!all_mem))
+	mmt_bin_timestamp();
+}
+
+/*
+ * valgrind started by execve of a traced child opens the log file again
+ * and, as the pid does not change, truncates the trace written before
+ * execve. Move it out of the way (to name.1, name.2, ...), so mmt-merge
+ * gets all of it. Children valgrind does not follow keep writing to the
+ * log file, and if execve fails, mmt_bin_restore_trace moves it back.
+ */
+static HChar *kept_path, *kept_name;
+
+void mmt_bin_keep_trace(const HChar *exe, const HChar **argv)
+{
+	HChar link[64], path[VKI_PATH_MAX], *name;
+	struct vg_stat st;
+	SSizeT len;
+	UInt i;
+
+	if (mmt_ring_active() || VG_(log_output_sink).type != VgLogTo_File)
+		return;
+
+	/* as the execve wrapper decides */
+	if (!exe || !VG_(am_is_valid_for_client)((Addr)exe, 1, VKI_PROT_READ))
+		return;
+	if (argv && argv[0] == NULL)
+		argv = NULL;
+	if (!VG_(should_we_trace_this_child)(exe, argv))
+		return;
+
+	VG_(snprintf)(link, sizeof(link), "/proc/self/fd/%d",
+			VG_(log_output_sink).fd);
+	len = VG_(readlink)(link, path, sizeof(path) - 1);
+	if (len <= 0 || path[0] != '/')
+		return;
+	path[len] = 0;
+
+	name = VG_(malloc)("mmt.keep_trace", len + 12);
+	for (i = 1; ; ++i)
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		VG_(sprintf)(name, "%s.%u", path, i);
+		if (sr_isError(VG_(stat)(name, &st)))
+			break;
+	}
+	if (VG_(rename)(path, name) != 0)
+	{
+		VG_(message)(Vg_UserMsg, "cannot rename %s to %s\n", path, name);
+		VG_(free)(name);
+		return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
-
-	print_load_info();
-	print_load_begin();
-	print_8_8_8_8(value1, value2, value3, value4);
-	print_load_end();
+	kept_path = VG_(strdup)("mmt.keep_trace", path);
+	kept_name = name;
 }
-#endif
 
-#ifndef MMT_64BIT
-VG_REGPARM(2)
-void mmt_trace_load_bin_4_4_4_4(Addr addr, UWord value1, UWord value2,
-		UWord value3, UWord value4)
+void mmt_bin_restore_trace(void)
 {
-	struct mmt_mmap_data *region = NULL;
+	if (!kept_name)
+		return;
 
-	if (LIKELY(!all_mem))
+	if (VG_(rename)(kept_name, kept_path) != 0)
+		VG_(message)(Vg_UserMsg, "cannot rename %s to %s\n", kept_name,
+				kept_path);
+	VG_(free)(kept_name);
+	VG_(free)(kept_path);
+	kept_name = kept_path = NULL;
+}
+
+static inline void write_access(UChar type, struct mmt_mmap_data *region, Addr addr,
+		const UChar *data, UInt len)
+{
+	if (mmt_trace_format == 2)
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		if (region)
+			write_access_v2(type, region->id, addr - region->start, data, len);
+		else
+			write_access_v2(type, 0, addr, data, len);
+		return;
 	}
 
-	print_load_begin();
-	print_4_4_4_4(value1, value2, value3, value4);
-	print_load_end();
+	if (region)
+	{
+		mmt_bin_write_1(type);
+		mmt_bin_write_4(region->id);
+		mmt_bin_write_4((UInt)(addr - region->start));
+	}
+	else
+	{
+		mmt_bin_write_1(type == 'w' ? 'W' : 'R');
+		mmt_bin_write_8(addr);
+	}
+	mmt_bin_write_1(len);
+	reserve(len);
+	VG_(memcpy)(buffer + written, data, len);
+	written += len;
+	mmt_bin_end();
 }
-VG_REGPARM(2)
-void mmt_trace_load_bin_4_4_4_4_ia(Addr addr, UWord value1, UWord value2,
-		UWord value3, UWord value4, Addr inst_addr)
+
+void mmt_bin_write_access(UChar type, struct mmt_mmap_data *region, Addr addr,
+		const UChar *data, UInt len)
 {
-	struct mmt_mmap_data *region = NULL;
-	char namestr[256];
+	ULong pos;
 
-	if (LIKELY(!all_mem))
+	tl_assert(len <= MMT_BULK_MAX);
+
+	stats_accesses++;
+
+	if (LIKELY(!mmt_timestamps))
 	{
-		region = find_mmap(addr);
-		if (LIKELY(!region))
-			return;
+		write_access(type, region, addr, data, len);
+		return;
 	}
 
-	mydescribe(inst_addr, namestr, 256);
+	if (stats_bytes + written - ts_pos >= TS_ACCESS_INTERVAL)
+		mmt_bin_timestamp();
 
-	print_load_info();
-	print_load_begin();
-	print_4_4_4_4(value1, value2, value3, value4);
-	print_load_end();
+	pos = stats_bytes + written;
+	write_access(type, region, addr, data, len);
+	ts_access_bytes += stats_bytes + written - pos;
 }
-#endif
 
-#define BUF_SIZE 64 * 1024
-static char buffer[BUF_SIZE];
-static int written = 0;
+void mmt_bin_submit(void)
+{
+	if (UNLIKELY(last.repeats))
+		flush_repeats();
+	if (UNLIKELY(run.count))
+		flush_run();
+
+	stats_bytes += written;
+
+	if (mmt_ring_active())
+		mmt_ring_write(buffer, written);
+	else if (mmt_writer_active())
+	{
+		if (written == 0)
+			return;
+		mmt_writer_submit(written);
+		buffer = mmt_writer_get_chunk();
+	}
+	else
+		mmt_writer_write(VG_(log_output_sink).fd, buffer, written);
+	written = 0;
+}
 
 void mmt_bin_flush(void)
 {
-	VG_(write)(VG_(log_output_sink).fd, buffer, written);
-	written = 0;
+	mmt_bin_submit();
+	mmt_writer_drain();
 }
 
 void mmt_bin_flush_and_sync(void)
@@ -764,31 +1028,114 @@ void mmt_bin_flush_and_sync(void)
 	VG_(do_syscall1)(__NR_fdatasync, VG_(log_output_sink).fd);
 }
 
+static void mmt_bin_atfork_pre(ThreadId tid)
+{
+	if (mmt_timestamps)
+		mmt_bin_timestamp();
+	mmt_bin_flush();
+}
+
+static void mmt_bin_atfork_child(ThreadId tid)
+{
+	mmt_ring_detach();
+	mmt_writer_detach();
+	buffer = static_buffer;
+
+	ts_pid = VG_(getpid)();
+	ts_pos = stats_bytes + written;
+	ts_access_bytes = 0;
+
+	mmt_blob_atfork_child();
+
+	/* child may write to its own file */
+	if (mmt_trace_format != 1)
+		write_header();
+}
+
+void mmt_bin_init(void)
+{
+	stats_start = VG_(read_millisecond_timer)();
+	ts_pid = VG_(getpid)();
+
+	if (mmt_ring_file)
+	{
+		if (!mmt_ring_init())
+			VG_(message)(Vg_UserMsg,
+					"cannot create trace ring, writing trace to the log file\n");
+	}
+	else if (mmt_async_writer)
+	{
+		if (mmt_writer_init(VG_(log_output_sink).fd))
+			buffer = mmt_writer_get_chunk();
+		else
+			VG_(message)(Vg_UserMsg,
+					"cannot start trace writer, falling back to synchronous writes\n");
+	}
+
+	VG_(atfork)(mmt_bin_atfork_pre, NULL, mmt_bin_atfork_child);
+
+	if (mmt_trace_format != 1)
+		write_header();
+}
+
+static void write_stats(void)
+{
+	UInt ms = VG_(read_millisecond_timer)() - stats_start;
+	HChar *name, buf[256];
+	SysRes r;
+
+	if (ms == 0)
+		ms = 1;
+
+	name = VG_(expand_file_name)("--mmt-stats", mmt_stats_file);
+	r = VG_(open)(name, VKI_O_CREAT | VKI_O_WRONLY | VKI_O_TRUNC, 0644);
+	if (sr_isError(r))
+		VG_(message)(Vg_UserMsg, "cannot open stats file %s\n", name);
+	else
+	{
+		VG_(snprintf)(buf, sizeof(buf),
+				"%llu accesses, %llu bytes in %u.%03u s (%llu accesses/s, %llu KB/s)\n",
+				stats_accesses, stats_bytes, ms / 1000, ms % 1000,
+				stats_accesses * 1000 / ms, stats_bytes * 1000 / 1024 / ms);
+		VG_(write)(sr_Res(r), buf, VG_(strlen)(buf));
+		VG_(close)(sr_Res(r));
+	}
+	VG_(free)(name);
+}
+
+void mmt_bin_fini(void)
+{
+	if (mmt_timestamps)
+		mmt_bin_timestamp();
+	mmt_bin_flush();
+	mmt_ring_close();
+	mmt_writer_fini();
+
+	if (mmt_stats_file)
+		write_stats();
+}
+
 void mmt_bin_write_1(UChar u8)
 {
-	if (BUF_SIZE - written < 1)
-		mmt_bin_flush();
+	reserve(1);
 	VG_(memcpy)(buffer + written, &u8, 1);
 	written++;
 }
 void mmt_bin_write_2(UShort u16)
 {
-	if (BUF_SIZE - written < 2)
-		mmt_bin_flush();
+	reserve(2);
 	VG_(memcpy)(buffer + written, &u16, 2);
 	written += 2;
 }
 void mmt_bin_write_4(UInt u32)
 {
-	if (BUF_SIZE - written < 4)
-		mmt_bin_flush();
+	reserve(4);
 	VG_(memcpy)(buffer + written, &u32, 4);
 	written += 4;
 }
 void mmt_bin_write_8(ULong u64)
 {
-	if (BUF_SIZE - written < 8)
-		mmt_bin_flush();
+	reserve(8);
 	VG_(memcpy)(buffer + written, &u64, 8);
 	written += 8;
 }
@@ -801,7 +1148,7 @@ void mmt_bin_write_str(const char *str)
 	do
 	{
 		if (BUF_SIZE - written < len)
-			mmt_bin_flush();
+			mmt_bin_submit();
 		int cur = MIN(BUF_SIZE - written, len);
 		VG_(memcpy)(buffer + written, str, cur);
 		written += cur;
@@ -819,7 +1166,7 @@ void mmt_bin_write_buffer(const UChar *buf, int len)
 	do
 	{
 		if (BUF_SIZE - written < len)
-			mmt_bin_flush();
+			mmt_bin_submit();
 		int cur = MIN(BUF_SIZE - written, len);
 		VG_(memcpy)(buffer + written, buf, cur);
 		written += cur;
@@ -33,24 +33,6 @@ void mmt_trace_store_bin_4_4(Addr addr, UWord value1, UWord value2);
 VG_REGPARM(2)
 void mmt_trace_store_bin_4_4_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr);
 
-#ifdef MMT_64BIT
-	VG_REGPARM(2)
-	void mmt_trace_store_bin_8_8(Addr addr, UWord value1, UWord value2);
-	VG_REGPARM(2)
-	void mmt_trace_store_bin_8_8_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr);
-	VG_REGPARM(2)
-	void mmt_trace_store_bin_8_8_8_8(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4);
-	VG_REGPARM(2)
-	void mmt_trace_store_bin_8_8_8_8_ia(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4, Addr inst_addr);
-#endif
-
-#ifndef MMT_64BIT
-	VG_REGPARM(2)
-	void mmt_trace_store_bin_4_4_4_4(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4);
-	VG_REGPARM(2)
-	void mmt_trace_store_bin_4_4_4_4_ia(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4, Addr inst_addr);
-#endif
-
 VG_REGPARM(2)
 void mmt_trace_load_bin_1(Addr addr, UWord value);
 VG_REGPARM(2)
@@ -76,23 +58,49 @@ void mmt_trace_load_bin_4_4(Addr addr, UWord value1, UWord value2);
 VG_REGPARM(2)
 void mmt_trace_load_bin_4_4_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr);
 
-#ifdef MMT_64BIT
-	VG_REGPARM(2)
-	void mmt_trace_load_bin_8_8(Addr addr, UWord value1, UWord value2);
-	VG_REGPARM(2)
-	void mmt_trace_load_bin_8_8_ia(Addr addr, UWord value1, UWord value2, Addr inst_addr);
-	VG_REGPARM(2)
-	void mmt_trace_load_bin_8_8_8_8(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4);
-	VG_REGPARM(2)
-	void mmt_trace_load_bin_8_8_8_8_ia(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4, Addr inst_addr);
-#endif
+/* values of one memory access, in memory order */
+struct mmt_access
+{
+	UChar data[32];
+	UInt len;
+};
 
-#ifndef MMT_64BIT
-	VG_REGPARM(2)
-	void mmt_trace_load_bin_4_4_4_4(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4);
-	VG_REGPARM(2)
-	void mmt_trace_load_bin_4_4_4_4_ia(Addr addr, UWord value1, UWord value2, UWord value3, UWord value4, Addr inst_addr);
-#endif
+/* maximum length of coalesced run of stores */
+#define MMT_BULK_MAX 128
+
+/* data of a run of stores or of a vector access, filled by instrumented code */
+extern UChar mmt_bulk_data[MMT_BULK_MAX];
+
+VG_REGPARM(2)
+void mmt_trace_store_bin_bulk(Addr addr, UWord len);
+VG_REGPARM(2)
+void mmt_trace_store_bin_bulk_ia(Addr addr, UWord len, Addr inst_addr);
+VG_REGPARM(2)
+void mmt_trace_load_bin_bulk(Addr addr, UWord len);
+VG_REGPARM(2)
+void mmt_trace_load_bin_bulk_ia(Addr addr, UWord len, Addr inst_addr);
+
+/*
+ * Compact access records of format 2 have bit 7 of the first byte set,
+ * the rest of it describes what follows (see mmt_trace.c).
+ */
+#define MMT_V2_ACCESS		0x80
+#define MMT_V2_WRITE		0x40
+#define MMT_V2_SIZE_SHIFT	3
+#define MMT_V2_SIZE_VAR		7 /* size is not a power of 2, varint follows */
+#define MMT_V2_REGION		0x04
+#define MMT_V2_REPEAT		0x02
+#define MMT_V2_RANGE		0x01
+
+/* 1 - classic format, 2 - compact access records */
+extern int mmt_trace_format;
+extern HChar *mmt_stats_file;
+extern int mmt_timestamps;
+
+void mydescribe(Addr inst_addr, char *namestr, int len);
+
+void mmt_bin_write_access(UChar type, struct mmt_mmap_data *region, Addr addr,
+		const UChar *data, UInt len);
 
 void mmt_bin_write_1(UChar u8);
 void mmt_bin_write_2(UShort u16);
@@ -101,15 +109,36 @@ void mmt_bin_write_8(ULong u64);
 void mmt_bin_write_str(const char *str);
 void mmt_bin_write_buffer(const UChar *buffer, int len);
 
+/* closes a group of records with a 'T' record (--mmt-timestamps) */
+void mmt_bin_timestamp(void);
+void mmt_bin_syscall_timestamp(void);
+/* renames the log file before execve of a traced child, and back if execve
+ * fails */
+void mmt_bin_keep_trace(const HChar *exe, const HChar **argv);
+void mmt_bin_restore_trace(void);
+
+void mmt_bin_init(void);
+void mmt_bin_fini(void);
+
+/* hands buffered data over to the writer, without waiting for it */
+void mmt_bin_submit(void);
+/* writes out all buffered data */
 void mmt_bin_flush(void);
 void mmt_bin_flush_and_sync(void);
 
 #define mmt_bin_end() \
 		mmt_bin_write_1(10)
 
+/* waits until consumer processes everything emitted so far */
 #define mmt_bin_sync() do {   \
 		if (mmt_sync_fd != -1) \
 			mmt_emit_sync_and_wait(); \
 	} while (0)
 
+/* same, but may be batched (see --mmt-sync-window) */
+#define mmt_bin_sync_access() do {   \
+		if (mmt_sync_fd != -1) \
+			mmt_sync_access(); \
+	} while (0)
+
 #endif
@@ -0,0 +1,121 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Decompresses trace written with --mmt-trace-compress.
+ *
+ * Compressed trace is a sequence of 'z' blocks (see mmt_writer.c)
+ * interleaved with valgrind's text messages, which are passed through.
+ *
+ * Usage: mmt-unpack [trace] > unpacked-trace
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../coregrind/m_debuginfo/minilzo-inl.c"
+
+#include "mmt_writer.h"
+
+static unsigned char in[MMT_WRITER_CHUNK_SIZE * 2];
+static unsigned char out[MMT_WRITER_CHUNK_SIZE];
+
+static unsigned int get4(FILE *f)
+{
+	unsigned char b[4];
+
+	if (fread(b, 1, 4, f) != 4)
+	{
+		fprintf(stderr, "truncated block header\n");
+		exit(2);
+	}
+
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+}
+
+static void unpack_block(FILE *f, long pos)
+{
+	int codec = getc(f);
+	unsigned int len = get4(f);
+	unsigned int zlen = get4(f);
+	lzo_uint outlen = sizeof(out);
+
+	if (codec != MMT_COMPRESS_FAST)
+	{
+		fprintf(stderr, "unknown codec %d in block at %ld\n", codec, pos);
+		exit(2);
+	}
+	if (len > sizeof(out) || zlen + 1 > sizeof(in))
+	{
+		fprintf(stderr, "block at %ld too big\n", pos);
+		exit(2);
+	}
+	if (fread(in, 1, zlen + 1, f) != zlen + 1 || in[zlen] != '\n')
+	{
+		fprintf(stderr, "truncated block at %ld\n", pos);
+		exit(2);
+	}
+	if (lzo1x_decompress_safe(in, zlen, out, &outlen, NULL) != LZO_E_OK ||
+			outlen != len)
+	{
+		fprintf(stderr, "corrupted block at %ld\n", pos);
+		exit(2);
+	}
+
+	fwrite(out, 1, len, stdout);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdin;
+	int c;
+
+	if (argc > 2)
+	{
+		fprintf(stderr, "usage: %s [trace]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2)
+	{
+		f = fopen(argv[1], "rb");
+		if (!f)
+		{
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	while ((c = getc(f)) != EOF)
+	{
+		if (c == 'z')
+		{
+			unpack_block(f, ftell(f) - 1);
+			continue;
+		}
+
+		/* text message */
+		do
+			putchar(c);
+		while (c != '\n' && (c = getc(f)) != EOF);
+	}
+
+	return 0;
+}
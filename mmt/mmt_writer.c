@@ -0,0 +1,343 @@
+/*
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+ * Asynchronous trace writer.
+ *
+ * Trace data is collected in chunks of a ring which lives in a shared
+ * mapping of an (unlinked) temporary file. Full chunks are handed over to
+ * a helper process, which writes them to the output file descriptor and
+ * gives them back. Both directions are signalled through pipes carrying
+ * chunk sequence numbers, so the traced process blocks only when all chunks
+ * are waiting to be written.
+ *
+ * The helper is detached from the client (double fork), so it never shows
+ * up in client's wait() calls. It exits when the write end of the "ready"
+ * pipe is closed, i.e. when the traced process exits or execs.
+ *
+ * With --mmt-trace-compress every chunk is written as a self-contained
+ * 'z' record: codec (1 byte), uncompressed size (4), compressed size (4),
+ * compressed data and a newline. Readers can skip over (or hand out to other
+ * threads) whole blocks using just the header.
+ */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_libcsignal.h"
+#include "pub_tool_vkiscnums.h"
+#include "coregrind/pub_core_aspacemgr.h"
+#include "coregrind/pub_core_libcfile.h"
+#include "coregrind/pub_core_libcsignal.h"
+#include "coregrind/pub_core_syscall.h"
+#include "coregrind/m_debuginfo/minilzo.h"
+
+#include "mmt_writer.h"
+
+int mmt_async_writer = False;
+int mmt_trace_compress = MMT_COMPRESS_NONE;
+
+struct chunk_desc
+{
+	UInt seq;
+	UInt len;
+};
+
+static int active = False;
+
+static struct chunk_desc *descs;
+static char *chunks;
+
+/* sequence number of the next chunk to submit */
+static UInt head;
+/* sequence number of the oldest chunk not yet written */
+static UInt tail;
+
+/* traced process -> writer */
+static int ready_fd = -1;
+/* writer -> traced process */
+static int done_fd = -1;
+
+static int read_full(int fd, void *buf, int len)
+{
+	int cnt = 0;
+
+	while (cnt < len)
+	{
+		int r = VG_(read)(fd, (char *)buf + cnt, len - cnt);
+		if (r <= 0)
+			return cnt;
+		cnt += r;
+	}
+
+	return cnt;
+}
+
+static int write_full(int fd, const void *buf, int len)
+{
+	int cnt = 0;
+
+	while (cnt < len)
+	{
+		int r = VG_(write)(fd, (const char *)buf + cnt, len - cnt);
+		if (r <= 0)
+			return cnt;
+		cnt += r;
+	}
+
+	return cnt;
+}
+
+#define Z_HDR_SIZE (1 + 1 + 4 + 4)
+
+/* worst case LZO1X expansion */
+static UChar zbuf[Z_HDR_SIZE + MMT_WRITER_CHUNK_SIZE + MMT_WRITER_CHUNK_SIZE / 16 + 64 + 3 + 1];
+static lzo_align_t lzo_wrkmem[(LZO1X_1_MEM_COMPRESS + sizeof(lzo_align_t) - 1) / sizeof(lzo_align_t)];
+
+static int write_compressed(int fd, const char *buf, int len)
+{
+	lzo_uint zlen = sizeof(zbuf) - Z_HDR_SIZE - 1;
+	UInt u32;
+
+	if (lzo1x_1_compress((const lzo_bytep)buf, len, zbuf + Z_HDR_SIZE,
+			&zlen, lzo_wrkmem) != LZO_E_OK)
+	{
+		static int warned = False;
+
+		/* mmt-unpack will take the raw data for text messages, which
+		 * may break the rest of the trace */
+		if (!warned)
+		{
+			VG_(message)(Vg_UserMsg,
+					"trace compression failed, writing uncompressed data\n");
+			warned = True;
+		}
+		return write_full(fd, buf, len);
+	}
+
+	zbuf[0] = 'z';
+	zbuf[1] = MMT_COMPRESS_FAST;
+	u32 = len;
+	VG_(memcpy)(zbuf + 2, &u32, 4);
+	u32 = zlen;
+	VG_(memcpy)(zbuf + 6, &u32, 4);
+	zbuf[Z_HDR_SIZE + zlen] = '\n';
+
+	if (write_full(fd, zbuf, Z_HDR_SIZE + zlen + 1) != Z_HDR_SIZE + zlen + 1)
+		return 0;
+	return len;
+}
+
+int mmt_writer_write(int fd, const char *buf, int len)
+{
+	tl_assert(len <= MMT_WRITER_CHUNK_SIZE);
+
+	if (len == 0)
+		return 0;
+
+	if (mmt_trace_compress == MMT_COMPRESS_FAST)
+		return write_compressed(fd, buf, len);
+
+	return write_full(fd, buf, len);
+}
+
+static void __attribute__((noreturn)) writer_loop(int out_fd, int in_fd, int ack_fd)
+{
+	UInt seq, expected = 0;
+	vki_sigset_t all;
+
+	/* signals sent to the whole process group are not for us */
+	VG_(sigfillset)(&all);
+	VG_(sigprocmask)(VKI_SIG_SETMASK, &all, NULL);
+
+	while (read_full(in_fd, &seq, sizeof(seq)) == sizeof(seq))
+	{
+		struct chunk_desc *desc = &descs[seq % MMT_WRITER_CHUNKS];
+
+		if (seq != expected++ || desc->seq != seq)
+			break;
+
+		mmt_writer_write(out_fd, chunks + (seq % MMT_WRITER_CHUNKS) * MMT_WRITER_CHUNK_SIZE,
+				desc->len);
+
+		if (write_full(ack_fd, &seq, sizeof(seq)) != sizeof(seq))
+			break;
+	}
+
+	VG_(do_syscall1)(__NR_exit_group, 0);
+	for (;;)
+		;
+}
+
+static void *map_ring(SizeT size)
+{
+	HChar name[VG_(mkstemp_fullname_bufsz)(sizeof("mmt-ring") - 1)];
+	SysRes res;
+	int fd;
+
+	fd = VG_(mkstemp)("mmt-ring", name);
+	if (fd < 0)
+		return NULL;
+	VG_(unlink)(name);
+
+	res = VG_(do_syscall2)(__NR_ftruncate, fd, size);
+	if (sr_isError(res))
+	{
+		VG_(close)(fd);
+		return NULL;
+	}
+
+	res = VG_(am_shared_mmap_file_float_valgrind)(size,
+			VKI_PROT_READ | VKI_PROT_WRITE, fd, 0);
+	VG_(close)(fd);
+	if (sr_isError(res))
+		return NULL;
+
+	return (void *)sr_Res(res);
+}
+
+int mmt_writer_init(int out_fd)
+{
+	int ready[2], done[2];
+	int pid, status, fd;
+	SizeT descs_size = VG_ROUNDUP(MMT_WRITER_CHUNKS * sizeof(struct chunk_desc), VKI_PAGE_SIZE);
+	char *ring;
+
+	ring = map_ring(descs_size + MMT_WRITER_CHUNKS * MMT_WRITER_CHUNK_SIZE);
+	if (!ring)
+		return False;
+
+	descs = (struct chunk_desc *)ring;
+	chunks = ring + descs_size;
+
+	if (VG_(pipe)(ready) < 0)
+		return False;
+	if (VG_(pipe)(done) < 0)
+	{
+		VG_(close)(ready[0]);
+		VG_(close)(ready[1]);
+		return False;
+	}
+
+	pid = VG_(fork)();
+	if (pid == 0)
+	{
+		/* intermediate child - exit immediately, so the writer gets
+		 * reparented to init */
+		if (VG_(fork)() != 0)
+			VG_(do_syscall1)(__NR_exit_group, 0);
+
+		VG_(close)(ready[1]);
+		VG_(close)(done[0]);
+		for (fd = 0; fd <= 2; ++fd)
+			if (fd != out_fd)
+				VG_(close)(fd);
+
+		writer_loop(out_fd, ready[0], done[1]);
+	}
+
+	VG_(close)(ready[0]);
+	VG_(close)(done[1]);
+
+	if (pid < 0)
+	{
+		VG_(close)(ready[1]);
+		VG_(close)(done[0]);
+		return False;
+	}
+
+	VG_(waitpid)(pid, &status, 0);
+
+	/* move pipes out of client's reach */
+	ready_fd = VG_(safe_fd)(ready[1]);
+	done_fd = VG_(safe_fd)(done[0]);
+
+	head = tail = 0;
+	active = True;
+
+	return True;
+}
+
+int mmt_writer_active(void)
+{
+	return active;
+}
+
+static void wait_for_one(void)
+{
+	UInt seq;
+
+	tl_assert2(read_full(done_fd, &seq, sizeof(seq)) == sizeof(seq),
+			"trace writer died\n");
+	tl_assert2(seq == tail, "trace writer out of sync: %u %u\n", seq, tail);
+	tail++;
+}
+
+char *mmt_writer_get_chunk(void)
+{
+	while (head - tail >= MMT_WRITER_CHUNKS)
+		wait_for_one();
+
+	return chunks + (head % MMT_WRITER_CHUNKS) * MMT_WRITER_CHUNK_SIZE;
+}
+
+void mmt_writer_submit(int len)
+{
+	struct chunk_desc *desc = &descs[head % MMT_WRITER_CHUNKS];
+
+	tl_assert(len <= MMT_WRITER_CHUNK_SIZE);
+
+	desc->seq = head;
+	desc->len = len;
+
+	tl_assert2(write_full(ready_fd, &head, sizeof(head)) == sizeof(head),
+			"trace writer died\n");
+	head++;
+}
+
+void mmt_writer_drain(void)
+{
+	if (!active)
+		return;
+
+	while (tail != head)
+		wait_for_one();
+}
+
+/* Forget about the writer without disturbing it. Used in forked children,
+ * which share the ring and pipes with the parent. */
+void mmt_writer_detach(void)
+{
+	if (!active)
+		return;
+
+	VG_(close)(ready_fd);
+	VG_(close)(done_fd);
+	ready_fd = done_fd = -1;
+	active = False;
+}
+
+void mmt_writer_fini(void)
+{
+	mmt_writer_drain();
+	mmt_writer_detach();
+}
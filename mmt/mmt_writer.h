@@ -0,0 +1,28 @@
+#ifndef MMT_WRITER_H_
+#define MMT_WRITER_H_
+
+#include "pub_tool_basics.h"
+
+#define MMT_WRITER_CHUNKS 16
+#define MMT_WRITER_CHUNK_SIZE (64 * 1024)
+
+#define MMT_COMPRESS_NONE 0
+#define MMT_COMPRESS_FAST 1 /* LZO1X-1 */
+
+extern int mmt_async_writer;
+extern int mmt_trace_compress;
+
+int mmt_writer_init(int out_fd);
+int mmt_writer_active(void);
+
+char *mmt_writer_get_chunk(void);
+void mmt_writer_submit(int len);
+void mmt_writer_drain(void);
+
+/* writes (and compresses, if enabled) one chunk of trace */
+int mmt_writer_write(int fd, const char *buf, int len);
+
+void mmt_writer_detach(void);
+void mmt_writer_fini(void);
+
+#endif /* MMT_WRITER_H_ */
@@ -63,7 +63,10 @@ static void nl_pre_clo_init(void)
                                  nl_instrument,
                                  nl_fini);
 
-   /* No needs, no core events to track */
+   VG_(needs_persistent_translations) ();
+   VG_(needs_parallel_execution) ();
+
+   /* No core events to track */
 }
 
 VG_DETERMINE_INTERFACE_VERSION(nl_pre_clo_init)
@@ -244,6 +244,7 @@ int main(int argc, char **argv)
    vta.guest_bytes                = (UChar*) get_guest_arch;
    vta.guest_bytes_addr           = (Addr) get_guest_arch;
    vta.chase_into_ok              = return_false;
+   vta.hot_successor              = NULL;
    vta.guest_extents              = &vge;
    vta.host_bytes                 = host_bytes;
    vta.host_bytes_size            = sizeof host_bytes;
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// mmt_bench simulates a graphics driver talking to a device, for
+// measuring the throughput of the mmt tool.  The "device" is a file
+// (on tmpfs, so that it behaves like memory) which mmt traces in place
+// of /dev/nvidia*.  Modes:
+//  * poll    - polling a status register, with rare doorbell writes
+//  * bulk    - filling a big buffer object, then ringing the doorbell
+//  * maps    - many short-lived mappings with a few accesses each
+//  * compute - untraced computation, with a traced mapping touched
+//              rarely; measures the cost of instrumentation of
+//              accesses which are not traced
+
+#define DEV_SIZE (16 << 20)
+
+static int dev_fd;
+
+static volatile unsigned *map_dev(size_t size, off_t offset)
+{
+   void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  dev_fd, offset);
+   if (p == MAP_FAILED) {
+      perror("mmap");
+      exit(1);
+   }
+   return p;
+}
+
+static unsigned do_poll(void)
+{
+   volatile unsigned *regs = map_dev(1 << 16, 0);
+   unsigned sum = 0;
+   int i, j;
+
+   for (i = 0; i < 2000; i++) {
+      for (j = 0; j < 1000; j++)
+         sum += regs[0x40];
+      regs[0x10] = i;
+   }
+
+   munmap((void *)regs, 1 << 16);
+   return sum;
+}
+
+static unsigned do_bulk(void)
+{
+   volatile unsigned *regs = map_dev(1 << 16, 0);
+   volatile unsigned *bo = map_dev(4 << 20, 1 << 20);
+   unsigned words = (4 << 20) / sizeof(unsigned);
+   unsigned i, r, res;
+
+   for (r = 0; r < 4; r++) {
+      for (i = 0; i < words; i++)
+         bo[i] = i ^ r;
+      regs[0x10] = r;
+   }
+   res = bo[words - 1];
+
+   munmap((void *)bo, 4 << 20);
+   munmap((void *)regs, 1 << 16);
+   return res;
+}
+
+static unsigned do_maps(void)
+{
+   unsigned sum = 0;
+   int i;
+
+   for (i = 0; i < 20000; i++) {
+      size_t size = 4096 << (i % 5);
+      off_t offset = (off_t)(i % 64) << 16;
+      volatile unsigned *p = map_dev(size, offset);
+
+      p[0] = i;
+      p[size / sizeof(unsigned) - 1] = i;
+      sum += p[1];
+      munmap((void *)p, size);
+   }
+
+   return sum;
+}
+
+static unsigned do_compute(void)
+{
+   volatile unsigned *regs = map_dev(1 << 16, 0);
+   unsigned n = 1 << 20;
+   unsigned *a = calloc(n, sizeof(unsigned));
+   unsigned sum = 0, i, r;
+
+   for (r = 0; r < 40; r++) {
+      for (i = 0; i < n; i++)
+         a[i] = a[i] * 3 + i + r;
+      for (i = 0; i < n; i += 7)
+         sum += a[i];
+      regs[0x10] = sum;
+   }
+
+   free(a);
+   munmap((void *)regs, 1 << 16);
+   return sum;
+}
+
+int main(int argc, char **argv)
+{
+   const char *mode, *path;
+   unsigned res;
+
+   if (argc != 3) {
+      fprintf(stderr, "usage: mmt_bench poll|bulk|maps|compute <device file>\n");
+      return 1;
+   }
+   mode = argv[1];
+   path = argv[2];
+
+   dev_fd = open(path, O_RDWR | O_CREAT, 0600);
+   if (dev_fd < 0 || ftruncate(dev_fd, DEV_SIZE) < 0) {
+      perror(path);
+      return 1;
+   }
+
+   if (strcmp(mode, "poll") == 0)
+      res = do_poll();
+   else if (strcmp(mode, "bulk") == 0)
+      res = do_bulk();
+   else if (strcmp(mode, "maps") == 0)
+      res = do_maps();
+   else if (strcmp(mode, "compute") == 0)
+      res = do_compute();
+   else {
+      fprintf(stderr, "unknown mode %s\n", mode);
+      return 1;
+   }
+
+   close(dev_fd);
+   unlink(path);
+
+   printf("%u\n", res);
+   return 0;
+}